@@ -0,0 +1,412 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+#include <limits.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/*
+ * Replacement sqlite3_mem_methods selected with --allocator=NAME.
+ *
+ *   system  -- SQLite's default allocator (malloc/free)
+ *   pool    -- power-of-two size classes with free lists carved from slabs
+ *   arena   -- bump allocator; each connection starts on a fresh chunk and
+ *              a chunk is recycled once every block in it has been freed
+ *   memsys5 -- SQLite's buddy allocator over a preallocated heap
+ *
+ * Whichever is chosen is wrapped by a thin layer that counts calls, so the
+ * benchmark lines can report the allocation rate next to the throughput.
+ * Worker threads allocate at the same time, so the counts are atomic.
+ */
+
+#define ROUND8(n)  (((n) + 7) & ~7)
+#define ROUND16(n) (((n) + 15) & ~15)
+
+static sqlite3_mem_methods inner_;
+static AllocStats stats_;
+static sqlite3_mutex* mutex_;
+
+#ifdef _WIN32
+static inline void count_add(volatile int64_t* p) {
+  InterlockedIncrement64(p);
+}
+
+static inline int64_t count_load(volatile int64_t* p) {
+  return InterlockedCompareExchange64(p, 0, 0);
+}
+#else
+static inline void count_add(volatile int64_t* p) {
+  __atomic_fetch_add(p, 1, __ATOMIC_RELAXED);
+}
+
+static inline int64_t count_load(volatile int64_t* p) {
+  return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+#endif
+
+/* counting wrapper */
+static void* count_malloc(int n) {
+  count_add(&stats_.mallocs_);
+  return inner_.xMalloc(n);
+}
+
+static void count_free(void* p) {
+  count_add(&stats_.frees_);
+  inner_.xFree(p);
+}
+
+static void* count_realloc(void* p, int n) {
+  count_add(&stats_.reallocs_);
+  return inner_.xRealloc(p, n);
+}
+
+static int count_size(void* p) {
+  return inner_.xSize(p);
+}
+
+static int count_roundup(int n) {
+  return inner_.xRoundup(n);
+}
+
+static int count_init(void* app) {
+  mutex_ = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP1);
+  return inner_.xInit(inner_.pAppData);
+}
+
+static void count_shutdown(void* app) {
+  inner_.xShutdown(inner_.pAppData);
+}
+
+/*
+ * pool: classes of 16 B .. 64 KB including an 8 byte header that holds
+ * the class index, or minus the usable size for blocks too large to pool.
+ */
+#define kPoolClasses 13
+#define kPoolSlabSize (1 << 20)
+
+typedef struct PoolBlock {
+  struct PoolBlock* next_;
+} PoolBlock;
+
+static PoolBlock* pool_free_[kPoolClasses];
+static PoolBlock* pool_slabs_;
+static char* pool_slab_;
+static size_t pool_slab_left_;
+
+static int pool_class(int n) {
+  int c = 0;
+  while (c < kPoolClasses && (16 << c) < n + 8) c++;
+  return c;
+}
+
+static void* pool_malloc(int n) {
+  int c = pool_class(n);
+  int64_t* h;
+
+  if (c == kPoolClasses) {
+    h = (int64_t*)malloc(8 + ROUND8(n));
+    if (h == NULL) return NULL;
+    *h = -(int64_t)ROUND8(n);
+    return h + 1;
+  }
+
+  sqlite3_mutex_enter(mutex_);
+  if (pool_free_[c] != NULL) {
+    h = (int64_t*)pool_free_[c];
+    pool_free_[c] = pool_free_[c]->next_;
+  } else {
+    size_t size = (size_t)16 << c;
+    if (pool_slab_left_ < size) {
+      PoolBlock* slab = (PoolBlock*)malloc(kPoolSlabSize);
+      if (slab == NULL) {
+        sqlite3_mutex_leave(mutex_);
+        return NULL;
+      }
+      slab->next_ = pool_slabs_;
+      pool_slabs_ = slab;
+      pool_slab_ = (char*)slab + 16;
+      pool_slab_left_ = kPoolSlabSize - 16;
+    }
+    h = (int64_t*)pool_slab_;
+    pool_slab_ += size;
+    pool_slab_left_ -= size;
+  }
+  sqlite3_mutex_leave(mutex_);
+  *h = c;
+  return h + 1;
+}
+
+static void pool_free(void* p) {
+  int64_t* h = (int64_t*)p - 1;
+  if (*h < 0) {
+    free(h);
+    return;
+  }
+  int c = (int)*h;
+  PoolBlock* b = (PoolBlock*)h;
+  sqlite3_mutex_enter(mutex_);
+  b->next_ = pool_free_[c];
+  pool_free_[c] = b;
+  sqlite3_mutex_leave(mutex_);
+}
+
+static int pool_size(void* p) {
+  int64_t h = ((int64_t*)p)[-1];
+  return h < 0 ? (int)-h : (16 << h) - 8;
+}
+
+static void* pool_realloc(void* p, int n) {
+  int old = pool_size(p);
+  if (n <= old && pool_class(n) == pool_class(old)) return p;
+  void* q = pool_malloc(n);
+  if (q == NULL) return NULL;
+  memcpy(q, p, old < n ? old : n);
+  pool_free(p);
+  return q;
+}
+
+static int pool_roundup(int n) {
+  int c = pool_class(n);
+  return c == kPoolClasses ? ROUND8(n) : (16 << c) - 8;
+}
+
+static int pool_init(void* app) {
+  return SQLITE_OK;
+}
+
+static void pool_shutdown(void* app) {
+  while (pool_slabs_ != NULL) {
+    PoolBlock* next = pool_slabs_->next_;
+    free(pool_slabs_);
+    pool_slabs_ = next;
+  }
+  memset(pool_free_, 0, sizeof(pool_free_));
+  pool_slab_ = NULL;
+  pool_slab_left_ = 0;
+}
+
+/*
+ * arena: blocks carry a 16 byte header naming their chunk (NULL for large
+ * blocks that went straight to malloc) and their rounded size.
+ */
+#define kArenaChunkSize (1 << 20)
+#define kArenaLargeSize (kArenaChunkSize / 8)
+
+typedef struct ArenaChunk {
+  struct ArenaChunk* next_;     /* free list */
+  struct ArenaChunk* all_;      /* every chunk, for shutdown */
+  int64_t live_;                /* blocks not yet freed */
+  size_t used_;
+} ArenaChunk;
+
+typedef struct ArenaHeader {
+  ArenaChunk* chunk_;
+  int64_t size_;
+} ArenaHeader;
+
+#define kArenaChunkHeader ROUND16(sizeof(ArenaChunk))
+
+static ArenaChunk* arena_cur_;
+static ArenaChunk* arena_free_;
+static ArenaChunk* arena_all_;
+
+static char* arena_data(ArenaChunk* chunk) {
+  return (char*)chunk + kArenaChunkHeader;
+}
+
+/* Called with mutex_ held.  The chunk is recycled by its last free. */
+static void arena_retire(void) {
+  if (arena_cur_ != NULL && arena_cur_->live_ == 0) {
+    arena_cur_->next_ = arena_free_;
+    arena_free_ = arena_cur_;
+  }
+  arena_cur_ = NULL;
+}
+
+static void* arena_malloc(int n) {
+  int64_t size = ROUND16(n);
+  ArenaHeader* h;
+
+  if (size > kArenaLargeSize) {
+    h = (ArenaHeader*)malloc(sizeof(ArenaHeader) + size);
+    if (h == NULL) return NULL;
+    h->chunk_ = NULL;
+    h->size_ = size;
+    return h + 1;
+  }
+
+  sqlite3_mutex_enter(mutex_);
+  if (arena_cur_ == NULL || arena_cur_->used_ + sizeof(ArenaHeader) + size >
+                            kArenaChunkSize - kArenaChunkHeader) {
+    arena_retire();
+    if (arena_free_ != NULL) {
+      arena_cur_ = arena_free_;
+      arena_free_ = arena_free_->next_;
+    } else {
+      arena_cur_ = (ArenaChunk*)malloc(kArenaChunkSize);
+      if (arena_cur_ == NULL) {
+        sqlite3_mutex_leave(mutex_);
+        return NULL;
+      }
+      arena_cur_->all_ = arena_all_;
+      arena_all_ = arena_cur_;
+    }
+    arena_cur_->live_ = 0;
+    arena_cur_->used_ = 0;
+  }
+  h = (ArenaHeader*)(arena_data(arena_cur_) + arena_cur_->used_);
+  arena_cur_->used_ += sizeof(ArenaHeader) + size;
+  arena_cur_->live_++;
+  sqlite3_mutex_leave(mutex_);
+
+  h->chunk_ = arena_cur_;
+  h->size_ = size;
+  return h + 1;
+}
+
+static void arena_free(void* p) {
+  ArenaHeader* h = (ArenaHeader*)p - 1;
+  ArenaChunk* chunk = h->chunk_;
+  if (chunk == NULL) {
+    free(h);
+    return;
+  }
+  sqlite3_mutex_enter(mutex_);
+  if (--chunk->live_ == 0) {
+    if (chunk == arena_cur_) {
+      chunk->used_ = 0;
+    } else {
+      chunk->next_ = arena_free_;
+      arena_free_ = chunk;
+    }
+  }
+  sqlite3_mutex_leave(mutex_);
+}
+
+static int arena_size(void* p) {
+  return (int)((ArenaHeader*)p - 1)->size_;
+}
+
+static void* arena_realloc(void* p, int n) {
+  ArenaHeader* h = (ArenaHeader*)p - 1;
+  int64_t size = ROUND16(n);
+  if (size <= h->size_) return p;
+
+  /* Grow in place when p is the most recent block of the current chunk */
+  sqlite3_mutex_enter(mutex_);
+  ArenaChunk* chunk = h->chunk_;
+  if (chunk != NULL && chunk == arena_cur_ && size <= kArenaLargeSize &&
+      (char*)p + h->size_ == arena_data(chunk) + chunk->used_ &&
+      chunk->used_ + (size - h->size_) <= kArenaChunkSize - kArenaChunkHeader) {
+    chunk->used_ += size - h->size_;
+    h->size_ = size;
+    sqlite3_mutex_leave(mutex_);
+    return p;
+  }
+  sqlite3_mutex_leave(mutex_);
+
+  void* q = arena_malloc(n);
+  if (q == NULL) return NULL;
+  memcpy(q, p, (size_t)h->size_);
+  arena_free(p);
+  return q;
+}
+
+static int arena_roundup(int n) {
+  return ROUND16(n);
+}
+
+static int arena_init(void* app) {
+  return SQLITE_OK;
+}
+
+static void arena_shutdown(void* app) {
+  while (arena_all_ != NULL) {
+    ArenaChunk* next = arena_all_->all_;
+    free(arena_all_);
+    arena_all_ = next;
+  }
+  arena_cur_ = NULL;
+  arena_free_ = NULL;
+}
+
+static const sqlite3_mem_methods pool_methods = {
+  pool_malloc, pool_free, pool_realloc, pool_size, pool_roundup,
+  pool_init, pool_shutdown, NULL
+};
+
+static const sqlite3_mem_methods arena_methods = {
+  arena_malloc, arena_free, arena_realloc, arena_size, arena_roundup,
+  arena_init, arena_shutdown, NULL
+};
+
+static const sqlite3_mem_methods count_methods = {
+  count_malloc, count_free, count_realloc, count_size, count_roundup,
+  count_init, count_shutdown, NULL
+};
+
+/* Must run before sqlite3_initialize() */
+void alloc_install(const char* name) {
+  int status;
+
+  if (!strcmp(name, "system")) {
+    status = sqlite3_config(SQLITE_CONFIG_GETMALLOC, &inner_);
+  } else if (!strcmp(name, "pool")) {
+    inner_ = pool_methods;
+    status = SQLITE_OK;
+  } else if (!strcmp(name, "arena")) {
+    inner_ = arena_methods;
+    status = SQLITE_OK;
+  } else if (!strcmp(name, "memsys5")) {
+    if (!sqlite3_compileoption_used("ENABLE_MEMSYS5")) {
+      fprintf(stderr, "allocator memsys5: SQLite built without "
+                      "SQLITE_ENABLE_MEMSYS5\n");
+      exit(1);
+    }
+    /* SQLITE_CONFIG_HEAP takes the size as an int */
+    sqlite3_int64 heap_size = (sqlite3_int64)FLAGS_heap_size * 1048576;
+    if (heap_size <= 0 || heap_size > INT_MAX) {
+      fprintf(stderr, "allocator memsys5: --heap_size must be 1..%d MB\n",
+              INT_MAX / 1048576);
+      exit(1);
+    }
+    void* heap = malloc((size_t)heap_size);
+    if (heap == NULL) {
+      fprintf(stderr, "allocator memsys5: cannot allocate %d MB heap\n",
+              FLAGS_heap_size);
+      exit(1);
+    }
+    /* SQLITE_CONFIG_HEAP swaps in memsys5, which GETMALLOC then returns */
+    status = sqlite3_config(SQLITE_CONFIG_HEAP, heap, (int)heap_size, 64);
+    if (status == SQLITE_OK)
+      status = sqlite3_config(SQLITE_CONFIG_GETMALLOC, &inner_);
+  } else {
+    fprintf(stderr, "unknown allocator '%s'\n", name);
+    exit(1);
+  }
+  if (status == SQLITE_OK)
+    status = sqlite3_config(SQLITE_CONFIG_MALLOC, &count_methods);
+  if (status != SQLITE_OK) {
+    fprintf(stderr, "allocator %s: sqlite3_config failed: status = %d\n",
+            name, status);
+    exit(1);
+  }
+}
+
+/* Start the next connection's allocations on a fresh arena chunk */
+void alloc_new_arena(void) {
+  if (inner_.xMalloc != arena_malloc) return;
+  sqlite3_mutex_enter(mutex_);
+  arena_retire();
+  sqlite3_mutex_leave(mutex_);
+}
+
+void alloc_stats(AllocStats* stats) {
+  stats->mallocs_ = count_load(&stats_.mallocs_);
+  stats->reallocs_ = count_load(&stats_.reallocs_);
+  stats->frees_ = count_load(&stats_.frees_);
+}
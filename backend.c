@@ -0,0 +1,271 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+#ifdef HAVE_LSM1
+#include "lsm.h"
+#endif
+
+/*
+ * Key/value stores for --backend.  The sql backend is the test table of
+ * an open connection (a database file, or :memory:), used through the
+ * statements the benchmarks themselves prepare; the lsm backend is
+ * SQLite's LSM1 engine (ext/lsm1 in the SQLite source tree) through its
+ * own API, built only when the build defines HAVE_LSM1.
+ */
+
+typedef struct SqlBackend {
+  Backend base_;
+  sqlite3* db_;
+  sqlite3_stmt* put_;
+  sqlite3_stmt* get_;
+  sqlite3_stmt* delete_;
+  sqlite3_stmt* scan_;          /* from a key */
+  sqlite3_stmt* scan_all_;      /* from the first key */
+  sqlite3_stmt* begin_;
+  sqlite3_stmt* commit_;
+} SqlBackend;
+
+static void sql_check(SqlBackend* s, int status) {
+  if (status != SQLITE_OK && status != SQLITE_DONE && status != SQLITE_ROW) {
+    fprintf(stderr, "sql backend: %s\n", sqlite3_errmsg(s->db_));
+    exit(1);
+  }
+}
+
+static void sql_run(SqlBackend* s, sqlite3_stmt* stmt) {
+  int status;
+  while ((status = sqlite3_step(stmt)) == SQLITE_ROW) {}
+  sql_check(s, status);
+  sql_check(s, sqlite3_reset(stmt));
+}
+
+static void sql_close(Backend* b) {
+  SqlBackend* s = (SqlBackend*)b;
+  sqlite3_finalize(s->put_);
+  sqlite3_finalize(s->get_);
+  sqlite3_finalize(s->delete_);
+  sqlite3_finalize(s->scan_);
+  sqlite3_finalize(s->scan_all_);
+  sqlite3_finalize(s->begin_);
+  sqlite3_finalize(s->commit_);
+  free(s);
+}
+
+static void sql_sync(Backend* b, bool sync) {
+  SqlBackend* s = (SqlBackend*)b;
+  sql_check(s, sqlite3_exec(s->db_, sync ? "PRAGMA synchronous = FULL" :
+                            "PRAGMA synchronous = OFF", NULL, NULL, NULL));
+}
+
+static void sql_begin(Backend* b) {
+  SqlBackend* s = (SqlBackend*)b;
+  sqlite3_reset(s->get_);
+  sql_run(s, s->begin_);
+}
+
+static void sql_commit(Backend* b) {
+  SqlBackend* s = (SqlBackend*)b;
+  sqlite3_reset(s->get_);
+  sql_run(s, s->commit_);
+}
+
+static void sql_put(Backend* b, const void* key, int nkey, const void* value,
+                    int nvalue) {
+  SqlBackend* s = (SqlBackend*)b;
+  sql_check(s, sqlite3_bind_blob(s->put_, 1, key, nkey, SQLITE_STATIC));
+  sql_check(s, sqlite3_bind_blob(s->put_, 2, value, nvalue, SQLITE_STATIC));
+  sql_run(s, s->put_);
+}
+
+/* The row is left current so the value stays valid until the next call */
+static bool sql_get(Backend* b, const void* key, int nkey, const void** value,
+                    int* nvalue) {
+  SqlBackend* s = (SqlBackend*)b;
+  sqlite3_reset(s->get_);
+  sql_check(s, sqlite3_bind_blob(s->get_, 1, key, nkey, SQLITE_STATIC));
+  int status = sqlite3_step(s->get_);
+  sql_check(s, status);
+  if (status != SQLITE_ROW) return false;
+  *value = sqlite3_column_blob(s->get_, 0);
+  *nvalue = sqlite3_column_bytes(s->get_, 0);
+  return true;
+}
+
+static void sql_delete(Backend* b, const void* key, int nkey) {
+  SqlBackend* s = (SqlBackend*)b;
+  sql_check(s, sqlite3_bind_blob(s->delete_, 1, key, nkey, SQLITE_STATIC));
+  sql_run(s, s->delete_);
+}
+
+static int64_t sql_scan(Backend* b, const void* key, int nkey, int64_t limit,
+                        BackendRowFunc fn, void* arg) {
+  SqlBackend* s = (SqlBackend*)b;
+  sqlite3_stmt* stmt = key != NULL ? s->scan_ : s->scan_all_;
+  int64_t rows = 0;
+  int status;
+  if (key != NULL)
+    sql_check(s, sqlite3_bind_blob(stmt, 1, key, nkey, SQLITE_STATIC));
+  sql_check(s, sqlite3_bind_int64(stmt, key != NULL ? 2 : 1, limit));
+  while ((status = sqlite3_step(stmt)) == SQLITE_ROW) {
+    fn(arg, sqlite3_column_blob(stmt, 0), sqlite3_column_bytes(stmt, 0),
+       sqlite3_column_blob(stmt, 1), sqlite3_column_bytes(stmt, 1));
+    rows++;
+  }
+  sql_check(s, status);
+  sql_check(s, sqlite3_reset(stmt));
+  return rows;
+}
+
+/* The test table of db, which must outlive the backend */
+Backend* backend_sql(sqlite3* db, const char* name) {
+  SqlBackend* s = (SqlBackend*)calloc(1, sizeof(SqlBackend));
+  s->db_ = db;
+  sql_check(s, sqlite3_prepare_v2(db, "REPLACE INTO test (key, value) "
+                                  "VALUES (?, ?)", -1, &s->put_, NULL));
+  sql_check(s, sqlite3_prepare_v2(db, "SELECT value FROM test WHERE key = ?",
+                                  -1, &s->get_, NULL));
+  sql_check(s, sqlite3_prepare_v2(db, "DELETE FROM test WHERE key = ?",
+                                  -1, &s->delete_, NULL));
+  sql_check(s, sqlite3_prepare_v2(db, "SELECT key, value FROM test "
+                                  "WHERE key >= ? ORDER BY key LIMIT ?",
+                                  -1, &s->scan_, NULL));
+  sql_check(s, sqlite3_prepare_v2(db, "SELECT key, value FROM test "
+                                  "ORDER BY key LIMIT ?", -1, &s->scan_all_,
+                                  NULL));
+  sql_check(s, sqlite3_prepare_v2(db, "BEGIN", -1, &s->begin_, NULL));
+  sql_check(s, sqlite3_prepare_v2(db, "COMMIT", -1, &s->commit_, NULL));
+  s->base_.name_ = name;
+  s->base_.close_ = sql_close;
+  s->base_.sync_ = sql_sync;
+  s->base_.begin_ = sql_begin;
+  s->base_.commit_ = sql_commit;
+  s->base_.put_ = sql_put;
+  s->base_.get_ = sql_get;
+  s->base_.delete_ = sql_delete;
+  s->base_.scan_ = sql_scan;
+  return &s->base_;
+}
+
+#ifdef HAVE_LSM1
+typedef struct LsmBackend {
+  Backend base_;
+  lsm_db* db_;
+  lsm_cursor* csr_;             /* for get, closed before any write */
+} LsmBackend;
+
+static void lsm_check(int rc, const char* what) {
+  if (rc != LSM_OK) {
+    fprintf(stderr, "lsm backend: %s failed (%d)\n", what, rc);
+    exit(1);
+  }
+}
+
+static void lsm_drop_cursor(LsmBackend* l) {
+  if (l->csr_ != NULL) {
+    lsm_csr_close(l->csr_);
+    l->csr_ = NULL;
+  }
+}
+
+static void lsmb_close(Backend* b) {
+  LsmBackend* l = (LsmBackend*)b;
+  lsm_drop_cursor(l);
+  lsm_check(lsm_close(l->db_), "lsm_close");
+  free(l);
+}
+
+static void lsmb_sync(Backend* b, bool sync) {
+  LsmBackend* l = (LsmBackend*)b;
+  int safety = sync ? LSM_SAFETY_FULL : LSM_SAFETY_OFF;
+  lsm_drop_cursor(l);
+  lsm_check(lsm_config(l->db_, LSM_CONFIG_SAFETY, &safety), "lsm_config");
+}
+
+static void lsmb_begin(Backend* b) {
+  LsmBackend* l = (LsmBackend*)b;
+  lsm_drop_cursor(l);
+  lsm_check(lsm_begin(l->db_, 1), "lsm_begin");
+}
+
+static void lsmb_commit(Backend* b) {
+  LsmBackend* l = (LsmBackend*)b;
+  lsm_drop_cursor(l);
+  lsm_check(lsm_commit(l->db_, 0), "lsm_commit");
+}
+
+static void lsmb_put(Backend* b, const void* key, int nkey, const void* value,
+                     int nvalue) {
+  LsmBackend* l = (LsmBackend*)b;
+  lsm_drop_cursor(l);
+  lsm_check(lsm_insert(l->db_, key, nkey, value, nvalue), "lsm_insert");
+}
+
+static bool lsmb_get(Backend* b, const void* key, int nkey, const void** value,
+                     int* nvalue) {
+  LsmBackend* l = (LsmBackend*)b;
+  if (l->csr_ == NULL) lsm_check(lsm_csr_open(l->db_, &l->csr_), "lsm_csr_open");
+  lsm_check(lsm_csr_seek(l->csr_, key, nkey, LSM_SEEK_EQ), "lsm_csr_seek");
+  if (!lsm_csr_valid(l->csr_)) return false;
+  lsm_check(lsm_csr_value(l->csr_, value, nvalue), "lsm_csr_value");
+  return true;
+}
+
+static void lsmb_delete(Backend* b, const void* key, int nkey) {
+  LsmBackend* l = (LsmBackend*)b;
+  lsm_drop_cursor(l);
+  lsm_check(lsm_delete(l->db_, key, nkey), "lsm_delete");
+}
+
+static int64_t lsmb_scan(Backend* b, const void* key, int nkey, int64_t limit,
+                         BackendRowFunc fn, void* arg) {
+  LsmBackend* l = (LsmBackend*)b;
+  lsm_cursor* csr;
+  int64_t rows = 0;
+  lsm_check(lsm_csr_open(l->db_, &csr), "lsm_csr_open");
+  if (key != NULL)
+    lsm_check(lsm_csr_seek(csr, key, nkey, LSM_SEEK_GE), "lsm_csr_seek");
+  else
+    lsm_check(lsm_csr_first(csr), "lsm_csr_first");
+  while (lsm_csr_valid(csr) && (limit < 0 || rows < limit)) {
+    const void* k;
+    const void* v;
+    int nk, nv;
+    lsm_check(lsm_csr_key(csr, &k, &nk), "lsm_csr_key");
+    lsm_check(lsm_csr_value(csr, &v, &nv), "lsm_csr_value");
+    fn(arg, k, nk, v, nv);
+    rows++;
+    lsm_check(lsm_csr_next(csr), "lsm_csr_next");
+  }
+  lsm_csr_close(csr);
+  return rows;
+}
+
+/* An LSM1 database in file path, created if it does not exist */
+Backend* backend_lsm(const char* path) {
+  LsmBackend* l = (LsmBackend*)calloc(1, sizeof(LsmBackend));
+  int single = 0;
+  lsm_check(lsm_new(NULL, &l->db_), "lsm_new");
+  /* One process: no file locks between connections */
+  lsm_check(lsm_config(l->db_, LSM_CONFIG_MULTIPLE_PROCESSES, &single),
+            "lsm_config");
+  lsm_check(lsm_open(l->db_, path), "lsm_open");
+  l->base_.name_ = "lsm";
+  l->base_.close_ = lsmb_close;
+  l->base_.sync_ = lsmb_sync;
+  l->base_.begin_ = lsmb_begin;
+  l->base_.commit_ = lsmb_commit;
+  l->base_.put_ = lsmb_put;
+  l->base_.get_ = lsmb_get;
+  l->base_.delete_ = lsmb_delete;
+  l->base_.scan_ = lsmb_scan;
+  return &l->base_;
+}
+#else
+Backend* backend_lsm(const char* path) {
+  (void)path;
+  return NULL;
+}
+#endif
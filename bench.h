@@ -16,11 +16,27 @@
 #include <string.h>
 #include <time.h>
 #include <sqlite3.h>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #ifndef inline
 #define inline __inline
 #endif
+#ifdef _MSC_VER
 #define snprintf _snprintf
+#endif
+
+#ifdef _WIN32
+typedef void* Thread;
+#else
+typedef pthread_t Thread;
+#endif
+typedef void (*ThreadFunc)(void*);
 
 #define kNumBuckets 154
 #define kNumData 200000
@@ -44,12 +60,148 @@ typedef struct Random {
   uint32_t seed_;
 } Random;
 
+typedef struct AllocStats {
+  int64_t mallocs_;
+  int64_t reallocs_;
+  int64_t frees_;
+} AllocStats;
+
+/* Process resource usage at one point in time */
+typedef struct Footprint {
+  int64_t rss_;                 /* bytes */
+  int64_t peak_rss_;
+  int64_t minor_faults_;
+  int64_t major_faults_;
+  int64_t voluntary_csw_;
+  int64_t involuntary_csw_;
+  double user_;                 /* CPU seconds */
+  double system_;
+} Footprint;
+
 typedef struct RandomGenerator {
   char *data_;
   size_t data_size_;
   int pos_;
 } RandomGenerator;
 
+enum TraceOp { TRACE_READ = 1, TRACE_WRITE, TRACE_DELETE, TRACE_SCAN };
+
+#define kTraceSizeMask 0xffffff
+
+typedef struct TraceRecord {
+  uint32_t op_size_;   /* TraceOp in the top byte, value size below */
+  uint32_t delta_us_;  /* time since the previous record */
+  uint64_t key_;
+} TraceRecord;
+
+typedef struct Trace {
+  const TraceRecord* records_;
+  uint64_t count_;
+  void* map_;
+  size_t size_;
+} Trace;
+
+typedef struct TraceWriter TraceWriter;
+
+/* A write handed from a producer to the groupcommit writer */
+typedef struct RingItem {
+  const char* value_;
+  int key_;
+  int size_;
+  double enqueued_;
+} RingItem;
+
+typedef struct Ring Ring;
+
+/*
+ * A key/value store the kv benchmarks run on under --backend; see
+ * backend.c.  A value from get_ stays valid until the next call.
+ */
+typedef void (*BackendRowFunc)(void*, const void*, int, const void*, int);
+
+typedef struct Backend Backend;
+struct Backend {
+  const char* name_;
+  void (*close_)(Backend*);
+  void (*sync_)(Backend*, bool);
+  void (*begin_)(Backend*);
+  void (*commit_)(Backend*);
+  void (*put_)(Backend*, const void*, int, const void*, int);
+  bool (*get_)(Backend*, const void*, int, const void**, int*);
+  void (*delete_)(Backend*, const void*, int);
+  /* At most limit rows in key order from the first key >= key, or from
+     the first key if key is NULL, through fn; returns the rows seen */
+  int64_t (*scan_)(Backend*, const void*, int, int64_t, BackendRowFunc,
+                   void*);
+};
+
+/* What the benchmark publishes for --metrics_listen; see metrics.c */
+typedef struct MetricsSnapshot {
+  char bench_[32];
+  char wal_path_[120];
+  int64_t ops_;                 /* ops of the main thread since start */
+  int64_t bytes_;
+  int64_t cache_hit_;           /* page cache of db_ */
+  int64_t cache_miss_;
+  double latency_[4];           /* p50, p90, p99 and p99.9 usec */
+  double latency_sum_;
+  double latency_max_;
+  int64_t latency_count_;
+} MetricsSnapshot;
+
+/* Counters of --vfs=uring; see vfs.c */
+typedef struct VfsStats {
+  int64_t writes_;              /* writes queued to the ring */
+  int64_t submits_;             /* io_uring_enter() batches */
+  int64_t syncs_;               /* fsyncs through the ring */
+} VfsStats;
+
+/* An op slower than --slow_op_ms, for the flight recorder in slowlog.c */
+enum SlowOpFlag { SLOW_CHECKPOINT = 1, SLOW_SPILL = 2 };
+
+typedef struct SlowOp {
+  int64_t index_;               /* ops the thread finished before it */
+  int64_t key_;                 /* -1 if not a single key's */
+  int type_;                    /* TRACE_* op, 0 for any other */
+  int thread_;                  /* -1 for the main thread */
+  double time_;                 /* seconds into the benchmark */
+  double usec_;
+  int wal_frames_;              /* in the WAL at the last commit */
+  int flags_;                   /* SLOW_* during the op (a spill: since
+                                   the last slow op) */
+} SlowOp;
+
+/* A phase of a --workload spec; see workload.c for the file format */
+enum WorkloadOp { WORK_READ, WORK_WRITE, WORK_SCAN, WORK_DELETE, kWorkOps };
+enum WorkloadKeys { KEYS_SEQUENTIAL, KEYS_UNIFORM, KEYS_ZIPF, KEYS_HOT };
+
+typedef struct WorkloadPhase {
+  char name_[32];
+  int mix_[kWorkOps];           /* percent of ops of each kind */
+  unsigned char op_table_[100]; /* op for each percentile, from mix_ */
+  int keys_;                    /* WorkloadKeys */
+  int64_t keyspace_;            /* keys are 0..keyspace_-1 */
+  double hot_, hot_ops_;        /* KEYS_HOT: fraction of keys that are hot
+                                   and of ops that go to them */
+  double theta_;                /* KEYS_ZIPF: skew, and its constants */
+  double zeta2_, zetan_, alpha_, eta_;
+  uint64_t scatter_;            /* KEYS_ZIPF: rank multiplier, coprime to
+                                   keyspace_ */
+  int value_min_, value_max_;   /* value size, uniform in [min, max] */
+  int batch_;                   /* ops per transaction */
+  int threads_;
+  int64_t ops_;                 /* ops to run, or 0 to run for duration_ */
+  double duration_;             /* seconds */
+  double rate_;                 /* target ops/s over all threads, 0 none */
+  int scan_;                    /* rows per scan */
+  bool sync_;                   /* synchronous=FULL */
+} WorkloadPhase;
+
+typedef struct Workload {
+  WorkloadPhase* phases_;
+  int count_;
+} Workload;
+
 // Comma-separated list of operations to run in the specified order
 //   Actual benchmarks:
 //
@@ -64,7 +216,28 @@ typedef struct RandomGenerator {
 //   fillseq100K   -- write N/1000 100K values in sequential order in async mode
 //   readseq       -- read N times sequentially
 //   readrandom    -- read N times in random order
+//   readhot       -- read N times in random order from 1% section of DB
 //   readrand100K  -- read N/1000 100K values in sequential order in async mode
+//   replay        -- run the operations recorded in --trace
+//   groupcommit   -- producer threads queue N writes for one batching writer
+//   groupcommitsync -- groupcommit with synchronous=FULL
+//   batchsweep    -- random writes at each of --batch_sizes rows per commit
+//   batchsweepsync -- batchsweep of N/100 values with synchronous=FULL
+//   readrandom_warmup  -- readrandom from a cold cache, latency per tenth
+//   readrandom_preload -- readrandom_warmup after reading the file through
+//   openlatency   -- time open, pragmas, schema load, prepare, first query
+//   null          -- the harness of N writes without SQLite calls
+//   mutexmatrix   -- reads and writes under each threading mode and memstatus
+//   sharedcache   -- --threads readers with private vs shared page cache
+//   scancount     -- SELECT count(*) over the table
+//   scansum       -- SELECT sum(length(value)) over the table
+//   scangroup     -- count(*) GROUP BY a --scan_prefix byte key prefix
+//   scantopk      -- ORDER BY value LIMIT --scan_limit
+//   analytics     -- the four scans under each page/cache/mmap/temp/threads
+//   backup        -- online backup of the database, --backup_pages per step
+//   vacuuminto    -- VACUUM INTO a copy of the database
+//   replicaapply  -- apply the --session changesets to a new database
+//   workload      -- run the phases of --workload
 extern char* FLAGS_benchmarks;
 
 // Number of key/values to place in database
@@ -79,6 +252,11 @@ extern int FLAGS_value_size;
 // Print histogram of operation timings
 extern bool FLAGS_histogram;
 
+// Record ops slower than this many ms and list them after each benchmark
+// (0 off; by default 20 with --histogram, else off).  Under --processes
+// only the first process's are listed.
+extern double FLAGS_slow_op_ms;
+
 // Print raw data
 extern bool FLAGS_raw;
 
@@ -109,27 +287,291 @@ extern bool FLAGS_WAL_enabled;
 // Use the db with the following name.
 extern char* FLAGS_db;
 
+// Allocator installed with SQLITE_CONFIG_MALLOC: system, pool, arena or
+// memsys5.  NULL leaves SQLite's default alone and skips malloc counting.
+extern char* FLAGS_allocator;
+
+// Size of the preallocated memsys5 heap in MB.
+extern int FLAGS_heap_size;
+
+// Comma-separated lookaside configurations, each SIZExCOUNT.  The
+// benchmarks are run once per configuration, "0x0" disables lookaside.
+extern char* FLAGS_lookaside;
+
+// Page cache installed with SQLITE_CONFIG_PCACHE2: pcache1 (SQLite's own)
+// or slab.  NULL leaves SQLite's default alone.
+extern char* FLAGS_pcache;
+
+// Back the slab page cache with huge pages (MAP_HUGETLB, else THP).
+extern bool FLAGS_huge_pages;
+
+// Number of processes that run each benchmark against the same database.
+// More than one switches to normal locking mode.
+extern int FLAGS_processes;
+
+// How long a process waits on another's lock before SQLITE_BUSY, in ms.
+extern int FLAGS_busy_timeout;
+
+// How --processes waits on locks: timeout (sqlite3_busy_timeout), or the
+// counting handlers backoff (same sleeps as SQLite's) and yield.
+extern char* FLAGS_busy_handler;
+
+// Comma-separated shard counts.  Keys are hash-partitioned over that many
+// database files and the benchmarks are run once per count.
+extern char* FLAGS_shards;
+
+// Comma-separated thread counts for --shards; 0 is one thread per shard.
+// Writers are capped at one per shard.
+extern char* FLAGS_threads;
+
+// files: a connection per shard; attach: shards ATTACHed to one connection.
+extern char* FLAGS_shard_mode;
+
+// Binary trace read by the replay benchmark.
+extern char* FLAGS_trace;
+
+// Record this run's statements to a trace file, through sqlite3_trace_v2.
+extern char* FLAGS_trace_capture;
+
+// Convert a log of "<usec> <expanded sql>" lines into --trace before running.
+extern char* FLAGS_trace_import;
+
+// Replay pacing as a multiple of the recorded speed; 0 is as fast as possible.
+extern double FLAGS_replay_speed;
+
+// Serve live Prometheus metrics on unix:PATH or [HOST:]PORT.
+extern char* FLAGS_metrics_listen;
+
+// Phases of operation mixes for the workload benchmark; see workload.c.
+extern char* FLAGS_workload;
+
+// Number of threads replaying the trace, keys partitioned by hash.
+extern int FLAGS_replay_threads;
+
+// Number of producer threads queueing writes in groupcommit.
+extern int FLAGS_producers;
+
+// Commit time the *batch benchmarks aim for by resizing transactions;
+// 0 keeps 1000 rows per transaction.
+extern double FLAGS_target_commit_ms;
+
+// Comma-separated rows per transaction for batchsweep.
+extern char* FLAGS_batch_sizes;
+
+// Close the database and drop its files from the OS page cache before
+// each read benchmark.
+extern bool FLAGS_cold;
+
+// Connections openlatency opens per configuration.
+extern int FLAGS_open_iters;
+
+// Comma-separated counts of extra tables (each with an index) and WAL
+// sizes in MB that openlatency sweeps over.
+extern char* FLAGS_open_tables;
+extern char* FLAGS_open_wal_mb;
+
+// Key prefix length in bytes scangroup groups by, and rows scantopk keeps
+// (past cache_size its sorter spills to temp storage).
+extern int FLAGS_scan_prefix;
+extern int FLAGS_scan_limit;
+
+// Comma-separated settings analytics varies one at a time from the first
+// of each: page_size, cache_size (pages, or KiB if negative), mmap_size in
+// MB, temp_store (0 default, 1 file, 2 memory) and PRAGMA threads.
+extern char* FLAGS_scan_page_sizes;
+extern char* FLAGS_scan_cache_sizes;
+extern char* FLAGS_scan_mmap_mb;
+extern char* FLAGS_scan_temp_store;
+extern char* FLAGS_scan_threads;
+
+// Pages the backup benchmark copies per sqlite3_backup_step() (-1 for all
+// at once), the pause between steps, and whether backup and vacuuminto
+// run next to a thread doing fillrandom's writes.
+extern int FLAGS_backup_pages;
+extern int FLAGS_backup_sleep_ms;
+extern bool FLAGS_backup_writer;
+
+// Key encoding: decimal16 (16-byte text blob), int64, bigendian8, uuid4,
+// uuid7 or prefix+suffix.
+extern char* FLAGS_key_format;
+
+// Make the key an INTEGER PRIMARY KEY, i.e. the rowid (needs int64 keys).
+extern bool FLAGS_use_intpk;
+
+// Report database size and leaf page fill after each benchmark.
+extern bool FLAGS_page_stats;
+
+// SQLite threading mode: single, multi or serialized (default: the build's).
+extern char* FLAGS_threading;
+
+// Connection mutexes: default, nomutex or fullmutex.
+extern char* FLAGS_open_mutex;
+
+// Keep SQLite's memory statistics (SQLITE_CONFIG_MEMSTATUS).
+extern bool FLAGS_memstatus;
+
+// Open connections in shared-cache mode.
+extern bool FLAGS_shared_cache;
+
+// Split fill/read ops into gen, bind, step, reset and bookkeeping time.
+extern bool FLAGS_op_breakdown;
+
+// Report each benchmark's usec/op less the harness cost measured by null.
+extern bool FLAGS_subtract_harness;
+
+// Report RSS, page faults, context switches and CPU time per benchmark.
+extern bool FLAGS_footprint;
+
+// Stamp values with their key and a CRC32C and check them on reads.
+extern bool FLAGS_verify;
+
+// VFS for all connections: unix (SQLite's default, but reporting
+// checkpoint times and OS cache use as the others do), uring (writes
+// batched through io_uring) or direct (O_DIRECT database and WAL files);
+// uring and direct are Linux only.
+extern char* FLAGS_vfs;
+
+// Store the fill and read benchmarks run on: sqlite (the SQL paths),
+// btree (the test table through key/value calls), memory (the same on a
+// :memory: database) or lsm (SQLite's LSM1 extension, if built in).
+extern char* FLAGS_backend;
+
+// Record the writes of the fill benchmarks with the session extension and
+// keep a changeset per transaction for replicaapply (needs a build with
+// make SESSION=1).
+extern bool FLAGS_session;
+
+// Print per-statement timings, sqlite3_stmt_status() counters and query
+// plans after each benchmark.
+extern bool FLAGS_stmt_profile;
+
+/* alloc.c */
+void alloc_install(const char*);
+void alloc_new_arena(void);
+void alloc_stats(AllocStats*);
+
+/* backend.c */
+Backend* backend_sql(sqlite3*, const char*);
+Backend* backend_lsm(const char*);
+
 /* benchmark.c */
 void benchmark_init(void);
 void benchmark_fini(void);
 void benchmark_run(void);
 
+/* checksum.c */
+const char* crc32c_init(void);
+uint32_t crc32c(uint32_t, const void*, size_t);
+
 /* histogram.c */
 void  histogram_clear(Histogram*);
 void  histogram_add(Histogram*, double);
 void  histogram_merge(Histogram*, const Histogram*);
+double histogram_percentile(Histogram*, double);
 char* histogram_to_string(Histogram* hist_);
 
+/* metrics.c */
+void metrics_start(const char*);
+void metrics_stop(void);
+void metrics_publish(const MetricsSnapshot*);
+void metrics_add_ops(int64_t);
+void metrics_add_checkpoint(void);
+
+/* pcache.c */
+void pcache_install(const char*);
+
+/* profile.c */
+void profile_begin(sqlite3_stmt*, const char*);
+void profile_end(sqlite3_stmt*, int64_t);
+void profile_print(sqlite3*);
+
 /* random.c */
 void rand_init(Random*, uint32_t);
 uint32_t rand_next(Random*);
 uint32_t rand_uniform(Random*, int);
 void  rand_gen_init(RandomGenerator*, double);
 char* rand_gen_generate(RandomGenerator*, size_t);
+void  rand_gen_free(RandomGenerator*);
+
+/* ring.c */
+Ring* ring_new(int);
+void ring_free(Ring*);
+bool ring_push(Ring*, const RingItem*);
+bool ring_pop(Ring*, RingItem*);
+int  ring_depth(Ring*);
+
+/* slowlog.c */
+void slowlog_clear(void);
+void slowlog_add(const SlowOp*);
+void slowlog_checkpoint_begin(void);
+void slowlog_checkpoint_end(void);
+bool slowlog_checkpointed(int64_t*);
+void slowlog_print(double);
+
+/* trace.c */
+TraceWriter* trace_writer_open(const char*);
+void trace_writer_add(TraceWriter*, int, uint64_t, uint32_t, double);
+uint64_t trace_writer_close(TraceWriter*);
+bool trace_parse_sql(const char*, int*, uint64_t*, uint32_t*);
+void trace_capture_stmt(TraceWriter*, sqlite3_stmt*, const char*);
+void trace_capture(sqlite3*, TraceWriter*);
+uint64_t trace_import(const char*, const char*);
+bool trace_map(Trace*, const char*);
+void trace_unmap(Trace*);
 
 /* util.c */
-double now_seconds(void);
+extern bool clock_tsc_;
+extern uint64_t clock_start_;
+extern double clock_tick_seconds_;
+void clock_init(void);
+uint64_t clock_os_ticks(void);
+
+/*
+ * Ticks of the CPU's invariant time stamp counter (the generic timer on
+ * arm64) when clock_init() found one, else of the OS monotonic clock.
+ */
+static inline uint64_t clock_ticks(void) {
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+  if (clock_tsc_) return __rdtsc();
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+  if (clock_tsc_) return __builtin_ia32_rdtsc();
+#elif defined(__GNUC__) && defined(__aarch64__)
+  if (clock_tsc_) {
+    uint64_t v;
+    __asm__ volatile("isb; mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+  }
+#endif
+  return clock_os_ticks();
+}
+
+/* Seconds since clock_init() */
+static inline double now_seconds(void) {
+  return (double)(clock_ticks() - clock_start_) * clock_tick_seconds_;
+}
+
+void drop_file_cache(const char*);
+int64_t file_size(const char*);
+int64_t file_cached(const char*);
+int64_t preload_file(const char*);
+int64_t peak_rss(void);
+void reset_peak_rss(void);
+void footprint_sample(Footprint*);
 bool starts_with(const char*, const char*);
+int parse_int_list(const char*, int*, int);
+void thread_create(Thread*, ThreadFunc, void*);
+void thread_join(Thread);
 char* trim_space(char*);
 
+/* vfs.c */
+void vfs_install(const char*);
+void vfs_stats(VfsStats*);
+
+/* workload.c */
+void workload_load(Workload*, const char*, int64_t, int);
+void workload_free(Workload*);
+int workload_op(const WorkloadPhase*, Random*);
+int64_t workload_key(const WorkloadPhase*, Random*, int64_t*);
+int workload_value_size(const WorkloadPhase*, Random*);
+
 #endif /* BENCH_H_ */
@@ -4,10 +4,16 @@
 
 #include "bench.h"
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 enum Order {
   SEQUENTIAL,
-  RANDOM
+  RANDOM,
+  HOT
 };
 
 enum DBState {
@@ -22,6 +28,7 @@ int FLAGS_num;
 int FLAGS_reads;
 int FLAGS_value_size;
 bool FLAGS_histogram;
+double FLAGS_slow_op_ms;
 bool FLAGS_raw;
 double FLAGS_compression_ratio;
 int FLAGS_page_size;
@@ -31,6 +38,56 @@ bool FLAGS_use_rowids;
 bool FLAGS_transaction;
 bool FLAGS_WAL_enabled;
 char* FLAGS_db;
+char* FLAGS_allocator;
+int FLAGS_heap_size;
+char* FLAGS_lookaside;
+char* FLAGS_pcache;
+bool FLAGS_huge_pages;
+int FLAGS_processes;
+int FLAGS_busy_timeout;
+char* FLAGS_busy_handler;
+char* FLAGS_shards;
+char* FLAGS_threads;
+char* FLAGS_shard_mode;
+char* FLAGS_trace;
+char* FLAGS_trace_capture;
+char* FLAGS_trace_import;
+char* FLAGS_workload;
+char* FLAGS_metrics_listen;
+double FLAGS_replay_speed;
+int FLAGS_replay_threads;
+bool FLAGS_stmt_profile;
+int FLAGS_producers;
+double FLAGS_target_commit_ms;
+char* FLAGS_batch_sizes;
+bool FLAGS_cold;
+int FLAGS_open_iters;
+char* FLAGS_open_tables;
+char* FLAGS_open_wal_mb;
+int FLAGS_scan_prefix;
+int FLAGS_scan_limit;
+char* FLAGS_scan_page_sizes;
+char* FLAGS_scan_cache_sizes;
+char* FLAGS_scan_mmap_mb;
+char* FLAGS_scan_temp_store;
+char* FLAGS_scan_threads;
+int FLAGS_backup_pages;
+int FLAGS_backup_sleep_ms;
+bool FLAGS_backup_writer;
+char* FLAGS_key_format;
+char* FLAGS_backend;
+bool FLAGS_session;
+char* FLAGS_vfs;
+char* FLAGS_threading;
+bool FLAGS_op_breakdown;
+bool FLAGS_footprint;
+bool FLAGS_verify;
+bool FLAGS_subtract_harness;
+char* FLAGS_open_mutex;
+bool FLAGS_memstatus;
+bool FLAGS_shared_cache;
+bool FLAGS_use_intpk;
+bool FLAGS_page_stats;
 
 inline
 static void exec_error_check(int status, char *err_msg) {
@@ -57,12 +114,290 @@ static void error_check(int status) {
   }
 }
 
+static void exec_sql(sqlite3* db, const char* sql) {
+  char* err_msg = NULL;
+  int status = sqlite3_exec(db, sql, NULL, NULL, &err_msg);
+  exec_error_check(status, err_msg);
+}
+
+/* --key_format: how key number k is stored in the key column */
+enum KeyFormat {
+  KEY_DECIMAL16,        /* "%016d" text bound as a blob */
+  KEY_INT64,            /* INTEGER; the rowid itself under --use_intpk */
+  KEY_BIGENDIAN8,       /* 8-byte big-endian blob, sorts like k */
+  KEY_UUID4,            /* version 4 UUID: 16 random bytes */
+  KEY_UUID7,            /* version 7 UUID: ms timestamp, 16 keys per ms */
+  KEY_PREFIX            /* "t%03d:%016d", k under one of 64 tenants */
+};
+
+#define kMaxKeySize 32
+#define kUuid7Epoch 0x018f00000000ull
+
+static const char* const key_format_name[] = {
+  "decimal16", "int64", "bigendian8", "uuid4", "uuid7", "prefix+suffix"
+};
+static const int key_format_size[] = { 16, 8, 8, 16, 16, 21 };
+static int key_format_;
+
+/* splitmix64: the random parts of a key are a function of k, so reads
+ * can find what the fills wrote */
+static uint64_t mix64(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ull;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+static void put_be64(char* p, uint64_t v) {
+  for (int i = 7; i >= 0; i--) {
+    p[i] = (char)(v & 0xff);
+    v >>= 8;
+  }
+}
+
+/*
+ * Encode key number k into buf (kMaxKeySize bytes) and return its size.
+ * int64 keys are bound as integers and leave buf alone.
+ */
+static int encode_key(int64_t k, char* buf) {
+  int n;
+  switch (key_format_) {
+  case KEY_INT64:
+    n = 8;
+    break;
+  case KEY_BIGENDIAN8:
+    put_be64(buf, (uint64_t)k);
+    n = 8;
+    break;
+  case KEY_UUID4:
+    put_be64(buf, mix64((uint64_t)k));
+    put_be64(buf + 8, mix64(~(uint64_t)k));
+    buf[6] = (char)((buf[6] & 0x0f) | 0x40);
+    buf[8] = (char)((buf[8] & 0x3f) | 0x80);
+    n = 16;
+    break;
+  case KEY_UUID7:
+    put_be64(buf, ((kUuid7Epoch + (uint64_t)k / 16) << 16) | 0x7000 |
+                  (mix64((uint64_t)k) & 0x0fff));
+    put_be64(buf + 8, mix64(~(uint64_t)k));
+    buf[8] = (char)((buf[8] & 0x3f) | 0x80);
+    n = 16;
+    break;
+  case KEY_PREFIX:
+    n = snprintf(buf, kMaxKeySize, "t%03d:%016lld",
+                 (int)(mix64((uint64_t)k) % 64), (long long)k);
+    break;
+  default:
+    n = snprintf(buf, kMaxKeySize, "%016lld", (long long)k);
+    break;
+  }
+  return n;
+}
+
+/* Bind key k encoded by encode_key() as parameter idx of stmt */
+static void bind_encoded_key(sqlite3_stmt* stmt, int idx, int64_t k,
+                             const char* buf, int n) {
+  if (key_format_ == KEY_INT64)
+    error_check(sqlite3_bind_int64(stmt, idx, k));
+  else
+    error_check(sqlite3_bind_blob(stmt, idx, buf, n, SQLITE_STATIC));
+}
+
+/*
+ * Bind key number k as parameter idx of stmt.  buf (kMaxKeySize bytes)
+ * holds the encoded key and must live until the statement is reset.
+ * Returns the key size.
+ */
+static int bind_key(sqlite3_stmt* stmt, int idx, int64_t k, char* buf) {
+  int n = encode_key(k, buf);
+  bind_encoded_key(stmt, idx, k, buf, n);
+  return n;
+}
+
+/*
+ * --verify: every value written starts with its key number and ends with
+ * a CRC32C of the rest, so a read can tell a wrong or damaged row.  The
+ * checks are left out of the latency of the op they run in, and of the
+ * benchmark's usec/op.
+ */
+#define kStampSize 12
+typedef struct VerifyStats {
+  int64_t rows_;
+  int64_t bad_;
+  uint64_t ticks_;              /* clock_ticks() spent checking */
+  uint64_t op_ticks_;           /* of which in the op not yet finished */
+} VerifyStats;
+static VerifyStats verify_;
+static uint64_t verify_wall_;   /* ticks of db_'s checks, or the busiest
+                                   thread's, off the benchmark's time */
+static int64_t verify_failed_;  /* bad rows over all benchmarks */
+static char* verify_scratch_;   /* stamped copy of a value for db_ */
+
+/*
+ * The value to write for key k: under --verify a copy in scratch (as big
+ * as the generator's data) stamped with k and its checksum.
+ */
+static const char* stamp_value(char* scratch, const char* value, int size,
+                               int64_t k) {
+  if (!FLAGS_verify || size < kStampSize) return value;
+  memcpy(scratch, &k, 8);
+  memcpy(scratch + 8, value + 8, size - kStampSize);
+  uint32_t crc = crc32c((uint32_t)k, scratch, size - 4);
+  memcpy(scratch + size - 4, &crc, 4);
+  return scratch;
+}
+
+/*
+ * The key number value is stamped with, or -1 if that is not k (when k is
+ * not negative) or the checksum does not match.
+ */
+static int64_t stamp_key(const char* value, int size, int64_t k) {
+  int64_t stored;
+  uint32_t crc;
+  if (size < kStampSize) return -1;
+  memcpy(&stored, value, 8);
+  memcpy(&crc, value + size - 4, 4);
+  if (k >= 0 && stored != k) return -1;
+  return crc == crc32c((uint32_t)stored, value, size - 4) ? stored : -1;
+}
+
+static void verify_count(VerifyStats* v, bool ok, int64_t k,
+                         const char* value, int size, uint64_t start) {
+  int64_t stored = -1;
+  v->rows_++;
+  if (!ok && v->bad_++ == 0) {
+    if (size >= 8) memcpy(&stored, value, 8);
+    fprintf(stderr, "verify: bad row for key %lld (%d bytes, stamped %lld)\n",
+            (long long)k, size, (long long)stored);
+  }
+  uint64_t ticks = clock_ticks() - start;
+  v->ticks_ += ticks;
+  v->op_ticks_ += ticks;
+}
+
+/* Seconds the op just finished spent in --verify checks */
+static inline double verify_op_seconds(VerifyStats* v) {
+  double seconds = v->op_ticks_ * clock_tick_seconds_;
+  v->op_ticks_ = 0;
+  return seconds;
+}
+
+/*
+ * Check the row stmt is on: the value must carry key k (any key when k is
+ * negative) and its checksum, and the key column must hold that key.
+ */
+static void verify_row(sqlite3_stmt* stmt, int64_t k, VerifyStats* v) {
+  uint64_t start = clock_ticks();
+  const char* value = (const char*)sqlite3_column_blob(stmt, 1);
+  int size = sqlite3_column_bytes(stmt, 1);
+  int64_t stored = stamp_key(value, size, k);
+  bool ok = stored >= 0;
+  if (ok) {
+    char key[kMaxKeySize];
+    int n = encode_key(stored, key);
+    if (key_format_ == KEY_INT64)
+      ok = sqlite3_column_int64(stmt, 0) == stored;
+    else
+      ok = sqlite3_column_bytes(stmt, 0) == n &&
+           memcmp(sqlite3_column_blob(stmt, 0), key, n) == 0;
+  }
+  verify_count(v, ok, k < 0 ? stored : k, value, size, start);
+}
+
+/*
+ * Key k for a --backend: encode_key() bytes, with int64 keys as 8 bytes
+ * big-endian since a key/value store has no integer keys.
+ */
+static int encode_kv_key(int64_t k, char* buf) {
+  int n = encode_key(k, buf);
+  if (key_format_ == KEY_INT64) put_be64(buf, (uint64_t)k);
+  return n;
+}
+
+/* verify_row() for a key and value read from a --backend */
+static void verify_kv(const void* key, int nkey, const void* value, int size,
+                      int64_t k, VerifyStats* v) {
+  uint64_t start = clock_ticks();
+  int64_t stored = stamp_key((const char*)value, size, k);
+  bool ok = stored >= 0;
+  if (ok) {
+    char buf[kMaxKeySize];
+    int n = encode_kv_key(stored, buf);
+    ok = nkey == n && memcmp(key, buf, n) == 0;
+  }
+  verify_count(v, ok, k < 0 ? stored : k, (const char*)value, size, start);
+}
+
+/*
+ * --metrics_listen: db_ latencies of the last second, published from
+ * finished_single_op() every kMetricsInterval seconds.  Checkpoints are
+ * counted by a WAL hook doing what wal_autocheckpoint would, which also
+ * keeps the WAL's frame count for --slow_op_ms.
+ */
+#define kMetricsInterval 0.1
+static bool metrics_;
+static char bench_name_[32];
+static Histogram metrics_window_;
+static double metrics_window_start_;
+static double metrics_next_;
+static int64_t metrics_ops_;
+static int64_t metrics_bytes_;  /* of the benchmarks before this one */
+static double metrics_latency_[4];
+static double metrics_latency_sum_, metrics_latency_max_;
+static int64_t metrics_latency_count_;
+
+/*
+ * --slow_op_ms: ops slower than slow_usec_ go to the flight recorder of
+ * slowlog.c with what the benchmark noted of them through op_note(), and
+ * whether a checkpoint ran meanwhile.  db_'s cache spill counter is only
+ * read for a slow op, so a spill is flagged if one ran since the last
+ * slow op (or the start); reading it for every op would cost them all.
+ */
+static double slow_usec_;       /* 0 when off */
+static volatile int wal_frames_;
+static int op_type_;            /* TRACE_* of the op in progress on db_ */
+static int64_t op_key_;
+static int64_t op_checkpoints_; /* for slowlog_checkpointed() */
+static int op_spills_;          /* cache spills of db_ at the last slow op */
+
+static inline void op_note(int type, int64_t key) {
+  op_type_ = type;
+  op_key_ = key;
+}
+
+static int cache_spills(sqlite3* db) {
+  int cur = 0, hi;
+  if (db != NULL)
+    sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_SPILL, &cur, &hi, 0);
+  return cur;
+}
+
+static int wal_hook(void* arg, sqlite3* db, const char* name, int pages) {
+  wal_frames_ = pages;
+  if (pages >= 4096) {
+    slowlog_checkpoint_begin();
+    sqlite3_wal_checkpoint_v2(db, name, SQLITE_CHECKPOINT_PASSIVE, NULL, NULL);
+    slowlog_checkpoint_end();
+    if (metrics_) metrics_add_checkpoint();
+  }
+  return SQLITE_OK;
+}
+
+/* Time in wal_checkpoint() during this benchmark, reported under --vfs */
+static double checkpoint_seconds_;
+static VfsStats vfs_start_;
+
 inline
 static void wal_checkpoint(sqlite3* db_) {
   /* Flush all writes to disk */
   if (FLAGS_WAL_enabled) {
+    double start = now_seconds();
+    slowlog_checkpoint_begin();
     sqlite3_wal_checkpoint_v2(db_, NULL, SQLITE_CHECKPOINT_FULL, NULL,
                               NULL);
+    slowlog_checkpoint_end();
+    checkpoint_seconds_ += now_seconds() - start;
+    if (metrics_) metrics_add_checkpoint();
   }
 }
 
@@ -75,11 +410,145 @@ static int reads_;
 static double start_;
 static double last_op_finish_;
 static int64_t bytes_;
-static char message_[256];
+/* Room for the result line with every optional report flag on */
+#define kMessageSize 1024
+static char message_[kMessageSize];
 static Histogram hist_;
 static RandomGenerator gen_;
 static Random rand_;
 static double elapsed;
+static AllocStats alloc_start_;
+static Footprint footprint_start_;
+static int lookaside_size_;
+static int lookaside_count_;
+
+/* SQLITE_BUSY accounting of a connection with the counting busy handler */
+typedef struct BusyStats {
+  int64_t retries_;
+  double wait_;
+  double first_;
+} BusyStats;
+
+/* --processes: index of this worker, and its SQLITE_BUSY accounting */
+static int worker_;
+static BusyStats busy_;
+
+/* Result a forked worker leaves for the parent in shared memory */
+typedef struct ProcResult {
+  int status_;
+  int db_num_;
+  int done_;
+  double seconds_;
+  int64_t bytes_;
+  int64_t busy_retries_;
+  double busy_wait_;
+  char message_[kMessageSize];
+  Histogram hist_;
+} ProcResult;
+
+/* --shards: keys are spread over shards_ database files by hash */
+#define kMaxShards 64
+static int shards_;             /* 0 when not sharding */
+static int threads_;            /* 0 for one per shard */
+static int shard_db_num_;       /* number of the current shard files */
+
+/* --trace_capture: records the statements of db_ */
+static TraceWriter* capture_;
+
+/* Transaction times of bench_write, in usec, for adaptive batching and
+ * batchsweep; other writes are not timed per transaction */
+#define kMaxBatch 100000
+static Histogram commit_hist_;
+static bool sweeping_;          /* bench_batch_sweep is running */
+
+/*
+ * --session: each transaction of bench_write is recorded by a session of
+ * its own and the changeset kept for replicaapply, as a primary shipping
+ * them to replicas would.  Each write benchmark first runs without one,
+ * for the penalty.
+ */
+typedef struct Changeset {
+  void* data_;
+  int size_;
+} Changeset;
+static Changeset* changesets_;  /* of the last write benchmark */
+static int nchangesets_;
+static bool changesets_sync_;   /* the writes were synchronous */
+static bool session_baseline_;  /* bench_write is running without one */
+static double session_seconds_; /* generating changesets */
+static int64_t session_bytes_;
+#ifdef SQLITE_ENABLE_SESSION
+static int changesets_cap_;
+static sqlite3_session* session_;
+#endif
+
+/* openlatency: phases of opening a connection, timestamps set by open_db */
+enum OpenPhase {
+  OPEN_OPEN,
+  OPEN_RECOVERY,
+  OPEN_SCHEMA,
+  OPEN_PRAGMAS,
+  OPEN_PREPARE,
+  OPEN_QUERY,
+  OPEN_CLOSE,
+  kOpenPhases
+};
+static double* open_marks_;
+
+/* Analytics: the aggregate scans of the scan* benchmarks */
+enum ScanQuery {
+  SCAN_COUNT,
+  SCAN_SUM,
+  SCAN_GROUP,
+  SCAN_TOPK,
+  kScanQueries
+};
+
+/*
+ * --threading, --open_mutex, --memstatus, --shared_cache.  The threading
+ * mode and memory statistics are fixed when SQLite initializes, so
+ * mutexmatrix shuts SQLite down and reinitializes it for each setting.
+ */
+static int threading_;          /* SQLITE_CONFIG_* threading mode in effect */
+static int open_flags_;         /* extra SQLITE_OPEN_* flags for open_db */
+static bool own_connections_;   /* sharedcache/workload threads connect */
+
+/*
+ * --backend: the store of the fill and read benchmarks.  BACKEND_SQLITE
+ * keeps their SQL paths; the others go through a Backend opened for each
+ * benchmark (btree over db_), or kept open across them (memory, lsm).
+ */
+enum BackendKind {
+  BACKEND_SQLITE,
+  BACKEND_BTREE,
+  BACKEND_MEMORY,
+  BACKEND_LSM
+};
+static const char* const backend_name[] = { "sqlite", "btree", "memory",
+                                            "lsm" };
+static int backend_;
+static sqlite3* memory_db_;     /* BACKEND_MEMORY */
+static Backend* lsm_;           /* BACKEND_LSM */
+
+/*
+ * --op_breakdown: where the time of a bench_write/bench_read/bench_readseq
+ * op goes, in clock_ticks().  GEN and BOOK are the harness (key and
+ * value generation, finished_single_op), the rest are SQLite calls.
+ */
+enum OpPhase {
+  PHASE_GEN,
+  PHASE_BIND,
+  PHASE_STEP,
+  PHASE_RESET,
+  PHASE_BOOK,
+  kOpPhases
+};
+static uint64_t phase_ticks_[kOpPhases];
+static uint64_t tick_overhead_;         /* ticks of reading the clock */
+
+/* Harness cost per op measured by the null benchmark, for --subtract_harness */
+static double harness_usec_;
+static volatile int null_sink_;
 
 /* State kept for progress messages */
 static int done_;
@@ -89,16 +558,108 @@ static void print_header(void);
 static void print_warnings(void);
 static void print_environment(void);
 static void bench_open(void);
+static void bench_connect(void);
+static sqlite3* open_db(const char*, BusyStats*);
+static bool shared_db(void);
+static char* db_file_name(char*, size_t, int, int);
+static void metrics_update(double);
 static void bench_start(void);
 static void bench_stop(const char *name);
 static void bench_write(bool, int, int, int, int, int);
 static void bench_read(int, int);
 static void bench_readseq(void);
+static void bench_kv_write(bool, int, int, int, int, int);
+static void bench_kv_read(int);
+static void bench_kv_readseq(void);
+static void bench_shard_write(bool, int, int, int, int, int);
+static void bench_shard_read(int);
+static void bench_replay(void);
+static void changesets_clear(void);
+static void bench_groupcommit(bool, int, int);
+static void bench_batch_sweep(bool);
+static void bench_evict(void);
+static void bench_read_warmup(bool);
+static void bench_open_latency(void);
+static void bench_mutex_matrix(void);
+static void bench_null(void);
+static void bench_shared_cache(void);
+static void bench_scan(int);
+static void bench_analytics(void);
+static void bench_copy(bool);
+static void bench_replica_apply(void);
+static void bench_workload(void);
+
+/* Start timing the phases of an op; 0 when --op_breakdown is off */
+static inline uint64_t phase_start(void) {
+  return FLAGS_op_breakdown ? clock_ticks() : 0;
+}
+
+/* Charge the ticks since `since` to phase; returns the new start */
+static inline uint64_t phase_add(int phase, uint64_t since) {
+  if (!FLAGS_op_breakdown) return 0;
+  uint64_t now = clock_ticks();
+  phase_ticks_[phase] += now - since;
+  return now;
+}
+
+/* Measure the cost of a clock reading, which every phase includes */
+static void phase_calibrate(void) {
+  tick_overhead_ = ~(uint64_t)0;
+  for (int i = 0; i < 1000; i++) {
+    uint64_t a = clock_ticks();
+    uint64_t b = clock_ticks();
+    if (b - a < tick_overhead_) tick_overhead_ = b - a;
+  }
+}
+
+/* Nanoseconds per op spent in phase, less the counter reading itself */
+static double phase_ns(int phase) {
+  double t = (double)phase_ticks_[phase] - (double)tick_overhead_ * done_;
+  return t > 0 ? t * clock_tick_seconds_ * 1e9 / done_ : 0;
+}
+
+/* SQLITE_CONFIG_* for a --threading name; NULL for the build's default */
+static int threading_config(const char* name) {
+  if (name == NULL) {
+    switch (sqlite3_threadsafe()) {
+    case 0: return SQLITE_CONFIG_SINGLETHREAD;
+    case 2: return SQLITE_CONFIG_MULTITHREAD;
+    default: return SQLITE_CONFIG_SERIALIZED;
+    }
+  }
+  if (!strcmp(name, "single")) return SQLITE_CONFIG_SINGLETHREAD;
+  if (!strcmp(name, "multi")) return SQLITE_CONFIG_MULTITHREAD;
+  if (!strcmp(name, "serialized")) return SQLITE_CONFIG_SERIALIZED;
+  fprintf(stderr, "unknown threading mode '%s'\n", name);
+  exit(1);
+}
+
+static const char* threading_name(int config) {
+  switch (config) {
+  case SQLITE_CONFIG_SINGLETHREAD: return "single";
+  case SQLITE_CONFIG_MULTITHREAD: return "multi";
+  default: return "serialized";
+  }
+}
+
+/*
+ * Set the threading mode and memstatus and initialize SQLite, which must
+ * be shut down.  False if the build lacks the mode (SQLITE_THREADSAFE=0).
+ */
+static bool sqlite_configure(int threading, bool memstatus) {
+  if (sqlite3_config(threading) != SQLITE_OK) return false;
+  error_check(sqlite3_config(SQLITE_CONFIG_MEMSTATUS, (int)memstatus));
+  error_check(sqlite3_initialize());
+  if (FLAGS_vfs != NULL) vfs_install(FLAGS_vfs);
+  return true;
+}
 
 static void print_header() {
-  const int kKeySize = 16;
+  const int kKeySize = key_format_size[key_format_];
   print_environment();
-  fprintf(stdout, "Keys:       %d bytes each\n", kKeySize);
+  fprintf(stdout, "Keys:       %d bytes each (%s%s)\n", kKeySize,
+          key_format_name[key_format_],
+          FLAGS_use_intpk ? ", INTEGER PRIMARY KEY" : "");
   fprintf(stdout, "Values:     %d bytes each\n", FLAGS_value_size);  
   fprintf(stdout, "Entries:    %d\n", num_);
   fprintf(stdout, "RawSize:    %.1f MB (estimated)\n",
@@ -113,10 +674,52 @@ static void print_warnings() {
       "WARNING: Assertions are enabled: benchmarks unnecessarily slow\n"
       );
 #endif
+  if (FLAGS_lookaside != NULL && sqlite3_compileoption_used("OMIT_LOOKASIDE"))
+    fprintf(stdout,
+        "WARNING: SQLite built with SQLITE_OMIT_LOOKASIDE: --lookaside has no effect\n"
+        );
 }
 
 static void print_environment() {
   fprintf(stdout, "SQLite:     version %s\n", sqlite3_libversion());
+
+  /* Average cost of a timestamp, which every timed op pays */
+  const int kReads = 100000;
+  double sink = 0, start = now_seconds();
+  for (int i = 0; i < kReads; i++) sink += now_seconds();
+  double read_ns = (now_seconds() - start) * 1e9 / kReads;
+  if (clock_tsc_)
+    fprintf(stdout, "Clock:      invariant TSC at %.3f GHz, %.1f ns/read%s\n",
+            1e-9 / clock_tick_seconds_, read_ns, sink < 0 ? " " : "");
+  else
+    fprintf(stdout, "Clock:      OS monotonic, %.1f ns/read%s\n", read_ns,
+            sink < 0 ? " " : "");
+  if (FLAGS_allocator != NULL)
+    fprintf(stdout, "Allocator:  %s\n", FLAGS_allocator);
+  if (FLAGS_vfs != NULL)
+    fprintf(stdout, "VFS:        %s\n", FLAGS_vfs);
+  if (FLAGS_pcache != NULL)
+    fprintf(stdout, "PCache:     %s%s\n", FLAGS_pcache,
+            FLAGS_huge_pages ? " (huge pages)" : "");
+  if (FLAGS_shards != NULL)
+    fprintf(stdout, "Shards:     %s (%s)\n", FLAGS_shards, FLAGS_shard_mode);
+  if (FLAGS_processes > 1)
+    fprintf(stdout, "Processes:  %d (busy handler %s, %d ms)\n",
+            FLAGS_processes, FLAGS_busy_handler, FLAGS_busy_timeout);
+  if (FLAGS_trace != NULL)
+    fprintf(stdout, "Trace:      %s\n", FLAGS_trace);
+  if (backend_ != BACKEND_SQLITE)
+    fprintf(stdout, "Backend:    %s (key/value calls for fill and read "
+            "benchmarks)\n", backend_name[backend_]);
+  if (FLAGS_cold)
+    fprintf(stdout, "Cache:      cold (page cache dropped before reads)\n");
+  if (FLAGS_threading != NULL || open_flags_ != 0 || !FLAGS_memstatus)
+    fprintf(stdout, "Threading:  %s%s%s, memstatus %s%s\n",
+            threading_name(threading_),
+            (open_flags_ & SQLITE_OPEN_NOMUTEX) ? ", nomutex" : "",
+            (open_flags_ & SQLITE_OPEN_FULLMUTEX) ? ", fullmutex" : "",
+            FLAGS_memstatus ? "on" : "off",
+            (open_flags_ & SQLITE_OPEN_SHAREDCACHE) ? ", shared cache" : "");
 }
 
 static void bench_start() {
@@ -124,20 +727,114 @@ static void bench_start() {
   bytes_ = 0;
   *message_ = 0;
   if(FLAGS_histogram) histogram_clear(&hist_);
+  if (FLAGS_allocator != NULL) {
+    alloc_stats(&alloc_start_);
+    reset_peak_rss();
+  }
+  if (FLAGS_footprint) {
+    reset_peak_rss();
+    footprint_sample(&footprint_start_);
+  }
+  if (lookaside_size_ >= 0 && db_ != NULL) {
+    int cur, hi;
+    sqlite3_db_status(db_, SQLITE_DBSTATUS_LOOKASIDE_HIT, &cur, &hi, 1);
+    sqlite3_db_status(db_, SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE, &cur, &hi, 1);
+    sqlite3_db_status(db_, SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL, &cur, &hi, 1);
+  }
+  histogram_clear(&commit_hist_);
+  memset(phase_ticks_, 0, sizeof(phase_ticks_));
+  memset(&verify_, 0, sizeof(verify_));
+  verify_wall_ = 0;
+  checkpoint_seconds_ = 0;
+  if (FLAGS_vfs != NULL) vfs_stats(&vfs_start_);
+  if (slow_usec_ > 0) {
+    slowlog_clear();
+    op_note(0, -1);
+    slowlog_checkpointed(&op_checkpoints_);
+    op_spills_ = cache_spills(db_);
+  }
   done_ = 0;
   next_report_ = 100;
+  busy_.retries_ = 0;
+  busy_.wait_ = 0;
   start_ =  now_seconds();
+  if (metrics_) metrics_update(start_);
+}
+
+/* Publish the counters of the main thread for the metrics server */
+static void metrics_update(double now) {
+  MetricsSnapshot s;
+  char file_name[100];
+
+  if (now - metrics_window_start_ >= 1.0) {
+    static const double q[4] = { 50, 90, 99, 99.9 };
+    for (int i = 0; i < 4; i++)
+      metrics_latency_[i] = metrics_window_.num_ > 0 ?
+                            histogram_percentile(&metrics_window_, q[i]) : 0;
+    metrics_latency_sum_ = metrics_window_.sum_;
+    metrics_latency_max_ = metrics_window_.num_ > 0 ? metrics_window_.max_ : 0;
+    metrics_latency_count_ = (int64_t)metrics_window_.num_;
+    histogram_clear(&metrics_window_);
+    metrics_window_start_ = now;
+  }
+
+  memset(&s, 0, sizeof(s));
+  snprintf(s.bench_, sizeof(s.bench_), "%s", bench_name_);
+  db_file_name(file_name, sizeof(file_name), db_num_, -1);
+  snprintf(s.wal_path_, sizeof(s.wal_path_), "%s-wal", file_name);
+  s.ops_ = metrics_ops_;
+  s.bytes_ = metrics_bytes_ + bytes_;
+  if (db_ != NULL) {
+    int cur, hi;
+    sqlite3_db_status(db_, SQLITE_DBSTATUS_CACHE_HIT, &cur, &hi, 0);
+    s.cache_hit_ = cur;
+    sqlite3_db_status(db_, SQLITE_DBSTATUS_CACHE_MISS, &cur, &hi, 0);
+    s.cache_miss_ = cur;
+  }
+  memcpy(s.latency_, metrics_latency_, sizeof(s.latency_));
+  s.latency_sum_ = metrics_latency_sum_;
+  s.latency_max_ = metrics_latency_max_;
+  s.latency_count_ = metrics_latency_count_;
+  metrics_publish(&s);
+  metrics_next_ = now + kMetricsInterval;
+}
+
+/* Record the op of db_ that finished at now if it took over slow_usec_ */
+static void slow_op_check(double usec, double now) {
+  bool checkpointed = slowlog_checkpointed(&op_checkpoints_);
+  if (usec > slow_usec_) {
+    int spills = cache_spills(db_);
+    SlowOp op;
+    op.index_ = done_;
+    op.key_ = op_key_;
+    op.type_ = op_type_;
+    op.thread_ = -1;
+    op.time_ = now - start_;
+    op.usec_ = usec;
+    op.wal_frames_ = wal_frames_;
+    op.flags_ = (checkpointed ? SLOW_CHECKPOINT : 0) |
+                (spills != op_spills_ ? SLOW_SPILL : 0);
+    slowlog_add(&op);
+    op_spills_ = spills;
+  }
 }
 
 void finished_single_op() {
-  if (FLAGS_histogram) {
+  double verify = 0;
+  if (verify_.op_ticks_ > 0) {
+    verify_wall_ += verify_.op_ticks_;
+    verify = verify_op_seconds(&verify_);
+  }
+  if (FLAGS_histogram || metrics_ || slow_usec_ > 0) {
     double now = now_seconds();
-    double usec = (now - last_op_finish_) * 1e6;
-	histogram_add(&hist_, usec);
-	if (usec > 20000) {
-		fprintf(stderr, "long op: %.1f usec%30s\r", usec, "");
-		fflush(stderr);
-	}
+    double usec = (now - last_op_finish_ - verify) * 1e6;
+    if (FLAGS_histogram) histogram_add(&hist_, usec);
+    if (slow_usec_ > 0) slow_op_check(usec, now);
+    if (metrics_) {
+      histogram_add(&metrics_window_, usec);
+      metrics_ops_++;
+      if (now >= metrics_next_) metrics_update(now);
+    }
     last_op_finish_ = now;
   }
 
@@ -150,48 +847,212 @@ void finished_single_op() {
     else if (next_report_ < 100000) next_report_ += 10000;
     else if (next_report_ < 500000) next_report_ += 50000;
     else                            next_report_ += 100000;
-    fprintf(stderr, "... finished %d ops%30s\r", done_, "");
-    fflush(stderr);
+    if (worker_ == 0) {
+      fprintf(stderr, "... finished %d ops%30s\r", done_, "");
+      fflush(stderr);
+    }
   }
 }
 
 inline bool isempty(const char* s) { return *s == 0; }
-static void str_addhead(char *msg, const char* s1, const char* s2)
+/* Put s1 and s2 in front of msg, a buffer of size bytes, cutting its end */
+static void str_addhead(char *msg, size_t size, const char* s1, const char* s2)
 {
-	int len_msg = strlen(msg);
-	int len_s1 = strlen(s1);
-	int epos = len_msg + len_s1 + strlen(s2);
-	while(len_msg >= 0) {
-		msg[epos--] = msg[len_msg--];
-	}
-	strcpy(msg, s1);
-	while(*s2) msg[len_s1++] = *s2++;
+	size_t len_s1 = strlen(s1);
+	size_t len_s2 = strlen(s2);
+	size_t len_msg = strlen(msg);
+	if (len_s1 + len_s2 >= size) return;
+	if (len_msg > size - 1 - len_s1 - len_s2)
+		len_msg = size - 1 - len_s1 - len_s2;
+	memmove(msg + len_s1 + len_s2, msg, len_msg);
+	msg[len_s1 + len_s2 + len_msg] = 0;
+	memcpy(msg, s1, len_s1);
+	memcpy(msg + len_s1, s2, len_s2);
+}
+
+static void append_message(const char* s) {
+  size_t len = strlen(message_);
+  snprintf(message_ + len, sizeof(message_) - len, "%s%s",
+           isempty(message_) ? "" : " ", s);
+}
+
+static int64_t query_int(sqlite3* db, const char* sql) {
+  sqlite3_stmt* stmt;
+  int64_t v = -1;
+  if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) return -1;
+  if (sqlite3_step(stmt) == SQLITE_ROW) v = sqlite3_column_int64(stmt, 0);
+  sqlite3_finalize(stmt);
+  return v;
+}
+
+/*
+ * --page_stats: database size, and how full the leaf pages of the test
+ * table and its index are (random inserts split pages half full).  Leaf
+ * fill needs the dbstat table, SQLITE_ENABLE_DBSTAT_VTAB.
+ */
+static void append_page_stats(void) {
+  char buf[150];
+  int64_t pages = query_int(db_, "PRAGMA page_count");
+  int64_t page_size = query_int(db_, "PRAGMA page_size");
+  snprintf(buf, sizeof(buf), "db: %.1f MB %lld pages",
+           pages * page_size / 1048576.0, (long long)pages);
+  append_message(buf);
+
+  sqlite3_stmt* stmt;
+  const char* sql =
+      "SELECT count(*), sum(pgsize), sum(unused) FROM dbstat "
+      "WHERE name IN (SELECT name FROM sqlite_master WHERE tbl_name = 'test') "
+      "AND pagetype = 'leaf'";
+  if (sqlite3_prepare_v2(db_, sql, -1, &stmt, NULL) != SQLITE_OK) return;
+  if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int64(stmt, 1) > 0) {
+    snprintf(buf, sizeof(buf), "leaves: %lld (%.0f%% full)",
+             (long long)sqlite3_column_int64(stmt, 0),
+             100.0 * (1.0 - (double)sqlite3_column_int64(stmt, 2) /
+                            sqlite3_column_int64(stmt, 1)));
+    append_message(buf);
+  }
+  sqlite3_finalize(stmt);
+}
+
+/*
+ * --footprint: RSS now and its change, the peak since bench_start(), and
+ * what the benchmark cost in page faults (minor/major), context switches
+ * (voluntary/involuntary) and CPU seconds (user/system).
+ */
+static void append_footprint(void) {
+  Footprint now;
+  const Footprint* s = &footprint_start_;
+  char buf[200];
+  footprint_sample(&now);
+  snprintf(buf, sizeof(buf),
+           "rss %.1f MB (%+.1f) peak %.1f MB faults %lld/%lld "
+           "csw %lld/%lld cpu %.2fu %.2fs",
+           now.rss_ / 1048576.0, (now.rss_ - s->rss_) / 1048576.0,
+           now.peak_rss_ / 1048576.0,
+           (long long)(now.minor_faults_ - s->minor_faults_),
+           (long long)(now.major_faults_ - s->major_faults_),
+           (long long)(now.voluntary_csw_ - s->voluntary_csw_),
+           (long long)(now.involuntary_csw_ - s->involuntary_csw_),
+           now.user_ - s->user_, now.system_ - s->system_);
+  append_message(buf);
 }
 
 static void bench_stop(const char* name) {
   double finish = now_seconds();
   elapsed += finish - start_;
+  /* The time of the ops themselves, without --verify's checks */
+  double seconds = finish - start_ - verify_wall_ * clock_tick_seconds_;
 
   if (done_ < 1) done_ = 1;
 
+  if (FLAGS_page_stats && db_ != NULL && shards_ == 0) append_page_stats();
+  if (FLAGS_footprint) append_footprint();
+  if (verify_.rows_ > 0) {
+    char buf[100];
+    snprintf(buf, sizeof(buf), "verified %lld rows, %lld bad, %.3f usec/op",
+             (long long)verify_.rows_, (long long)verify_.bad_,
+             verify_.ticks_ * clock_tick_seconds_ * 1e6 / done_);
+    append_message(buf);
+    verify_failed_ += verify_.bad_;
+  }
+
+  /* Harness share of the op: measured in place, or by the null benchmark */
+  double usec = seconds * 1e6 / done_;
+  double harness = harness_usec_;
+  uint64_t phased = 0;
+  for (int p = 0; p < kOpPhases; p++) phased += phase_ticks_[p];
+  if (phased > 0) {
+    char buf[150];
+    snprintf(buf, sizeof(buf),
+             "gen %.3f bind %.3f step %.3f reset %.3f book %.3f usec/op",
+             phase_ns(PHASE_GEN) / 1e3, phase_ns(PHASE_BIND) / 1e3,
+             phase_ns(PHASE_STEP) / 1e3, phase_ns(PHASE_RESET) / 1e3,
+             phase_ns(PHASE_BOOK) / 1e3);
+    append_message(buf);
+    harness = (phase_ns(PHASE_GEN) + phase_ns(PHASE_BOOK)) / 1e3;
+  }
+  if (FLAGS_subtract_harness && strcmp(name, "null")) {
+    char buf[100];
+    snprintf(buf, sizeof(buf), "net %.3f usec/op",
+             usec > harness ? usec - harness : 0.0);
+    append_message(buf);
+  }
+
+  if (FLAGS_vfs != NULL) {
+    VfsStats now;
+    char buf[150], file_name[100], wal_name[110];
+    vfs_stats(&now);
+    int64_t submits = now.submits_ - vfs_start_.submits_;
+    db_file_name(file_name, sizeof(file_name), db_num_, -1);
+    snprintf(wal_name, sizeof(wal_name), "%s-wal", file_name);
+    int64_t cached = file_cached(file_name);
+    int64_t wal_cached = file_cached(wal_name);
+    snprintf(buf, sizeof(buf), "checkpoint %.2f ms",
+             checkpoint_seconds_ * 1e3);
+    append_message(buf);
+    if (cached >= 0 && wal_cached >= 0) {
+      snprintf(buf, sizeof(buf), "os cache %.1f MB",
+               (cached + wal_cached) / 1048576.0);
+      append_message(buf);
+    }
+    if (submits > 0) {
+      snprintf(buf, sizeof(buf), "uring %.1f writes/submit, %lld fsyncs",
+               (double)(now.writes_ - vfs_start_.writes_) / submits,
+               (long long)(now.syncs_ - vfs_start_.syncs_));
+      append_message(buf);
+    }
+  }
+
+  if (FLAGS_allocator != NULL) {
+    AllocStats now;
+    char buf[100];
+    alloc_stats(&now);
+    int64_t calls = (now.mallocs_ - alloc_start_.mallocs_) +
+                    (now.reallocs_ - alloc_start_.reallocs_);
+    snprintf(buf, sizeof(buf), "mallocs: %lld (%.1f/op) peakRSS: %.1f MB",
+             (long long)calls, (double)calls / done_,
+             peak_rss() / 1048576.0);
+    append_message(buf);
+  }
+
+  if (lookaside_size_ >= 0 && db_ != NULL) {
+    int cur, hit, miss_size, miss_full;
+    char buf[100];
+    sqlite3_db_status(db_, SQLITE_DBSTATUS_LOOKASIDE_HIT, &cur, &hit, 0);
+    sqlite3_db_status(db_, SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE, &cur,
+                      &miss_size, 0);
+    sqlite3_db_status(db_, SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL, &cur,
+                      &miss_full, 0);
+    int total = hit + miss_size + miss_full;
+    snprintf(buf, sizeof(buf), "lookaside hit: %.1f%%",
+             total > 0 ? 100.0 * hit / total : 0.0);
+    append_message(buf);
+  }
+
   if (bytes_ > 0) {
     char rate[100];
-    snprintf(rate, sizeof(rate), "%6.1f MB/s", (bytes_/1048576.0)/(finish-start_));
+    snprintf(rate, sizeof(rate), "%6.1f MB/s", (bytes_/1048576.0)/seconds);
     if (!isempty(message_))
-      str_addhead(message_, rate, " ");
+      str_addhead(message_, sizeof(message_), rate, " ");
     else
       strcpy(message_, rate);
   }
 
   fprintf(stdout, "%-14s : %10.3f usec/op[%6.3f];%s%s\n",
-          name, (finish - start_) * 1e6 / done_, finish - start_,
+          name, usec, finish - start_,
           (isempty(message_) ? "" : " "), message_);
 
   if (FLAGS_histogram) {
     fprintf(stdout, "Microseconds per op:\n%s\n",
             histogram_to_string(&hist_));
   }
+  if (slow_usec_ > 0) slowlog_print(slow_usec_ / 1e3);
+  if (FLAGS_stmt_profile) profile_print(db_);
   fflush(stdout);
+  if (metrics_) {
+    metrics_update(finish);
+    metrics_bytes_ += bytes_;
+  }
 }
 
 static
@@ -200,7 +1061,7 @@ char *makepath(char *buf, char *dir, char *file)
 	strcpy(buf, dir);
 	switch(buf[strlen(buf)-1]) {
 	case '\\': case '/': break;
-	default: strcat(buf, "\\");
+	default: strcat(buf, "/");
 	}
 	strcat(buf, file);
 	return buf;
@@ -214,35 +1075,158 @@ void benchmark_init() {
 	reads_ = FLAGS_reads < 0 ? FLAGS_num : FLAGS_reads;
 	bytes_ = 0;
 	*message_ = 0;
+	lookaside_size_ = -1;
+	lookaside_count_ = -1;
 	rand_gen_init(&gen_, FLAGS_compression_ratio);
 	rand_init(&rand_, 301);
+	/* --histogram alone keeps marking ops over 20 ms as it always has */
+	slow_usec_ = FLAGS_slow_op_ms >= 0 ? FLAGS_slow_op_ms * 1e3 :
+	             FLAGS_histogram ? 20000 : 0;
+
+	key_format_ = -1;
+	for (int i = 0; i <= KEY_PREFIX; i++) {
+		if (!strcmp(FLAGS_key_format, key_format_name[i])) key_format_ = i;
+	}
+	if (key_format_ < 0) {
+		fprintf(stderr, "unknown key format '%s'\n", FLAGS_key_format);
+		exit(1);
+	}
+	if (FLAGS_use_intpk && key_format_ != KEY_INT64) {
+		fprintf(stderr, "--use_intpk needs --key_format=int64\n");
+		exit(1);
+	}
+
+	backend_ = -1;
+	for (int i = 0; i <= BACKEND_LSM; i++) {
+		if (!strcmp(FLAGS_backend, backend_name[i])) backend_ = i;
+	}
+	if (backend_ < 0) {
+		fprintf(stderr, "unknown backend '%s'\n", FLAGS_backend);
+		exit(1);
+	}
+#ifndef HAVE_LSM1
+	if (backend_ == BACKEND_LSM) {
+		fprintf(stderr, "--backend=lsm: built without LSM1 (make LSM1=...)\n");
+		exit(1);
+	}
+#endif
+	if (backend_ != BACKEND_SQLITE &&
+	    (FLAGS_use_intpk || FLAGS_shards != NULL || FLAGS_processes > 1)) {
+		fprintf(stderr, "--backend=%s: no --use_intpk, --shards or "
+		        "--processes\n", FLAGS_backend);
+		exit(1);
+	}
+	memory_db_ = NULL;
+	lsm_ = NULL;
+#ifndef SQLITE_ENABLE_SESSION
+	if (FLAGS_session) {
+		fprintf(stderr, "--session: built without the session extension "
+		        "(make SESSION=1)\n");
+		exit(1);
+	}
+#endif
+	if (FLAGS_session && (backend_ != BACKEND_SQLITE ||
+	    FLAGS_shards != NULL || FLAGS_processes > 1)) {
+		fprintf(stderr, "--session: no --backend, --shards or --processes\n");
+		exit(1);
+	}
+
+	open_flags_ = 0;
+	if (!strcmp(FLAGS_open_mutex, "nomutex")) {
+		open_flags_ = SQLITE_OPEN_NOMUTEX;
+	} else if (!strcmp(FLAGS_open_mutex, "fullmutex")) {
+		open_flags_ = SQLITE_OPEN_FULLMUTEX;
+	} else if (strcmp(FLAGS_open_mutex, "default")) {
+		fprintf(stderr, "unknown mutex mode '%s'\n", FLAGS_open_mutex);
+		exit(1);
+	}
+	if (FLAGS_shared_cache)
+		open_flags_ |= SQLITE_OPEN_SHAREDCACHE;
+
+	/* A custom allocator must be in place before SQLite initializes */
+	if (FLAGS_allocator != NULL)
+		alloc_install(FLAGS_allocator);
+	if (FLAGS_pcache != NULL)
+		pcache_install(FLAGS_pcache);
+	threading_ = threading_config(FLAGS_threading);
+	if (!sqlite_configure(threading_, FLAGS_memstatus)) {
+		fprintf(stderr, "threading mode %s: SQLite built with SQLITE_THREADSAFE=0\n",
+		        threading_name(threading_));
+		exit(1);
+	}
+
+	if (FLAGS_trace_import != NULL) {
+		if (FLAGS_trace == NULL) {
+			fprintf(stderr, "--trace_import needs --trace to write to\n");
+			exit(1);
+		}
+		uint64_t n = trace_import(FLAGS_trace_import, FLAGS_trace);
+		fprintf(stdout, "Trace:      %llu records imported from %s\n",
+		        (unsigned long long)n, FLAGS_trace_import);
+	}
+	if (FLAGS_op_breakdown)
+		phase_calibrate();
+	if (FLAGS_verify) {
+		if (FLAGS_value_size < kStampSize) {
+			fprintf(stderr, "--verify needs --value_size >= %d\n", kStampSize);
+			exit(1);
+		}
+		fprintf(stdout, "Verify:     CRC32C (%s)\n", crc32c_init());
+		verify_scratch_ = (char*)malloc(gen_.data_size_);
+	}
+	verify_failed_ = 0;
+	metrics_ = FLAGS_metrics_listen != NULL;
+	if (metrics_) {
+		metrics_start(FLAGS_metrics_listen);
+		histogram_clear(&metrics_window_);
+		metrics_window_start_ = now_seconds();
+		fprintf(stdout, "Metrics:    Prometheus on %s\n", FLAGS_metrics_listen);
+	}
+
+	capture_ = NULL;
+	if (FLAGS_trace_capture != NULL)
+		capture_ = trace_writer_open(FLAGS_trace_capture);
 
-	HANDLE hFind;
-	WIN32_FIND_DATA FindFileData;
 	char filename[512];
 	if (!FLAGS_use_existing_db) {
-		if((hFind = FindFirstFile(makepath(filename, FLAGS_db, "dbbench_sqlite3*.*"),
-			&FindFileData)) != INVALID_HANDLE_VALUE)
-		{
-			do remove(makepath(filename, FLAGS_db, FindFileData.cFileName));
-			while(FindNextFile(hFind, &FindFileData));
-			FindClose(hFind);
+		DIR* dir = opendir(FLAGS_db);
+		if (dir != NULL) {
+			struct dirent* ent;
+			while ((ent = readdir(dir)) != NULL) {
+				if (starts_with(ent->d_name, "dbbench_sqlite3"))
+					remove(makepath(filename, FLAGS_db, ent->d_name));
+			}
+			closedir(dir);
 		}
 	}
 }
 
 void benchmark_fini() {
+  changesets_clear();
+  free(changesets_);
+  if (lsm_ != NULL) lsm_->close_(lsm_);
+  if (memory_db_ != NULL) sqlite3_close(memory_db_);
   int status = sqlite3_close(db_);
   error_check(status);
+  if (capture_ != NULL) {
+    uint64_t n = trace_writer_close(capture_);
+    fprintf(stdout, "Trace:      %llu records captured to %s\n",
+            (unsigned long long)n, FLAGS_trace_capture);
+  }
   fprintf(stdout, "-----------------------------------[SQLite]---------\n");
   fprintf(stdout, "Total Elapsed  : %10.3f secs   [%6.2f]\n", now_seconds(), elapsed);
   fprintf(stdout, "----------------------------------------------------\n");
+  if (metrics_) metrics_stop();
+  if (verify_failed_ > 0) {
+    fprintf(stderr, "verify: %lld bad rows\n", (long long)verify_failed_);
+    exit(1);
+  }
 }
 
-void benchmark_run() {
-  print_header();
-  bench_open();
+static bool run_one(const char*);
+static void run_processes(const char*);
 
+static void run_benchmarks(void) {
   char* benchmarks = FLAGS_benchmarks;
   char name[32];
   while (benchmarks != NULL) {
@@ -256,145 +1240,632 @@ void benchmark_run() {
       benchmarks = sep + 1;
     }
     bytes_ = 0;
-    bench_start();
-    bool known = true;
-    bool write_sync = false;
-    if (!strcmp(name, "fillseq")) {
-      bench_write(write_sync, SEQUENTIAL, FRESH, num_, FLAGS_value_size, 1);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "fillseqbatch")) {
-      bench_write(write_sync, SEQUENTIAL, FRESH, num_, FLAGS_value_size, 1000);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "fillrandom")) {
-      bench_write(write_sync, RANDOM, FRESH, num_, FLAGS_value_size, 1);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "fillrandbatch")) {
-      bench_write(write_sync, RANDOM, FRESH, num_, FLAGS_value_size, 1000);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "overwrite")) {
-      bench_write(write_sync, RANDOM, EXISTING, num_, FLAGS_value_size, 1);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "overwritebatch")) {
-      bench_write(write_sync, RANDOM, EXISTING, num_, FLAGS_value_size, 1000);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "fillrandsync")) {
-      write_sync = true;
-      bench_write(write_sync, RANDOM, FRESH, num_ / 100, FLAGS_value_size, 1);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "fillseqsync")) {
-      write_sync = true;
-      bench_write(write_sync, SEQUENTIAL, FRESH, num_ / 100, FLAGS_value_size, 1);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "fillrand100K")) {
-      bench_write(write_sync, RANDOM, FRESH, num_ / 1000, 100 * 1000, 1);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "fillseq100K")) {
-      bench_write(write_sync, SEQUENTIAL, FRESH, num_ / 1000, 100 * 1000, 1);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "readseq")) {
-      bench_readseq();
-    } else if (!strcmp(name, "readrandom")) {
-      bench_read(RANDOM, 1);
-    } else if (!strcmp(name, "readrand100K")) {
-      int n = reads_;
-      reads_ /= 1000;
-      bench_read(RANDOM, 1);
-      reads_ = n;
+    snprintf(bench_name_, sizeof(bench_name_), "%s", name);
+    if (FLAGS_cold && (starts_with(name, "read") || starts_with(name, "scan")))
+      bench_evict();
+    if (!strcmp(name, "workload")) {
+      bench_workload();         /* reports each phase */
+    } else if (FLAGS_processes > 1 && strcmp(name, "analytics")) {
+      run_processes(name);
     } else {
-      known = false;
-      if (!isempty(name)) fprintf(stderr, "unknown benchmark '%s'\n", name);
-    }
-    if (known) {
-      bench_stop(name);
+      /* analytics skips --processes here rather than in every worker */
+      bench_start();
+      if (run_one(name)) bench_stop(name);
     }
   }
 }
 
-void bench_open() {
-  assert(db_ == NULL);
+/* Run the named benchmark on db_; false if there is no such benchmark */
+/* Whether benchmark name runs on a --backend=memory or lsm store */
+static bool kv_benchmark(const char* name) {
+  return starts_with(name, "fill") || starts_with(name, "overwrite") ||
+         !strcmp(name, "readseq") || !strcmp(name, "readrandom") ||
+         !strcmp(name, "readhot") || !strcmp(name, "readrand100K") ||
+         !strcmp(name, "null");
+}
 
-  int status;
-  char file_name[100];
-  char* err_msg = NULL;
-  db_num_++;
+static bool run_one(const char* name) {
+  bool known = true;
+  bool write_sync = false;
+  if (backend_ >= BACKEND_MEMORY && !kv_benchmark(name)) {
+    snprintf(message_, sizeof(message_), "skipping (--backend=%s)",
+             backend_name[backend_]);
+  } else if (!strcmp(name, "fillseq")) {
+    bench_write(write_sync, SEQUENTIAL, FRESH, num_, FLAGS_value_size, 1);
+    wal_checkpoint(db_);
+  } else if (!strcmp(name, "fillseqbatch")) {
+    bench_write(write_sync, SEQUENTIAL, FRESH, num_, FLAGS_value_size, 1000);
+    wal_checkpoint(db_);
+  } else if (!strcmp(name, "fillrandom")) {
+    bench_write(write_sync, RANDOM, FRESH, num_, FLAGS_value_size, 1);
+    wal_checkpoint(db_);
+  } else if (!strcmp(name, "fillrandbatch")) {
+    bench_write(write_sync, RANDOM, FRESH, num_, FLAGS_value_size, 1000);
+    wal_checkpoint(db_);
+  } else if (!strcmp(name, "overwrite")) {
+    bench_write(write_sync, RANDOM, EXISTING, num_, FLAGS_value_size, 1);
+    wal_checkpoint(db_);
+  } else if (!strcmp(name, "overwritebatch")) {
+    bench_write(write_sync, RANDOM, EXISTING, num_, FLAGS_value_size, 1000);
+    wal_checkpoint(db_);
+  } else if (!strcmp(name, "fillrandsync")) {
+    write_sync = true;
+    bench_write(write_sync, RANDOM, FRESH, num_ / 100, FLAGS_value_size, 1);
+    wal_checkpoint(db_);
+  } else if (!strcmp(name, "fillseqsync")) {
+    write_sync = true;
+    bench_write(write_sync, SEQUENTIAL, FRESH, num_ / 100, FLAGS_value_size, 1);
+    wal_checkpoint(db_);
+  } else if (!strcmp(name, "fillrand100K")) {
+    bench_write(write_sync, RANDOM, FRESH, num_ / 1000, 100 * 1000, 1);
+    wal_checkpoint(db_);
+  } else if (!strcmp(name, "fillseq100K")) {
+    bench_write(write_sync, SEQUENTIAL, FRESH, num_ / 1000, 100 * 1000, 1);
+    wal_checkpoint(db_);
+  } else if (!strcmp(name, "readseq")) {
+    bench_readseq();
+  } else if (!strcmp(name, "readrandom")) {
+    bench_read(RANDOM, 1);
+  } else if (!strcmp(name, "readhot")) {
+    bench_read(HOT, 1);
+  } else if (!strcmp(name, "readrand100K")) {
+    int n = reads_;
+    reads_ /= 1000;
+    bench_read(RANDOM, 1);
+    reads_ = n;
+  } else if (!strcmp(name, "readrandom_warmup")) {
+    bench_read_warmup(false);
+  } else if (!strcmp(name, "readrandom_preload")) {
+    bench_read_warmup(true);
+  } else if (!strcmp(name, "openlatency")) {
+    bench_open_latency();
+  } else if (!strcmp(name, "null")) {
+    bench_null();
+  } else if (!strcmp(name, "mutexmatrix")) {
+    bench_mutex_matrix();
+  } else if (!strcmp(name, "sharedcache")) {
+    bench_shared_cache();
+  } else if (!strcmp(name, "scancount")) {
+    bench_scan(SCAN_COUNT);
+  } else if (!strcmp(name, "scansum")) {
+    bench_scan(SCAN_SUM);
+  } else if (!strcmp(name, "scangroup")) {
+    bench_scan(SCAN_GROUP);
+  } else if (!strcmp(name, "scantopk")) {
+    bench_scan(SCAN_TOPK);
+  } else if (!strcmp(name, "analytics")) {
+    bench_analytics();
+  } else if (!strcmp(name, "backup")) {
+    bench_copy(false);
+  } else if (!strcmp(name, "vacuuminto")) {
+    bench_copy(true);
+  } else if (!strcmp(name, "replicaapply")) {
+    bench_replica_apply();
+  } else if (!strcmp(name, "replay")) {
+    bench_replay();
+  } else if (!strcmp(name, "batchsweep")) {
+    bench_batch_sweep(write_sync);
+  } else if (!strcmp(name, "batchsweepsync")) {
+    write_sync = true;
+    bench_batch_sweep(write_sync);
+  } else if (!strcmp(name, "groupcommit")) {
+    bench_groupcommit(write_sync, num_, FLAGS_value_size);
+    wal_checkpoint(db_);
+  } else if (!strcmp(name, "groupcommitsync")) {
+    write_sync = true;
+    bench_groupcommit(write_sync, num_, FLAGS_value_size);
+    wal_checkpoint(db_);
+  } else {
+    known = false;
+    if (!isempty(name) && worker_ == 0)
+      fprintf(stderr, "unknown benchmark '%s'\n", name);
+  }
+  return known;
+}
 
-  /* Open database */
-  char *tmp_dir = FLAGS_db;
-  snprintf(file_name, sizeof(file_name), "%s\\dbbench_sqlite3-%d.db",
-            tmp_dir, db_num_);
-  status = sqlite3_open(file_name, &db_);
-  if (status) {
-    fprintf(stderr, "open error: %s\n", sqlite3_errmsg(db_));
+/*
+ * --processes=N: fork N workers that each run the benchmark on their own
+ * connection to the same database, then merge what they report.  A
+ * connection must not cross fork(), so the parent closes its own first
+ * and reconnects to whichever database the workers ended on.
+ */
+static void run_processes(const char* name) {
+  if (isempty(name)) return;
+#ifdef _WIN32
+  fprintf(stderr, "--processes: fork() is not available on this platform\n");
+  exit(1);
+#else
+  const int n = FLAGS_processes;
+  ProcResult* results = (ProcResult*)mmap(NULL, sizeof(ProcResult) * n,
+                                          PROT_READ | PROT_WRITE,
+                                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (results == MAP_FAILED) {
+    perror("mmap");
     exit(1);
   }
+  pid_t* pids = (pid_t*)malloc(sizeof(pid_t) * n);
 
-  /* Change SQLite cache size */
-  char cache_size[100];
-  snprintf(cache_size, sizeof(cache_size), "PRAGMA cache_size = %d",
-            FLAGS_num_pages);
-  status = sqlite3_exec(db_, cache_size, NULL, NULL, &err_msg);
-  exec_error_check(status, err_msg);
+  sqlite3_close(db_);
+  db_ = NULL;
+  fflush(stdout);
+  fflush(stderr);
+  double start = now_seconds();
+  for (int w = 0; w < n; w++) {
+    pids[w] = fork();
+    if (pids[w] < 0) {
+      perror("fork");
+      exit(1);
+    }
+    if (pids[w] == 0) {
+      ProcResult* r = &results[w];
+      worker_ = w;
+      rand_init(&rand_, 301 + w);
+      bench_connect();
+      bench_start();
+      bool known = run_one(name);
+      r->seconds_ = now_seconds() - start_;
+      r->db_num_ = db_num_;
+      r->done_ = done_;
+      r->bytes_ = bytes_;
+      r->busy_retries_ = busy_.retries_;
+      r->busy_wait_ = busy_.wait_;
+      strcpy(r->message_, message_);
+      r->hist_ = hist_;
+      /* Each process profiles itself; show the first one's */
+      if (FLAGS_stmt_profile && w == 0) {
+        profile_print(db_);
+        fflush(stdout);
+      }
+      sqlite3_close(db_);
+      if (slow_usec_ > 0 && w == 0) {
+        slowlog_print(slow_usec_ / 1e3);
+        fflush(stdout);
+      }
+      _exit(known ? 0 : 2);
+    }
+  }
 
-  /* FLAGS_page_size is defaulted to 1024 */
-  if (FLAGS_page_size != 1024) {
-    char page_size[100];
-    snprintf(page_size, sizeof(page_size), "PRAGMA page_size = %d",
-              FLAGS_page_size);
-    status = sqlite3_exec(db_, page_size, NULL, NULL, &err_msg);
-    exec_error_check(status, err_msg);
+  bool known = true;
+  for (int w = 0; w < n; w++) {
+    int wstatus;
+    waitpid(pids[w], &wstatus, 0);
+    results[w].status_ = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 1;
+    if (results[w].status_ == 2) known = false;
   }
+  double finish = now_seconds();
+  elapsed += finish - start;
 
-  /* Change journal mode to WAL if WAL enabled flag is on */
-  if (FLAGS_WAL_enabled) {
-    char* WAL_stmt = "PRAGMA journal_mode = WAL";
+  for (int w = 0; w < n; w++) {
+    if (results[w].db_num_ > db_num_) db_num_ = results[w].db_num_;
+  }
+  bench_connect();
+  if (!known) {
+    munmap(results, sizeof(ProcResult) * n);
+    free(pids);
+    return;
+  }
 
-    /* Default cache size is a combined 4 MB */
-    char* WAL_checkpoint = "PRAGMA wal_autocheckpoint = 4096";
-    status = sqlite3_exec(db_, WAL_stmt, NULL, NULL, &err_msg);
-    exec_error_check(status, err_msg);
-    status = sqlite3_exec(db_, WAL_checkpoint, NULL, NULL, &err_msg);
-    exec_error_check(status, err_msg);
+  /* sqlite3_busy_timeout() waits out of sight, only our handlers count */
+  bool counted = strcmp(FLAGS_busy_handler, "timeout") != 0;
+  char rate[100], busy[100] = "";
+  int done = 0;
+  int64_t bytes = 0, retries = 0;
+  double wait = 0;
+  if (FLAGS_histogram) histogram_clear(&hist_);
+  for (int w = 0; w < n; w++) {
+    ProcResult* r = &results[w];
+    if (r->status_ != 0) {
+      fprintf(stdout, "  process %-4d : failed (exit status %d)\n",
+              w, r->status_);
+      continue;
+    }
+    int ops = r->done_ < 1 ? 1 : r->done_;
+    *rate = 0;
+    if (r->bytes_ > 0)
+      snprintf(rate, sizeof(rate), " %6.1f MB/s",
+               (r->bytes_ / 1048576.0) / r->seconds_);
+    if (counted)
+      snprintf(busy, sizeof(busy), " busy: %lld retries %.3f s",
+               (long long)r->busy_retries_, r->busy_wait_);
+    fprintf(stdout, "  process %-4d : %10.3f usec/op[%6.3f];%s%s%s%s\n",
+            w, r->seconds_ * 1e6 / ops, r->seconds_, rate, busy,
+            (isempty(r->message_) ? "" : " "), r->message_);
+    done += r->done_;
+    bytes += r->bytes_;
+    retries += r->busy_retries_;
+    wait += r->busy_wait_;
+    if (FLAGS_histogram) histogram_merge(&hist_, &r->hist_);
   }
+  if (done < 1) done = 1;
 
-  /* Change locking mode to exclusive and create tables/index for database */
-  char* stmt_array[] = {
-	"PRAGMA locking_mode = EXCLUSIVE",
-	FLAGS_use_rowids ? "CREATE TABLE test (key blob, value blob, PRIMARY KEY (key))" :
-	"CREATE TABLE test (key blob, value blob, PRIMARY KEY (key)) WITHOUT ROWID" };
-  int stmt_array_length = sizeof(stmt_array) / sizeof(char*);
-  for (int i = 0; i < stmt_array_length; i++) {
-    status = sqlite3_exec(db_, stmt_array[i], NULL, NULL, &err_msg);
-    exec_error_check(status, err_msg);
+  *rate = 0;
+  if (bytes > 0)
+    snprintf(rate, sizeof(rate), " %6.1f MB/s",
+             (bytes / 1048576.0) / (finish - start));
+  if (counted)
+    snprintf(busy, sizeof(busy), " busy: %lld retries %.3f s",
+             (long long)retries, wait);
+  fprintf(stdout, "%-14s : %10.3f usec/op[%6.3f];%s %.0f ops/s%s (%d procs)\n",
+          name, (finish - start) * 1e6 / done, finish - start, rate,
+          done / (finish - start), busy, n);
+  if (FLAGS_histogram) {
+    fprintf(stdout, "Microseconds per op:\n%s\n",
+            histogram_to_string(&hist_));
   }
+  fflush(stdout);
+
+  munmap(results, sizeof(ProcResult) * n);
+  free(pids);
+#endif
 }
 
-void bench_write(bool write_sync, int order, int state,
-                  int num_entries, int value_size, int entries_per_batch) {
-  /* Create new database if state == FRESH */
-  if (state == FRESH) {
-    if (FLAGS_use_existing_db) {
-      strcpy(message_, "skipping (--use_existing_db is true)");
-      return;
+/* Readers ATTACH every shard to one connection: checked before anything
+ * is printed */
+static void shard_check_attach(void) {
+  int shard_list[16];
+  int nshard;
+  sqlite3* db;
+
+  if (FLAGS_shards == NULL || strcmp(FLAGS_shard_mode, "attach")) return;
+  nshard = parse_int_list(FLAGS_shards, shard_list, 16);
+  if (sqlite3_open(":memory:", &db) != SQLITE_OK) return;
+  int max_shards = sqlite3_limit(db, SQLITE_LIMIT_ATTACHED, -1) + 1;
+  sqlite3_close(db);
+  for (int i = 0; i < nshard; i++) {
+    if (shard_list[i] > max_shards) {
+      fprintf(stderr, "--shard_mode=attach allows at most %d shards "
+              "(SQLITE_MAX_ATTACHED)\n", max_shards);
+      exit(1);
     }
-    sqlite3_close(db_);
-    db_ = NULL;
-    bench_open();
-    bench_start();
   }
+}
 
-  if (num_entries != num_) {
-    char msg[100];
-    snprintf(msg, sizeof(msg), "(%d ops)", num_entries);
-    strcpy(message_, msg);
+/* Run the benchmarks once per --shards x --threads combination */
+static void run_sharded(void) {
+  int shard_list[16], thread_list[16];
+  int nshard, nthread;
+
+  if (FLAGS_shards == NULL) {
+    run_benchmarks();
+    return;
+  }
+  nshard = parse_int_list(FLAGS_shards, shard_list, 16);
+  nthread = 1;
+  thread_list[0] = 0;
+  if (FLAGS_threads != NULL)
+    nthread = parse_int_list(FLAGS_threads, thread_list, 16);
+  if (nshard <= 0 || nthread <= 0) {
+    fprintf(stderr, "invalid --shards or --threads list\n");
+    exit(1);
+  }
+  if (FLAGS_processes > 1) {
+    fprintf(stderr, "--shards and --processes cannot be combined\n");
+    exit(1);
+  }
+  if (strcmp(FLAGS_shard_mode, "files") && strcmp(FLAGS_shard_mode, "attach")) {
+    fprintf(stderr, "unknown shard mode '%s'\n", FLAGS_shard_mode);
+    exit(1);
   }
 
-  char* err_msg = NULL;
-  int status;
+  for (int i = 0; i < nshard; i++) {
+    for (int j = 0; j < nthread; j++) {
+      if (shard_list[i] < 1 || shard_list[i] > kMaxShards ||
+          thread_list[j] < 0) {
+        fprintf(stderr, "shards must be 1..%d, threads >= 0\n", kMaxShards);
+        exit(1);
+      }
+      shards_ = shard_list[i];
+      threads_ = thread_list[j];
+      shard_db_num_ = 0;
+      if (threads_ > 0)
+        fprintf(stdout, "Shards:     %d, %d threads\n", shards_, threads_);
+      else
+        fprintf(stdout, "Shards:     %d, thread per shard\n", shards_);
+      run_benchmarks();
+    }
+  }
+  shards_ = 0;
+}
 
-  sqlite3_stmt *replace_stmt, *begin_trans_stmt, *end_trans_stmt;
-  char* replace_str = "REPLACE INTO test (key, value) VALUES (?, ?)";
-  char* begin_trans_str = "BEGIN TRANSACTION";
-  char* end_trans_str = "END TRANSACTION";
+void benchmark_run() {
+  shard_check_attach();
+  print_header();
+  /* --subtract_harness needs a null run even if none is asked for */
+  harness_usec_ = 0;
+  if (FLAGS_subtract_harness) {
+    bench_start();
+    bench_null();
+  }
+  if (FLAGS_lookaside == NULL) {
+    bench_open();
+    run_sharded();
+    return;
+  }
+
+  /* Sweep: rerun the benchmarks on a new database per lookaside setting */
+  const char* p = FLAGS_lookaside;
+  while (*p != 0) {
+    if (sscanf(p, "%dx%d", &lookaside_size_, &lookaside_count_) != 2) {
+      fprintf(stderr, "invalid lookaside setting '%s'\n", p);
+      exit(1);
+    }
+    if (db_ != NULL) {
+      sqlite3_close(db_);
+      db_ = NULL;
+    }
+    fprintf(stdout, "Lookaside:  %d bytes x %d slots\n",
+            lookaside_size_, lookaside_count_);
+    bench_open();
+    run_sharded();
+    fprintf(stdout, "----------------------------------------------------\n");
+    p = strchr(p, ',');
+    if (p == NULL) break;
+    p++;
+  }
+}
+
+void bench_open() {
+  assert(db_ == NULL);
+
+  db_num_++;
+  bench_connect();
+}
+
+/*
+ * SQLITE_BUSY handler for --processes.  "backoff" sleeps on SQLite's own
+ * busy_timeout schedule, "yield" retries after giving up the CPU; both
+ * count retries and the time spent waiting.
+ */
+static int busy_handler(void* arg, int count) {
+  static const int delays[] = { 1, 2, 5, 10, 15, 20, 25, 25, 25, 50, 50, 100 };
+  const int ndelay = sizeof(delays) / sizeof(delays[0]);
+  BusyStats* busy = (BusyStats*)arg;
+  double now = now_seconds();
+
+  if (count == 0) busy->first_ = now;
+  if ((now - busy->first_) * 1000 >= FLAGS_busy_timeout) return 0;
+  if (!strcmp(FLAGS_busy_handler, "yield")) {
+    sqlite3_sleep(0);
+  } else {
+    sqlite3_sleep(delays[count < ndelay ? count : ndelay - 1]);
+  }
+  busy->retries_++;
+  busy->wait_ += now_seconds() - now;
+  return 1;
+}
+
+/*
+ * sqlite3_trace_v2() callback of every connection for --stmt_profile, and
+ * of db_ for --trace_capture (ctx is then the TraceWriter).
+ */
+static int db_trace(unsigned type, void* ctx, void* p, void* x) {
+  sqlite3_stmt* stmt = (sqlite3_stmt*)p;
+  if (type == SQLITE_TRACE_STMT) {
+    if (FLAGS_stmt_profile) profile_begin(stmt, (const char*)x);
+    if (ctx != NULL) trace_capture_stmt((TraceWriter*)ctx, stmt, (const char*)x);
+  } else if (type == SQLITE_TRACE_PROFILE) {
+    profile_end(stmt, *(sqlite3_int64*)x);
+  }
+  return 0;
+}
+
+static void db_trace_install(sqlite3* db, TraceWriter* capture) {
+  unsigned mask = 0;
+  if (FLAGS_stmt_profile) mask |= SQLITE_TRACE_STMT | SQLITE_TRACE_PROFILE;
+  if (capture != NULL) mask |= SQLITE_TRACE_STMT;
+  if (mask != 0) sqlite3_trace_v2(db, mask, db_trace, capture);
+}
+
+static bool shared_db(void) {
+  return FLAGS_processes > 1 || shards_ > 0 || own_connections_;
+}
+
+/* Name of database file num, or of one of its shards when shard >= 0 */
+static char* db_file_name(char* buf, size_t size, int num, int shard) {
+  char *tmp_dir = FLAGS_db;
+  if (shard < 0)
+    snprintf(buf, size, "%s/dbbench_sqlite3-%d.db", tmp_dir, num);
+  else
+    snprintf(buf, size, "%s/dbbench_sqlite3-%d.%d.db", tmp_dir, num, shard);
+  return buf;
+}
+
+/* Connect to database db_num_, creating its table if it is new */
+static void bench_connect(void) {
+  char file_name[100];
+  assert(db_ == NULL);
+  db_ = open_db(db_file_name(file_name, sizeof(file_name), db_num_, -1),
+                &busy_);
+  if (capture_ != NULL) db_trace_install(db_, capture_);
+}
+
+/* Open file_name with the benchmark's settings; busy collects lock waits */
+static sqlite3* open_db(const char* file_name, BusyStats* busy) {
+  sqlite3* db;
+  int status;
+  char* err_msg = NULL;
+
+  /* Keep each connection's allocations apart under --allocator=arena */
+  if (FLAGS_allocator != NULL) alloc_new_arena();
+
+  /* Open database */
+  status = sqlite3_open_v2(file_name, &db,
+                           SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE |
+                           open_flags_, NULL);
+  if (status) {
+    fprintf(stderr, "open error: %s\n", sqlite3_errmsg(db));
+    exit(1);
+  }
+  if (open_marks_ != NULL) open_marks_[OPEN_OPEN] = now_seconds();
+  db_trace_install(db, NULL);
+
+  /* Connections share the file, so wait on each other's locks */
+  if (shared_db()) {
+    if (!strcmp(FLAGS_busy_handler, "timeout")) {
+      status = sqlite3_busy_timeout(db, FLAGS_busy_timeout);
+    } else if (!strcmp(FLAGS_busy_handler, "backoff") ||
+               !strcmp(FLAGS_busy_handler, "yield")) {
+      status = sqlite3_busy_handler(db, busy_handler, busy);
+    } else {
+      fprintf(stderr, "unknown busy handler '%s'\n", FLAGS_busy_handler);
+      exit(1);
+    }
+    error_check(status);
+  }
+
+  /* Lookaside must be configured before the connection allocates any */
+  if (lookaside_size_ >= 0) {
+    status = sqlite3_db_config(db, SQLITE_DBCONFIG_LOOKASIDE, NULL,
+                               lookaside_size_, lookaside_count_);
+    error_check(status);
+  }
+
+  /* openlatency: most pragmas would load the schema, so do the first read
+   * (which recovers the WAL) and the schema load on their own */
+  if (open_marks_ != NULL) {
+    exec_sql(db, "PRAGMA schema_version");
+    open_marks_[OPEN_RECOVERY] = now_seconds();
+    exec_sql(db, "SELECT 1 FROM sqlite_master LIMIT 1");
+    open_marks_[OPEN_SCHEMA] = now_seconds();
+  }
+
+  /* Change SQLite cache size */
+  char cache_size[100];
+  snprintf(cache_size, sizeof(cache_size), "PRAGMA cache_size = %d",
+            FLAGS_num_pages);
+  status = sqlite3_exec(db, cache_size, NULL, NULL, &err_msg);
+  exec_error_check(status, err_msg);
+
+  /* FLAGS_page_size is defaulted to 1024 */
+  if (FLAGS_page_size != 1024) {
+    char page_size[100];
+    snprintf(page_size, sizeof(page_size), "PRAGMA page_size = %d",
+              FLAGS_page_size);
+    status = sqlite3_exec(db, page_size, NULL, NULL, &err_msg);
+    exec_error_check(status, err_msg);
+  }
+
+  /* Change journal mode to WAL if WAL enabled flag is on */
+  if (FLAGS_WAL_enabled) {
+    char* WAL_stmt = "PRAGMA journal_mode = WAL";
+
+    /* Default cache size is a combined 4 MB */
+    char* WAL_checkpoint = "PRAGMA wal_autocheckpoint = 4096";
+    status = sqlite3_exec(db, WAL_stmt, NULL, NULL, &err_msg);
+    exec_error_check(status, err_msg);
+    status = sqlite3_exec(db, WAL_checkpoint, NULL, NULL, &err_msg);
+    exec_error_check(status, err_msg);
+    if (metrics_ || slow_usec_ > 0) sqlite3_wal_hook(db, wal_hook, NULL);
+  }
+
+  /* Change locking mode to exclusive and create tables/index for database.
+   * Shared files only work in normal locking mode, and any connection
+   * may be the one to create the table. */
+  char* stmt_array[] = {
+	shared_db() ? "PRAGMA locking_mode = NORMAL" :
+	"PRAGMA locking_mode = EXCLUSIVE",
+	FLAGS_use_intpk ? "CREATE TABLE IF NOT EXISTS test (key INTEGER PRIMARY KEY, value blob)" :
+	FLAGS_use_rowids ? "CREATE TABLE IF NOT EXISTS test (key blob, value blob, PRIMARY KEY (key))" :
+	"CREATE TABLE IF NOT EXISTS test (key blob, value blob, PRIMARY KEY (key)) WITHOUT ROWID" };
+  int stmt_array_length = sizeof(stmt_array) / sizeof(char*);
+  for (int i = 0; i < stmt_array_length; i++) {
+    status = sqlite3_exec(db, stmt_array[i], NULL, NULL, &err_msg);
+    exec_error_check(status, err_msg);
+  }
+  if (open_marks_ != NULL) open_marks_[OPEN_PRAGMAS] = now_seconds();
+  return db;
+}
+
+static void changesets_clear(void) {
+  for (int i = 0; i < nchangesets_; i++) sqlite3_free(changesets_[i].data_);
+  nchangesets_ = 0;
+}
+
+/* Start recording the next transaction of db_ on the test table */
+static void session_begin(void) {
+#ifdef SQLITE_ENABLE_SESSION
+  error_check(sqlite3session_create(db_, "main", &session_));
+  error_check(sqlite3session_attach(session_, "test"));
+#endif
+}
+
+/* Keep the changeset of the transaction just committed */
+static void session_end(void) {
+#ifdef SQLITE_ENABLE_SESSION
+  Changeset c;
+  double start = now_seconds();
+  error_check(sqlite3session_changeset(session_, &c.size_, &c.data_));
+  session_seconds_ += now_seconds() - start;
+  session_bytes_ += c.size_;
+  sqlite3session_delete(session_);
+  session_ = NULL;
+  if (c.size_ == 0) return;
+  if (nchangesets_ == changesets_cap_) {
+    changesets_cap_ = changesets_cap_ > 0 ? changesets_cap_ * 2 : 1024;
+    changesets_ = (Changeset*)realloc(changesets_,
+                                      changesets_cap_ * sizeof(Changeset));
+  }
+  changesets_[nchangesets_++] = c;
+#endif
+}
+
+void bench_write(bool write_sync, int order, int state,
+                  int num_entries, int value_size, int entries_per_batch) {
+  if (shards_ > 0) {
+    bench_shard_write(write_sync, order, state, num_entries, value_size,
+                      entries_per_batch);
+    return;
+  }
+  if (backend_ != BACKEND_SQLITE) {
+    bench_kv_write(write_sync, order, state, num_entries, value_size,
+                   entries_per_batch);
+    return;
+  }
+
+  /* --session: the same writes without a session first */
+  bool session = FLAGS_session && !session_baseline_;
+  double base_usec = 0;
+  if (session) {
+    session_baseline_ = true;
+    bench_write(write_sync, order, state, num_entries, value_size,
+                entries_per_batch);
+    session_baseline_ = false;
+    base_usec = (now_seconds() - start_) * 1e6 / (done_ > 0 ? done_ : 1);
+    if (state != FRESH) {
+      wal_checkpoint(db_);
+      bench_start();
+    }
+    changesets_clear();
+    changesets_sync_ = write_sync;
+    session_seconds_ = 0;
+    session_bytes_ = 0;
+  }
+
+  /* Create new database if state == FRESH */
+  if (state == FRESH) {
+    if (FLAGS_use_existing_db) {
+      strcpy(message_, "skipping (--use_existing_db is true)");
+      return;
+    }
+    sqlite3_close(db_);
+    db_ = NULL;
+    bench_open();
+    bench_start();
+  }
+
+  if (num_entries != num_) {
+    char msg[100];
+    snprintf(msg, sizeof(msg), "(%d ops)", num_entries);
+    strcpy(message_, msg);
+  }
+
+  char* err_msg = NULL;
+  int status;
+
+  sqlite3_stmt *replace_stmt, *begin_trans_stmt, *end_trans_stmt;
+  char* replace_str = "REPLACE INTO test (key, value) VALUES (?, ?)";
+  char* begin_trans_str = "BEGIN TRANSACTION";
+  char* end_trans_str = "END TRANSACTION";
 
   /* Check for synchronous flag in options */
   char* sync_stmt =
@@ -411,7 +1882,17 @@ void bench_write(bool write_sync, int order, int state,
   error_check(status);
 
   bool transaction = (entries_per_batch > 1);
-  for (int i = 0; i < num_entries; i += entries_per_batch) {
+  bool adaptive = transaction && FLAGS_target_commit_ms > 0;
+  bool timed = adaptive || sweeping_;
+  double row_cost = 0;
+  int64_t batches = 0;
+  int rows;
+  for (int i = 0; i < num_entries; i += rows) {
+    rows = entries_per_batch < num_entries - i ? entries_per_batch :
+           num_entries - i;
+    double batch_start = timed ? now_seconds() : 0;
+    if (session) session_begin();
+
     /* Begin write transaction */
     if (FLAGS_transaction && transaction) {
       status = sqlite3_step(begin_trans_stmt);
@@ -421,32 +1902,39 @@ void bench_write(bool write_sync, int order, int state,
     }
 
     /* Create and execute SQL statements */
-    for (int j = 0; j < entries_per_batch; j++) {
+    for (int j = 0; j < rows; j++) {
+      uint64_t t = phase_start();
       const char* value = rand_gen_generate(&gen_, value_size);
 
       /* Create values for key-value pair */
       const int k = (order == SEQUENTIAL) ? i + j : (rand_next(&rand_) % num_entries);
-      char key[100];
-      snprintf(key, sizeof(key), "%016d", k);
+      char key[kMaxKeySize];
+      int key_size = encode_key(k, key);
+      t = phase_add(PHASE_GEN, t);
 
       /* Bind KV values into replace_stmt */
-      status = sqlite3_bind_blob(replace_stmt, 1, key, 16, SQLITE_STATIC);
-      error_check(status);
+      bind_encoded_key(replace_stmt, 1, k, key, key_size);
+      value = stamp_value(verify_scratch_, value, value_size, k);
       status = sqlite3_bind_blob(replace_stmt, 2, value, value_size, SQLITE_STATIC);
       error_check(status);
+      t = phase_add(PHASE_BIND, t);
 
       /* Execute replace_stmt */
-      bytes_ += value_size + strlen(key);
+      bytes_ += value_size + key_size;
       status = sqlite3_step(replace_stmt);
       step_error_check(status);
+      t = phase_add(PHASE_STEP, t);
 
       /* Reset SQLite statement for another use */
       status = sqlite3_clear_bindings(replace_stmt);
       error_check(status);
       status = sqlite3_reset(replace_stmt);
       error_check(status);
+      t = phase_add(PHASE_RESET, t);
 
+      op_note(TRACE_WRITE, k);
       finished_single_op();
+      phase_add(PHASE_BOOK, t);
     }
 
     /* End write transaction */
@@ -456,6 +1944,48 @@ void bench_write(bool write_sync, int order, int state,
       status = sqlite3_reset(end_trans_stmt);
       error_check(status);
     }
+
+    double commit = 0;
+    if (timed) {
+      commit = now_seconds() - batch_start;
+      histogram_add(&commit_hist_, commit * 1e6);
+    }
+    batches++;
+    if (session) session_end();
+
+    /* --target_commit_ms: size the next batch from the smoothed cost of
+     * a row, moving at most 2x per transaction to ride out outliers */
+    if (adaptive) {
+      double cost = commit / rows;
+      row_cost = (row_cost == 0) ? cost : 0.8 * row_cost + 0.2 * cost;
+      double next = FLAGS_target_commit_ms * 1e-3 / row_cost;
+      if (next > entries_per_batch * 2.0) next = entries_per_batch * 2.0;
+      if (next < entries_per_batch / 2.0) next = entries_per_batch / 2.0;
+      if (next > kMaxBatch) next = kMaxBatch;
+      entries_per_batch = next < 1 ? 1 : (int)next;
+    }
+  }
+
+  if (adaptive) {
+    char msg[200];
+    snprintf(msg, sizeof(msg),
+             "batch avg %.0f last %d, commit p50 %.2f p99 %.2f ms "
+             "(target %.2f)",
+             batches > 0 ? (double)num_entries / batches : 0.0,
+             entries_per_batch, histogram_percentile(&commit_hist_, 50) / 1e3,
+             histogram_percentile(&commit_hist_, 99) / 1e3,
+             FLAGS_target_commit_ms);
+    append_message(msg);
+  }
+  if (session && batches > 0) {
+    char msg[200];
+    double usec = (now_seconds() - start_) * 1e6 / (done_ > 0 ? done_ : 1);
+    snprintf(msg, sizeof(msg), "session %+.1f%% (%.3f usec/op without), "
+             "changeset %.1f usec %.0f bytes per batch",
+             base_usec > 0 ? 100.0 * (usec / base_usec - 1) : 0.0, base_usec,
+             session_seconds_ * 1e6 / batches,
+             (double)session_bytes_ / batches);
+    append_message(msg);
   }
 
   status = sqlite3_finalize(replace_stmt);
@@ -466,7 +1996,75 @@ void bench_write(bool write_sync, int order, int state,
   error_check(status);
 }
 
+/*
+ * Rerun a random-order write on a fresh database for each --batch_sizes
+ * entry and print throughput and commit latency per batch size.  Every
+ * size writes at least ten transactions so the percentiles mean something.
+ */
+static void bench_batch_sweep(bool write_sync) {
+  int sizes[16];
+  int nsizes = parse_int_list(FLAGS_batch_sizes, sizes, 16);
+
+  if (shards_ > 0) {
+    strcpy(message_, "skipping (not sharded)");
+    return;
+  }
+  if (FLAGS_use_existing_db) {
+    strcpy(message_, "skipping (--use_existing_db is true)");
+    return;
+  }
+  if (nsizes <= 0) {
+    fprintf(stderr, "invalid --batch_sizes list\n");
+    exit(1);
+  }
+
+  /* Adaptive batching would move off the size under test, and a session
+   * would run each size twice */
+  double target = FLAGS_target_commit_ms;
+  bool session = FLAGS_session;
+  FLAGS_target_commit_ms = 0;
+  FLAGS_session = false;
+  sweeping_ = true;
+  fprintf(stdout, "  %7s %8s %12s %8s %10s %10s %10s\n", "batch", "commits",
+          "ops/s", "MB/s", "p50 ms", "p99 ms", "max ms");
+  for (int i = 0; i < nsizes; i++) {
+    int batch = sizes[i] < 1 ? 1 : sizes[i];
+    /* N/100 rows in sync mode, as fillrandsync; batch=1 fsyncs each */
+    int rows = write_sync ? num_ / 100 : num_;
+    if (rows < batch * 10) rows = batch * 10;
+    sqlite3_close(db_);
+    db_ = NULL;
+    bench_open();
+    histogram_clear(&commit_hist_);
+    int64_t bytes = bytes_;
+    double start = now_seconds();
+    bench_write(write_sync, RANDOM, EXISTING, rows, FLAGS_value_size, batch);
+    double seconds = now_seconds() - start;
+    fprintf(stdout, "  %7d %8.0f %12.0f %8.1f %10.3f %10.3f %10.3f\n",
+            batch, commit_hist_.num_, rows / seconds,
+            (bytes_ - bytes) / 1048576.0 / seconds,
+            histogram_percentile(&commit_hist_, 50) / 1e3,
+            histogram_percentile(&commit_hist_, 99) / 1e3,
+            commit_hist_.max_ / 1e3);
+    fflush(stdout);
+    wal_checkpoint(db_);
+  }
+  FLAGS_target_commit_ms = target;
+  FLAGS_session = session;
+  sweeping_ = false;
+  *message_ = 0;
+}
+
 void bench_read(int order, int entries_per_batch) {
+  if (shards_ > 0) {
+    bench_shard_read(order);
+    return;
+  }
+  if (backend_ != BACKEND_SQLITE) {
+    bench_kv_read(order);
+    return;
+  }
+
   int status;
   sqlite3_stmt *read_stmt, *begin_trans_stmt, *end_trans_stmt;
 
@@ -495,24 +2093,34 @@ void bench_read(int order, int entries_per_batch) {
     /* Create and execute SQL statements */
     for (int j = 0; j < entries_per_batch; j++) {
       /* Create key value */
-      char key[100];
-      int k = (order == SEQUENTIAL) ? i + j : (rand_next(&rand_) % reads_);
-      snprintf(key, sizeof(key), "%016d", k);
+      uint64_t t = phase_start();
+      char key[kMaxKeySize];
+      int k = (order == SEQUENTIAL) ? i + j :
+              (order == HOT) ? (rand_next(&rand_) % ((num_ + 99) / 100)) :
+              (rand_next(&rand_) % reads_);
+      int key_size = encode_key(k, key);
+      t = phase_add(PHASE_GEN, t);
 
       /* Bind key value into read_stmt */
-      status = sqlite3_bind_blob(read_stmt, 1, key, 16, SQLITE_STATIC);
-      error_check(status);
+      bind_encoded_key(read_stmt, 1, k, key, key_size);
+      t = phase_add(PHASE_BIND, t);
       
       /* Execute read statement */
-      while ((status = sqlite3_step(read_stmt)) == SQLITE_ROW) {}
+      while ((status = sqlite3_step(read_stmt)) == SQLITE_ROW) {
+        if (FLAGS_verify) verify_row(read_stmt, k, &verify_);
+      }
       step_error_check(status);
+      t = phase_add(PHASE_STEP, t);
 
       /* Reset SQLite statement for another use */
       status = sqlite3_clear_bindings(read_stmt);
       error_check(status);
       status = sqlite3_reset(read_stmt);
       error_check(status);
+      t = phase_add(PHASE_RESET, t);
+      op_note(TRACE_READ, k);
       finished_single_op();
+      phase_add(PHASE_BOOK, t);
     }
 
     /* End read transaction */
@@ -533,18 +2141,1958 @@ void bench_read(int order, int entries_per_batch) {
 }
 
 
+/* Drop the files of database num (or of shard) from the OS page cache */
+static void drop_db_cache(int num, int shard) {
+  char file_name[100], aux[120];
+  db_file_name(file_name, sizeof(file_name), num, shard);
+  drop_file_cache(file_name);
+  snprintf(aux, sizeof(aux), "%s-wal", file_name);
+  drop_file_cache(aux);
+  snprintf(aux, sizeof(aux), "%s-shm", file_name);
+  drop_file_cache(aux);
+}
+
+/*
+ * Start the next benchmark cold: close db_, which also drops SQLite's page
+ * cache, evict the database files (and the current shards) from the OS
+ * page cache and reconnect.
+ */
+static void bench_evict(void) {
+  sqlite3_close(db_);
+  db_ = NULL;
+  drop_db_cache(db_num_, -1);
+  for (int s = 0; shard_db_num_ > 0 && s < shards_; s++) {
+    drop_db_cache(shard_db_num_, s);
+  }
+  bench_connect();
+}
+
+/*
+ * readrandom from an evicted cache, showing latency for each tenth of the
+ * reads as the caches refill.  With preload the file is first read
+ * through sequentially, the cheapest way to make every page hot again.
+ */
+static void bench_read_warmup(bool preload) {
+  const int kPhases = 10;
+  Histogram phase[kPhases];
+  sqlite3_stmt* read_stmt;
+  char file_name[100];
+  int status;
+
+  if (shards_ > 0) {
+    strcpy(message_, "skipping (not sharded)");
+    return;
+  }
+  bench_evict();
+  for (int p = 0; p < kPhases; p++) histogram_clear(&phase[p]);
+  bench_start();
+
+  if (preload) {
+    char msg[100];
+    double start = now_seconds();
+    int64_t bytes = preload_file(db_file_name(file_name, sizeof(file_name),
+                                              db_num_, -1));
+    double seconds = now_seconds() - start;
+    snprintf(msg, sizeof(msg), "preload %.1f MB in %.3f s (%.1f MB/s)",
+             bytes / 1048576.0, seconds,
+             seconds > 0 ? bytes / 1048576.0 / seconds : 0.0);
+    append_message(msg);
+  }
+
+  status = sqlite3_prepare_v2(db_, "SELECT * FROM test WHERE key = ?", -1,
+                              &read_stmt, NULL);
+  error_check(status);
+  for (int i = 0; i < reads_; i++) {
+    char key[kMaxKeySize];
+    int k = rand_next(&rand_) % reads_;
+    double start = now_seconds();
+    bind_key(read_stmt, 1, k, key);
+    while ((status = sqlite3_step(read_stmt)) == SQLITE_ROW) {
+      if (FLAGS_verify) verify_row(read_stmt, k, &verify_);
+    }
+    step_error_check(status);
+    status = sqlite3_reset(read_stmt);
+    error_check(status);
+    histogram_add(&phase[(int)((int64_t)i * kPhases / reads_)],
+                  (now_seconds() - start) * 1e6);
+    op_note(TRACE_READ, k);
+    finished_single_op();
+  }
+  status = sqlite3_finalize(read_stmt);
+  error_check(status);
+
+  fprintf(stdout, "  %7s %10s %10s %10s %10s\n", "reads", "avg usec",
+          "p50", "p99", "max");
+  for (int p = 0; p < kPhases; p++) {
+    if (phase[p].num_ == 0) continue;
+    fprintf(stdout, "  %5d0%% %10.3f %10.3f %10.3f %10.3f\n", p + 1,
+            phase[p].sum_ / phase[p].num_, histogram_percentile(&phase[p], 50),
+            histogram_percentile(&phase[p], 99), phase[p].max_);
+  }
+}
+
+
+/*
+ * Build the database for one openlatency configuration: 1000 rows to
+ * query, the given number of extra tables with an index each, and a WAL
+ * of at least wal_mb MB that nothing checkpoints.
+ */
+static void open_latency_setup(const char* file_name, int tables, int wal_mb) {
+  char sql[200], wal_name[120];
+  int status;
+
+  remove(file_name);
+  snprintf(wal_name, sizeof(wal_name), "%s-wal", file_name);
+  remove(wal_name);
+  sqlite3* db = open_db(file_name, &busy_);
+  exec_sql(db, "PRAGMA synchronous = OFF");
+  exec_sql(db, "BEGIN");
+  for (int t = 0; t < tables; t++) {
+    snprintf(sql, sizeof(sql),
+             "CREATE TABLE t%d (id INTEGER PRIMARY KEY, name TEXT, data BLOB)", t);
+    exec_sql(db, sql);
+    snprintf(sql, sizeof(sql), "CREATE INDEX t%d_name ON t%d (name)", t, t);
+    exec_sql(db, sql);
+  }
+  exec_sql(db, "COMMIT");
+
+  sqlite3_stmt* stmt;
+  status = sqlite3_prepare_v2(db, "REPLACE INTO test (key, value) VALUES (?, ?)",
+                              -1, &stmt, NULL);
+  error_check(status);
+  int k = 0;
+  for (bool base = true; ; base = false) {
+    exec_sql(db, "BEGIN");
+    for (int i = 0; i < 1000; i++, k++) {
+      char key[kMaxKeySize];
+      bind_key(stmt, 1, k, key);
+      status = sqlite3_bind_blob(stmt, 2,
+                                 stamp_value(verify_scratch_,
+                                             rand_gen_generate(&gen_, FLAGS_value_size),
+                                             FLAGS_value_size, k),
+                                 FLAGS_value_size, SQLITE_STATIC);
+      error_check(status);
+      step_error_check(sqlite3_step(stmt));
+      error_check(sqlite3_reset(stmt));
+    }
+    exec_sql(db, "COMMIT");
+
+    /* The first rows and the schema go to the database file itself */
+    if (base) {
+      sqlite3_wal_checkpoint_v2(db, NULL, SQLITE_CHECKPOINT_TRUNCATE, NULL,
+                                NULL);
+      exec_sql(db, "PRAGMA wal_autocheckpoint = 0");
+    }
+    if (!FLAGS_WAL_enabled || file_size(wal_name) >= (int64_t)wal_mb << 20)
+      break;
+  }
+  error_check(sqlite3_finalize(stmt));
+  sqlite3_db_config(db, SQLITE_DBCONFIG_NO_CKPT_ON_CLOSE, 1, NULL);
+  error_check(sqlite3_close(db));
+}
+
+/*
+ * Open-to-first-result latency: open a connection, recover the WAL, load
+ * the schema, apply the benchmark's pragmas, prepare a point query and run
+ * it, then close, timing each phase.  Swept over --open_tables x
+ * --open_wal_mb.  Uses its own files so db_ is left alone.
+ */
+static void bench_open_latency(void) {
+  static const char* const phase_name[kOpenPhases] = {
+    "open", "wal", "schema", "pragmas", "prepare", "query", "close"
+  };
+  int table_list[16], wal_list[16];
+  int ntables = parse_int_list(FLAGS_open_tables, table_list, 16);
+  int nwal = parse_int_list(FLAGS_open_wal_mb, wal_list, 16);
+  char file_name[100], wal_name[120];
+  double marks[kOpenPhases + 1];
+  Histogram total;
+
+  if (ntables <= 0 || nwal <= 0) {
+    fprintf(stderr, "invalid --open_tables or --open_wal_mb list\n");
+    exit(1);
+  }
+
+  fprintf(stdout, "  %6s %6s", "tables", "wal MB");
+  for (int p = 0; p < kOpenPhases; p++) fprintf(stdout, " %8s", phase_name[p]);
+  fprintf(stdout, " %8s %8s  (usec)\n", "total", "p99");
+  for (int t = 0; t < ntables; t++) {
+    for (int w = 0; w < nwal; w++) {
+      double sum[kOpenPhases];
+      int n = 0;
+      snprintf(file_name, sizeof(file_name), "%s/dbbench_sqlite3-open%d.db",
+               FLAGS_db, t * nwal + w);
+      snprintf(wal_name, sizeof(wal_name), "%s-wal", file_name);
+      open_latency_setup(file_name, table_list[t], wal_list[w]);
+      int64_t wal_bytes = file_size(wal_name);
+
+      memset(sum, 0, sizeof(sum));
+      histogram_clear(&total);
+      open_marks_ = marks + 1;
+      for (int i = 0; i < FLAGS_open_iters; i++) {
+        sqlite3_stmt* stmt;
+        char key[kMaxKeySize];
+        int status;
+
+        marks[0] = now_seconds();
+        sqlite3* db = open_db(file_name, &busy_);
+        status = sqlite3_prepare_v2(db, "SELECT * FROM test WHERE key = ?",
+                                    -1, &stmt, NULL);
+        error_check(status);
+        marks[1 + OPEN_PREPARE] = now_seconds();
+        bind_key(stmt, 1, rand_next(&rand_) % 1000, key);
+        while ((status = sqlite3_step(stmt)) == SQLITE_ROW) {}
+        step_error_check(status);
+        error_check(sqlite3_finalize(stmt));
+        marks[1 + OPEN_QUERY] = now_seconds();
+        /* Leave the WAL in place for the next open */
+        sqlite3_db_config(db, SQLITE_DBCONFIG_NO_CKPT_ON_CLOSE, 1, NULL);
+        error_check(sqlite3_close(db));
+        marks[1 + OPEN_CLOSE] = now_seconds();
+
+        for (int p = 0; p < kOpenPhases; p++) sum[p] += marks[p + 1] - marks[p];
+        histogram_add(&total, (marks[kOpenPhases] - marks[0]) * 1e6);
+        n++;
+        finished_single_op();
+      }
+      open_marks_ = NULL;
+
+      fprintf(stdout, "  %6d %6.1f", table_list[t], wal_bytes / 1048576.0);
+      for (int p = 0; p < kOpenPhases; p++)
+        fprintf(stdout, " %8.1f", sum[p] * 1e6 / n);
+      fprintf(stdout, " %8.1f %8.1f\n", total.sum_ / n,
+              histogram_percentile(&total, 99));
+      fflush(stdout);
+    }
+  }
+}
+
+
+/*
+ * null: the harness of a bench_write op with no SQLite calls, i.e. key
+ * and value generation and finished_single_op().  Its usec/op is what
+ * --subtract_harness takes off the other benchmarks.
+ */
+static void bench_null(void) {
+  int sink = 0;
+  for (int i = 0; i < num_; i++) {
+    uint64_t t = phase_start();
+    char key[kMaxKeySize];
+    const char* value = rand_gen_generate(&gen_, FLAGS_value_size);
+    int k = rand_next(&rand_) % num_;
+    sink += encode_key(k, key) + value[0];
+    t = phase_add(PHASE_GEN, t);
+    finished_single_op();
+    phase_add(PHASE_BOOK, t);
+  }
+  null_sink_ = sink;
+  harness_usec_ = (now_seconds() - start_) * 1e6 / (num_ > 0 ? num_ : 1);
+}
+
 void bench_readseq() {
   int status;
   sqlite3_stmt *stmt;
   char *read_str = "SELECT * FROM test ORDER BY key";
 
+  if (shards_ > 0) {
+    strcpy(message_, "skipping (not sharded)");
+    return;
+  }
+  if (backend_ != BACKEND_SQLITE) {
+    bench_kv_readseq();
+    return;
+  }
+
   /* Preparing sqlite3 statements */
   status = sqlite3_prepare_v2(db_, read_str, -1, &stmt, NULL);
   error_check(status);
+  uint64_t t = phase_start();
+  op_note(TRACE_SCAN, -1);
   for (int i = 0; i < reads_ && SQLITE_ROW == sqlite3_step(stmt); ++i) {
-    bytes_ += sqlite3_column_bytes(stmt, 1) + sqlite3_column_bytes(stmt, 2);
+    bytes_ += sqlite3_column_bytes(stmt, 0) + sqlite3_column_bytes(stmt, 1);
+    if (FLAGS_verify) verify_row(stmt, -1, &verify_);
+    t = phase_add(PHASE_STEP, t);
     finished_single_op();
+    t = phase_add(PHASE_BOOK, t);
   }
   status = sqlite3_finalize(stmt);
   error_check(status);
 }
+
+/*
+ * The Backend of one benchmark, on a new store if fresh.  btree wraps
+ * db_, which bench_kv_write has already reopened for a fresh store; the
+ * memory and lsm stores stay open between benchmarks.
+ */
+static Backend* kv_open(bool fresh) {
+  char file_name[100];
+  switch (backend_) {
+  case BACKEND_MEMORY:
+    if (fresh && memory_db_ != NULL) {
+      sqlite3_close(memory_db_);
+      memory_db_ = NULL;
+    }
+    if (memory_db_ == NULL) memory_db_ = open_db(":memory:", &busy_);
+    return backend_sql(memory_db_, "memory");
+  case BACKEND_LSM:
+    if (fresh && lsm_ != NULL) {
+      lsm_->close_(lsm_);
+      lsm_ = NULL;
+    }
+    if (lsm_ == NULL) {
+      snprintf(file_name, sizeof(file_name), "%s/dbbench_sqlite3-%d.lsm",
+               FLAGS_db, db_num_);
+      lsm_ = backend_lsm(file_name);
+    }
+    return lsm_;
+  default:
+    return backend_sql(db_, "btree");
+  }
+}
+
+static void kv_close(Backend* b) {
+  if (b != lsm_) b->close_(b);
+}
+
+/* bench_write on --backend: the same keys, values and batches */
+static void bench_kv_write(bool write_sync, int order, int state,
+                           int num_entries, int value_size,
+                           int entries_per_batch) {
+  if (state == FRESH) {
+    if (FLAGS_use_existing_db) {
+      strcpy(message_, "skipping (--use_existing_db is true)");
+      return;
+    }
+    sqlite3_close(db_);
+    db_ = NULL;
+    bench_open();
+  }
+  Backend* b = kv_open(state == FRESH);
+  if (state == FRESH) bench_start();
+
+  if (num_entries != num_) {
+    char msg[100];
+    snprintf(msg, sizeof(msg), "(%d ops)", num_entries);
+    strcpy(message_, msg);
+  }
+
+  b->sync_(b, write_sync);
+  bool transaction = FLAGS_transaction && entries_per_batch > 1;
+  for (int i = 0; i < num_entries; i += entries_per_batch) {
+    if (transaction) b->begin_(b);
+    for (int j = 0; j < entries_per_batch && i + j < num_entries; j++) {
+      uint64_t t = phase_start();
+      const char* value = rand_gen_generate(&gen_, value_size);
+      const int k = (order == SEQUENTIAL) ? i + j : (rand_next(&rand_) % num_entries);
+      char key[kMaxKeySize];
+      int key_size = encode_kv_key(k, key);
+      value = stamp_value(verify_scratch_, value, value_size, k);
+      t = phase_add(PHASE_GEN, t);
+
+      b->put_(b, key, key_size, value, value_size);
+      bytes_ += value_size + key_size;
+      t = phase_add(PHASE_STEP, t);
+      op_note(TRACE_WRITE, k);
+      finished_single_op();
+      phase_add(PHASE_BOOK, t);
+    }
+    if (transaction) b->commit_(b);
+  }
+  kv_close(b);
+}
+
+/* bench_read on --backend */
+static void bench_kv_read(int order) {
+  Backend* b = kv_open(false);
+  for (int i = 0; i < reads_; i++) {
+    uint64_t t = phase_start();
+    char key[kMaxKeySize];
+    int k = (order == SEQUENTIAL) ? i :
+            (order == HOT) ? (rand_next(&rand_) % ((num_ + 99) / 100)) :
+            (rand_next(&rand_) % reads_);
+    int key_size = encode_kv_key(k, key);
+    const void* value;
+    int size;
+    t = phase_add(PHASE_GEN, t);
+
+    if (b->get_(b, key, key_size, &value, &size) && FLAGS_verify)
+      verify_kv(key, key_size, value, size, k, &verify_);
+    t = phase_add(PHASE_STEP, t);
+    op_note(TRACE_READ, k);
+    finished_single_op();
+    phase_add(PHASE_BOOK, t);
+  }
+  kv_close(b);
+}
+
+static void kv_readseq_row(void* arg, const void* key, int nkey,
+                           const void* value, int size) {
+  (void)arg;
+  bytes_ += nkey + size;
+  if (FLAGS_verify) verify_kv(key, nkey, value, size, -1, &verify_);
+  finished_single_op();
+}
+
+/* bench_readseq on --backend: a scan from the first key */
+static void bench_kv_readseq(void) {
+  Backend* b = kv_open(false);
+  uint64_t t = phase_start();
+  op_note(TRACE_SCAN, -1);
+  b->scan_(b, NULL, 0, reads_, kv_readseq_row, NULL);
+  phase_add(PHASE_STEP, t);
+  kv_close(b);
+}
+
+
+/*
+ * Per-thread counterpart of done_, bytes_ and hist_ for benchmarks that run
+ * on several threads; folded into the globals before bench_stop().
+ */
+typedef struct ThreadState {
+  Thread thread_;
+  Random rand_;
+  RandomGenerator gen_;
+  int done_;
+  int64_t bytes_;
+  double last_op_finish_;
+  Histogram hist_;
+  BusyStats busy_;
+  VerifyStats verify_;
+  char* scratch_;               /* for stamp_value() */
+  int id_;
+  int op_type_;                 /* the op in progress, for --slow_op_ms */
+  int64_t op_key_;
+  int64_t checkpoints_;
+} ThreadState;
+
+static void thread_state_init(ThreadState* t, int id) {
+  rand_init(&t->rand_, 301 + id);
+  t->id_ = id;
+  t->op_type_ = 0;
+  t->op_key_ = -1;
+  slowlog_checkpointed(&t->checkpoints_);
+  rand_gen_init(&t->gen_, FLAGS_compression_ratio);
+  t->done_ = 0;
+  t->bytes_ = 0;
+  t->last_op_finish_ = now_seconds();
+  histogram_clear(&t->hist_);
+  memset(&t->busy_, 0, sizeof(t->busy_));
+  memset(&t->verify_, 0, sizeof(t->verify_));
+  t->scratch_ = FLAGS_verify ? (char*)malloc(t->gen_.data_size_) : NULL;
+}
+
+static inline void thread_op_note(ThreadState* t, int type, int64_t key) {
+  t->op_type_ = type;
+  t->op_key_ = key;
+}
+
+static void thread_finished_op(ThreadState* t) {
+  double verify = t->verify_.op_ticks_ > 0 ? verify_op_seconds(&t->verify_) : 0;
+  if (FLAGS_histogram || slow_usec_ > 0) {
+    double now = now_seconds();
+    double usec = (now - t->last_op_finish_ - verify) * 1e6;
+    if (FLAGS_histogram) histogram_add(&t->hist_, usec);
+    if (slow_usec_ > 0) {
+      bool checkpointed = slowlog_checkpointed(&t->checkpoints_);
+      if (usec > slow_usec_) {
+        /* Cache spills are only watched on db_ */
+        SlowOp op;
+        op.index_ = t->done_;
+        op.key_ = t->op_key_;
+        op.type_ = t->op_type_;
+        op.thread_ = t->id_;
+        op.time_ = now - start_;
+        op.usec_ = usec;
+        op.wal_frames_ = wal_frames_;
+        op.flags_ = checkpointed ? SLOW_CHECKPOINT : 0;
+        slowlog_add(&op);
+      }
+    }
+    t->last_op_finish_ = now;
+  }
+  t->done_++;
+  if (metrics_ && (t->done_ & 63) == 0) metrics_add_ops(64);
+}
+
+static void thread_state_merge(ThreadState* t) {
+  done_ += t->done_;
+  if (metrics_) metrics_add_ops(t->done_ & 63);
+  bytes_ += t->bytes_;
+  busy_.retries_ += t->busy_.retries_;
+  busy_.wait_ += t->busy_.wait_;
+  if (FLAGS_histogram) histogram_merge(&hist_, &t->hist_);
+  verify_.rows_ += t->verify_.rows_;
+  verify_.bad_ += t->verify_.bad_;
+  verify_.ticks_ += t->verify_.ticks_;
+  /* Threads check in parallel: the slowest one holds up the benchmark */
+  if (t->verify_.ticks_ > verify_wall_) verify_wall_ = t->verify_.ticks_;
+  rand_gen_free(&t->gen_);
+  free(t->scratch_);
+}
+
+/* Work and connections of one --shards thread */
+typedef struct ShardThread {
+  ThreadState t_;
+  bool write_sync_;
+  int order_;
+  int num_entries_;
+  int value_size_;
+  int entries_per_batch_;
+  int ops_;
+  bool owned_[kMaxShards];
+  int nconn_;
+  sqlite3* conn_[kMaxShards];
+  sqlite3_stmt* stmt_[kMaxShards];
+} ShardThread;
+
+static int shard_of(int k) {
+  return (int)((((uint32_t)k * 2654435761u) >> 8) % (uint32_t)shards_);
+}
+
+/*
+ * Open the thread's shards (all of them when reading).  In files mode each
+ * shard gets its own connection, in attach mode one connection ATTACHes
+ * them all and statements name the shard's schema.
+ */
+static void shard_connect(ShardThread* st, bool write, bool all) {
+  bool attach = !strcmp(FLAGS_shard_mode, "attach");
+  char file_name[100];
+  char sql[200];
+
+  st->nconn_ = 0;
+  for (int s = 0; s < shards_; s++) {
+    st->stmt_[s] = NULL;
+    if (!all && !st->owned_[s]) continue;
+
+    const char* schema = "main";
+    char schema_buf[16];
+    sqlite3* db;
+    db_file_name(file_name, sizeof(file_name), shard_db_num_, s);
+    if (!attach || st->nconn_ == 0) {
+      db = open_db(file_name, &st->t_.busy_);
+      st->conn_[st->nconn_++] = db;
+    } else {
+      db = st->conn_[0];
+      snprintf(schema_buf, sizeof(schema_buf), "s%d", s);
+      schema = schema_buf;
+      char* attach_sql = sqlite3_mprintf("ATTACH DATABASE %Q AS %s",
+                                         file_name, schema);
+      exec_sql(db, attach_sql);
+      sqlite3_free(attach_sql);
+      snprintf(sql, sizeof(sql), "PRAGMA %s.cache_size = %d",
+               schema, FLAGS_num_pages);
+      exec_sql(db, sql);
+    }
+
+    if (write) {
+      snprintf(sql, sizeof(sql), "PRAGMA %s.synchronous = %s",
+               schema, st->write_sync_ ? "FULL" : "OFF");
+      exec_sql(db, sql);
+      snprintf(sql, sizeof(sql),
+               "REPLACE INTO %s.test (key, value) VALUES (?, ?)", schema);
+    } else {
+      snprintf(sql, sizeof(sql), "SELECT * FROM %s.test WHERE key = ?",
+               schema);
+    }
+    error_check(sqlite3_prepare_v2(db, sql, -1, &st->stmt_[s], NULL));
+  }
+}
+
+static void shard_disconnect(ShardThread* st) {
+  for (int s = 0; s < shards_; s++) {
+    if (st->stmt_[s] != NULL) error_check(sqlite3_finalize(st->stmt_[s]));
+  }
+  for (int i = 0; i < st->nconn_; i++) {
+    error_check(sqlite3_close(st->conn_[i]));
+  }
+}
+
+static void shard_writer(void* arg) {
+  ShardThread* st = (ShardThread*)arg;
+  ThreadState* t = &st->t_;
+  bool transaction = FLAGS_transaction && st->entries_per_batch_ > 1;
+  int next_key = 0;
+  int status;
+
+  t->last_op_finish_ = now_seconds();
+  for (int i = 0; i < st->ops_; i += st->entries_per_batch_) {
+    if (transaction) {
+      for (int c = 0; c < st->nconn_; c++) exec_sql(st->conn_[c], "BEGIN");
+    }
+    for (int j = 0; j < st->entries_per_batch_ && i + j < st->ops_; j++) {
+      const char* value = rand_gen_generate(&t->gen_, st->value_size_);
+
+      /* Only keys that hash to this thread's shards */
+      int k;
+      do {
+        k = (st->order_ == SEQUENTIAL) ? next_key++ :
+            (int)(rand_next(&t->rand_) % st->num_entries_);
+      } while (!st->owned_[shard_of(k)]);
+      char key[kMaxKeySize];
+      sqlite3_stmt* stmt = st->stmt_[shard_of(k)];
+      int key_size = bind_key(stmt, 1, k, key);
+      value = stamp_value(t->scratch_, value, st->value_size_, k);
+      status = sqlite3_bind_blob(stmt, 2, value, st->value_size_, SQLITE_STATIC);
+      error_check(status);
+      t->bytes_ += st->value_size_ + key_size;
+      status = sqlite3_step(stmt);
+      step_error_check(status);
+      status = sqlite3_reset(stmt);
+      error_check(status);
+      thread_op_note(t, TRACE_WRITE, k);
+      thread_finished_op(t);
+    }
+    if (transaction) {
+      for (int c = 0; c < st->nconn_; c++) exec_sql(st->conn_[c], "COMMIT");
+    }
+  }
+}
+
+static void shard_reader(void* arg) {
+  ShardThread* st = (ShardThread*)arg;
+  ThreadState* t = &st->t_;
+  int status;
+
+  t->last_op_finish_ = now_seconds();
+  for (int i = 0; i < st->ops_; i++) {
+    int k = (st->order_ == HOT) ?
+            (int)(rand_next(&t->rand_) % ((num_ + 99) / 100)) :
+            (int)(rand_next(&t->rand_) % reads_);
+    char key[kMaxKeySize];
+    sqlite3_stmt* stmt = st->stmt_[shard_of(k)];
+    bind_key(stmt, 1, k, key);
+    while ((status = sqlite3_step(stmt)) == SQLITE_ROW) {
+      if (FLAGS_verify) verify_row(stmt, k, &t->verify_);
+    }
+    step_error_check(status);
+    status = sqlite3_reset(stmt);
+    error_check(status);
+    thread_op_note(t, TRACE_READ, k);
+    thread_finished_op(t);
+  }
+}
+
+/* Start the threads on fn, wait for them and fold in their counters */
+static void shard_run(ShardThread* st, int nthreads, ThreadFunc fn) {
+  bench_start();
+  for (int i = 0; i < nthreads; i++) {
+    thread_create(&st[i].t_.thread_, fn, &st[i]);
+  }
+  for (int i = 0; i < nthreads; i++) {
+    thread_join(st[i].t_.thread_);
+    thread_state_merge(&st[i].t_);
+    shard_disconnect(&st[i]);
+  }
+}
+
+static void shard_message(int nthreads) {
+  char msg[100];
+  snprintf(msg, sizeof(msg), "%.0f ops/s (%d shards, %d threads)",
+           done_ / (now_seconds() - start_), shards_, nthreads);
+  append_message(msg);
+}
+
+/*
+ * Sharded counterpart of bench_write().  Shards are dealt out round-robin
+ * and every shard has a single writer, so there are at most shards_
+ * writer threads.
+ */
+static void bench_shard_write(bool write_sync, int order, int state,
+                              int num_entries, int value_size,
+                              int entries_per_batch) {
+  char file_name[100];
+
+  if (state == FRESH || shard_db_num_ == 0) {
+    if (FLAGS_use_existing_db) {
+      strcpy(message_, "skipping (--use_existing_db is true)");
+      return;
+    }
+    shard_db_num_ = ++db_num_;
+    for (int s = 0; s < shards_; s++) {
+      db_file_name(file_name, sizeof(file_name), shard_db_num_, s);
+      error_check(sqlite3_close(open_db(file_name, &busy_)));
+    }
+  }
+
+  int nthreads = (threads_ > 0 && threads_ < shards_) ? threads_ : shards_;
+  ShardThread* st = (ShardThread*)calloc(nthreads, sizeof(ShardThread));
+  for (int i = 0; i < nthreads; i++) {
+    thread_state_init(&st[i].t_, i);
+    st[i].write_sync_ = write_sync;
+    st[i].order_ = order;
+    st[i].num_entries_ = num_entries;
+    st[i].value_size_ = value_size;
+    st[i].entries_per_batch_ = entries_per_batch;
+    for (int s = 0; s < shards_; s++) {
+      st[i].owned_[s] = (s % nthreads == i);
+    }
+    for (int k = 0; k < num_entries; k++) {
+      if (st[i].owned_[shard_of(k)]) st[i].ops_++;
+    }
+    shard_connect(&st[i], true, false);
+  }
+
+  shard_run(st, nthreads, shard_writer);
+  free(st);
+
+  if (num_entries != num_) {
+    char msg[100];
+    snprintf(msg, sizeof(msg), "(%d ops)", num_entries);
+    strcpy(message_, msg);
+  }
+  shard_message(nthreads);
+}
+
+/* Sharded counterpart of bench_read(): every thread reads from all shards */
+static void bench_shard_read(int order) {
+  if (shard_db_num_ == 0) {
+    strcpy(message_, "skipping (no shards written)");
+    return;
+  }
+
+  int nthreads = threads_ > 0 ? threads_ : shards_;
+  ShardThread* st = (ShardThread*)calloc(nthreads, sizeof(ShardThread));
+  for (int i = 0; i < nthreads; i++) {
+    thread_state_init(&st[i].t_, i);
+    st[i].order_ = order;
+    st[i].ops_ = reads_ / nthreads + (i == 0 ? reads_ % nthreads : 0);
+    shard_connect(&st[i], false, true);
+  }
+
+  shard_run(st, nthreads, shard_reader);
+  free(st);
+  shard_message(nthreads);
+}
+
+/* Work of one replay thread: the trace records whose key hashes to index_ */
+typedef struct ReplayThread {
+  ThreadState t_;
+  const Trace* trace_;
+  int index_;
+  int nthreads_;
+  sqlite3* db_;
+  sqlite3_stmt* stmt_[TRACE_SCAN + 1];
+  double max_lag_;
+} ReplayThread;
+
+/* Sleep until now_seconds() reaches t, spinning out the last 2 ms */
+static void wait_until(double t) {
+  double now;
+  while ((now = now_seconds()) < t) {
+    if (t - now > 0.002) sqlite3_sleep((int)((t - now) * 1000) - 1);
+  }
+}
+
+static void replay_worker(void* arg) {
+  ReplayThread* rt = (ReplayThread*)arg;
+  ThreadState* t = &rt->t_;
+  const TraceRecord* rec = rt->trace_->records_;
+  const uint64_t count = rt->trace_->count_;
+  const int max_value = (int)t->gen_.data_size_ - 1;
+  double start = now_seconds();
+  double at = 0;
+  int status;
+
+  for (uint64_t i = 0; i < count; i++) {
+    const TraceRecord* r = &rec[i];
+    at += r->delta_us_ * 1e-6;
+
+    /* Keep each key on one thread so its operations stay in order */
+    if (rt->nthreads_ > 1 &&
+        (int)(((r->key_ * 0x9e3779b97f4a7c15ull) >> 32) % rt->nthreads_) !=
+        rt->index_)
+      continue;
+
+    if (FLAGS_replay_speed > 0) {
+      double due = start + at / FLAGS_replay_speed;
+      double lag = now_seconds() - due;
+      if (lag > rt->max_lag_) rt->max_lag_ = lag;
+      wait_until(due);
+    }
+
+    int op = (int)(r->op_size_ >> 24);
+    int size = (int)(r->op_size_ & kTraceSizeMask);
+    char key[kMaxKeySize];
+    if (op < TRACE_READ || op > TRACE_SCAN) continue;
+
+    /* Keys beyond 16 decimal digits (hashed ones) are folded into range */
+    sqlite3_stmt* stmt = rt->stmt_[op];
+    t->last_op_finish_ = now_seconds();
+    int64_t k = (int64_t)(r->key_ % 10000000000000000ull);
+    int key_size = bind_key(stmt, 1, k, key);
+    if (op == TRACE_WRITE) {
+      if (size > max_value) size = max_value;
+      const char* value = stamp_value(t->scratch_,
+                                      rand_gen_generate(&t->gen_, size), size, k);
+      status = sqlite3_bind_blob(stmt, 2, value, size, SQLITE_STATIC);
+      error_check(status);
+      t->bytes_ += size + key_size;
+    } else if (op == TRACE_SCAN) {
+      status = sqlite3_bind_int(stmt, 2, size > 0 ? size : -1);
+      error_check(status);
+    }
+    while ((status = sqlite3_step(stmt)) == SQLITE_ROW) {
+      if (op == TRACE_SCAN)
+        t->bytes_ += sqlite3_column_bytes(stmt, 0) +
+                     sqlite3_column_bytes(stmt, 1);
+    }
+    step_error_check(status);
+    status = sqlite3_reset(stmt);
+    error_check(status);
+    thread_op_note(t, op, k);
+    thread_finished_op(t);
+  }
+}
+
+/*
+ * Run the operations of --trace against the current database, as fast as
+ * possible or paced at --replay_speed times the recorded arrival rate.
+ * Latencies are measured from the start of each operation.
+ */
+static void bench_replay(void) {
+  static const char* const sql[TRACE_SCAN + 1] = {
+    NULL,
+    "SELECT * FROM test WHERE key = ?",
+    "REPLACE INTO test (key, value) VALUES (?, ?)",
+    "DELETE FROM test WHERE key = ?",
+    "SELECT key, value FROM test WHERE key >= ? ORDER BY key LIMIT ?"
+  };
+  Trace trace;
+  char file_name[100];
+
+  if (FLAGS_trace == NULL) {
+    strcpy(message_, "skipping (no --trace)");
+    return;
+  }
+  if (shards_ > 0) {
+    strcpy(message_, "skipping (not sharded)");
+    return;
+  }
+  if (!trace_map(&trace, FLAGS_trace)) {
+    fprintf(stderr, "cannot read trace '%s'\n", FLAGS_trace);
+    exit(1);
+  }
+
+  /* One thread replays on db_, more open their own connections, which
+   * cannot share the file with db_ in exclusive locking mode */
+  int nthreads = FLAGS_replay_threads;
+  if (nthreads > 1) {
+    sqlite3_close(db_);
+    db_ = NULL;
+    own_connections_ = true;
+  }
+  ReplayThread* rt = (ReplayThread*)calloc(nthreads, sizeof(ReplayThread));
+  db_file_name(file_name, sizeof(file_name), db_num_, -1);
+  for (int i = 0; i < nthreads; i++) {
+    thread_state_init(&rt[i].t_, i);
+    rt[i].trace_ = &trace;
+    rt[i].index_ = i;
+    rt[i].nthreads_ = nthreads;
+    rt[i].db_ = nthreads == 1 ? db_ : open_db(file_name, &rt[i].t_.busy_);
+    exec_sql(rt[i].db_, "PRAGMA synchronous = OFF");
+    for (int op = TRACE_READ; op <= TRACE_SCAN; op++) {
+      error_check(sqlite3_prepare_v2(rt[i].db_, sql[op], -1, &rt[i].stmt_[op],
+                                     NULL));
+    }
+  }
+
+  bench_start();
+  for (int i = 0; i < nthreads; i++) {
+    thread_create(&rt[i].t_.thread_, replay_worker, &rt[i]);
+  }
+  double max_lag = 0;
+  for (int i = 0; i < nthreads; i++) {
+    thread_join(rt[i].t_.thread_);
+    thread_state_merge(&rt[i].t_);
+    if (rt[i].max_lag_ > max_lag) max_lag = rt[i].max_lag_;
+    for (int op = TRACE_READ; op <= TRACE_SCAN; op++) {
+      error_check(sqlite3_finalize(rt[i].stmt_[op]));
+    }
+    if (rt[i].db_ != db_) error_check(sqlite3_close(rt[i].db_));
+  }
+
+  char msg[200];
+  if (FLAGS_replay_speed > 0)
+    snprintf(msg, sizeof(msg),
+             "%llu records, %.0f ops/s (%d threads, %.2fx pacing, max lag %.1f ms)",
+             (unsigned long long)trace.count_, done_ / (now_seconds() - start_),
+             nthreads, FLAGS_replay_speed, max_lag * 1e3);
+  else
+    snprintf(msg, sizeof(msg), "%llu records, %.0f ops/s (%d threads)",
+             (unsigned long long)trace.count_, done_ / (now_seconds() - start_),
+             nthreads);
+  append_message(msg);
+  free(rt);
+  trace_unmap(&trace);
+
+  if (nthreads > 1) {
+    own_connections_ = false;
+    bench_connect();
+  }
+}
+
+/* Work of one thread of a --workload phase */
+typedef struct WorkThread {
+  ThreadState t_;
+  const WorkloadPhase* phase_;
+  int index_;
+  sqlite3* db_;
+  sqlite3_stmt* stmt_[kWorkOps];
+  Backend* kv_;                 /* --backend, instead of the statements */
+  int64_t ops_;                 /* ops to run, or -1 to run until deadline_ */
+  double deadline_;
+  double interval_;             /* seconds between ops at the target rate */
+  Histogram latency_;
+  int64_t count_[kWorkOps];
+  double max_lag_;
+} WorkThread;
+
+/* Op op on key k through the phase's statements */
+static void work_sql_op(WorkThread* w, int op, int64_t k) {
+  ThreadState* t = &w->t_;
+  sqlite3_stmt* stmt = w->stmt_[op];
+  char key[kMaxKeySize];
+  int key_size = bind_key(stmt, 1, k, key);
+  int status;
+  if (op == WORK_WRITE) {
+    int size = workload_value_size(w->phase_, &t->rand_);
+    if (size > (int)t->gen_.data_size_ - 1) size = (int)t->gen_.data_size_ - 1;
+    const char* value = stamp_value(t->scratch_,
+                                    rand_gen_generate(&t->gen_, size), size, k);
+    status = sqlite3_bind_blob(stmt, 2, value, size, SQLITE_STATIC);
+    error_check(status);
+    t->bytes_ += size + key_size;
+  } else if (op == WORK_SCAN) {
+    status = sqlite3_bind_int(stmt, 2, w->phase_->scan_);
+    error_check(status);
+  }
+  while ((status = sqlite3_step(stmt)) == SQLITE_ROW) {
+    if (op == WORK_SCAN)
+      t->bytes_ += sqlite3_column_bytes(stmt, 0) +
+                   sqlite3_column_bytes(stmt, 1);
+    if (FLAGS_verify) verify_row(stmt, op == WORK_READ ? k : -1, &t->verify_);
+  }
+  step_error_check(status);
+  status = sqlite3_reset(stmt);
+  error_check(status);
+}
+
+static void work_scan_row(void* arg, const void* key, int nkey,
+                          const void* value, int size) {
+  ThreadState* t = (ThreadState*)arg;
+  t->bytes_ += nkey + size;
+  if (FLAGS_verify) verify_kv(key, nkey, value, size, -1, &t->verify_);
+}
+
+/* Op op on key k through the --backend */
+static void work_kv_op(WorkThread* w, int op, int64_t k) {
+  ThreadState* t = &w->t_;
+  Backend* b = w->kv_;
+  char key[kMaxKeySize];
+  int key_size = encode_kv_key(k, key);
+  const void* found;
+  int size;
+  switch (op) {
+  case WORK_READ:
+    if (b->get_(b, key, key_size, &found, &size) && FLAGS_verify)
+      verify_kv(key, key_size, found, size, k, &t->verify_);
+    break;
+  case WORK_WRITE:
+    size = workload_value_size(w->phase_, &t->rand_);
+    if (size > (int)t->gen_.data_size_ - 1) size = (int)t->gen_.data_size_ - 1;
+    b->put_(b, key, key_size, stamp_value(t->scratch_,
+            rand_gen_generate(&t->gen_, size), size, k), size);
+    t->bytes_ += size + key_size;
+    break;
+  case WORK_SCAN:
+    b->scan_(b, key, key_size, w->phase_->scan_, work_scan_row, t);
+    break;
+  case WORK_DELETE:
+    b->delete_(b, key, key_size);
+    break;
+  }
+}
+
+static void work_commit(WorkThread* w) {
+  if (w->kv_ != NULL)
+    w->kv_->commit_(w->kv_);
+  else
+    exec_sql(w->db_, "COMMIT");
+}
+
+/* The TRACE_* op of each WorkloadOp, for --slow_op_ms */
+static const int work_trace_op[kWorkOps] = {
+  TRACE_READ, TRACE_WRITE, TRACE_SCAN, TRACE_DELETE
+};
+
+/*
+ * Run a phase's ops on one thread.  Under a target rate an op's latency
+ * is counted from when it was due, not when it started, so a stall also
+ * counts against the ops that queued up behind it.
+ */
+static void work_worker(void* arg) {
+  WorkThread* w = (WorkThread*)arg;
+  ThreadState* t = &w->t_;
+  const WorkloadPhase* p = w->phase_;
+  const bool batched = p->batch_ > 1;
+  const char* begin_sql = p->threads_ > 1 && (p->mix_[WORK_WRITE] > 0 ||
+                          p->mix_[WORK_DELETE] > 0) ? "BEGIN IMMEDIATE" : "BEGIN";
+  int64_t next = p->keyspace_ / p->threads_ * w->index_;
+  double start = now_seconds();
+  int in_batch = 0;
+
+  t->last_op_finish_ = start;
+  for (int64_t i = 0; w->ops_ < 0 || i < w->ops_; i++) {
+    double begin;
+    if (w->interval_ > 0) {
+      begin = start + i * w->interval_;
+      double lag = now_seconds() - begin;
+      if (lag > w->max_lag_) w->max_lag_ = lag;
+      wait_until(begin);
+      if (w->ops_ < 0 && begin >= w->deadline_) break;
+    } else {
+      begin = now_seconds();
+      if (w->ops_ < 0 && begin >= w->deadline_) break;
+    }
+
+    if (batched && in_batch == 0) {
+      if (w->kv_ != NULL)
+        w->kv_->begin_(w->kv_);
+      else
+        exec_sql(w->db_, begin_sql);
+    }
+    int op = workload_op(p, &t->rand_);
+    int64_t k = workload_key(p, &t->rand_, &next);
+    if (w->kv_ != NULL)
+      work_kv_op(w, op, k);
+    else
+      work_sql_op(w, op, k);
+    if (batched && ++in_batch == p->batch_) {
+      work_commit(w);
+      in_batch = 0;
+    }
+
+    histogram_add(&w->latency_, (now_seconds() - begin) * 1e6);
+    w->count_[op]++;
+    thread_op_note(t, work_trace_op[op], k);
+    thread_finished_op(t);
+  }
+  if (in_batch > 0) work_commit(w);
+}
+
+/*
+ * Run the phases of --workload in order, each reported as a benchmark of
+ * its own name.  A phase of one thread runs on db_, or on the --backend;
+ * with more, db_ is closed and every thread opens its own connection.
+ */
+static void bench_workload(void) {
+  static const char* const sql[kWorkOps] = {
+    "SELECT * FROM test WHERE key = ?",
+    "REPLACE INTO test (key, value) VALUES (?, ?)",
+    "SELECT key, value FROM test WHERE key >= ? ORDER BY key LIMIT ?",
+    "DELETE FROM test WHERE key = ?"
+  };
+  Workload wl;
+  char file_name[100];
+
+  if (FLAGS_workload == NULL || shards_ > 0 || FLAGS_processes > 1) {
+    bench_start();
+    strcpy(message_, FLAGS_workload == NULL ? "skipping (no --workload)" :
+                     "skipping (not sharded)");
+    bench_stop("workload");
+    return;
+  }
+  workload_load(&wl, FLAGS_workload, num_, FLAGS_value_size);
+  db_file_name(file_name, sizeof(file_name), db_num_, -1);
+  /* A one-thread phase sets its synchronous on db_ itself */
+  int64_t synchronous = query_int(db_, "PRAGMA synchronous");
+
+  for (int ph = 0; ph < wl.count_; ph++) {
+    const WorkloadPhase* p = &wl.phases_[ph];
+    int nthreads = p->threads_;
+    if (nthreads > 1 && threading_ == SQLITE_CONFIG_SINGLETHREAD) {
+      fprintf(stderr, "workload: phase %s needs --threading other than "
+              "single\n", p->name_);
+      exit(1);
+    }
+    if (nthreads > 1 && backend_ != BACKEND_SQLITE) {
+      fprintf(stderr, "workload: phase %s: --backend=%s runs one thread\n",
+              p->name_, backend_name[backend_]);
+      exit(1);
+    }
+    if (nthreads > 1) {
+      sqlite3_close(db_);
+      db_ = NULL;
+      own_connections_ = true;
+    }
+
+    WorkThread* wt = (WorkThread*)calloc(nthreads, sizeof(WorkThread));
+    for (int i = 0; i < nthreads; i++) {
+      WorkThread* w = &wt[i];
+      thread_state_init(&w->t_, ph * 1024 + i);
+      w->t_.id_ = i;            /* the seed differs per phase, not the id */
+      w->phase_ = p;
+      w->index_ = i;
+      w->db_ = nthreads == 1 ? db_ : open_db(file_name, &w->t_.busy_);
+      exec_sql(w->db_, p->sync_ ? "PRAGMA synchronous = FULL" :
+                                  "PRAGMA synchronous = OFF");
+      for (int op = 0; op < kWorkOps; op++) {
+        error_check(sqlite3_prepare_v2(w->db_, sql[op], -1, &w->stmt_[op],
+                                       NULL));
+      }
+      w->ops_ = p->ops_ > 0 ? p->ops_ / nthreads +
+                              (i == 0 ? p->ops_ % nthreads : 0) : -1;
+      w->interval_ = p->rate_ > 0 ? nthreads / p->rate_ : 0;
+      histogram_clear(&w->latency_);
+      if (backend_ != BACKEND_SQLITE) {
+        w->kv_ = kv_open(false);
+        w->kv_->sync_(w->kv_, p->sync_);
+      }
+    }
+
+    Histogram latency;
+    int64_t count[kWorkOps];
+    snprintf(bench_name_, sizeof(bench_name_), "%s", p->name_);
+    double max_lag = 0;
+    histogram_clear(&latency);
+    memset(count, 0, sizeof(count));
+    bench_start();
+    for (int i = 0; i < nthreads; i++) {
+      wt[i].deadline_ = start_ + p->duration_;
+      thread_create(&wt[i].t_.thread_, work_worker, &wt[i]);
+    }
+    for (int i = 0; i < nthreads; i++) {
+      WorkThread* w = &wt[i];
+      thread_join(w->t_.thread_);
+      thread_state_merge(&w->t_);
+      histogram_merge(&latency, &w->latency_);
+      for (int op = 0; op < kWorkOps; op++) count[op] += w->count_[op];
+      if (w->max_lag_ > max_lag) max_lag = w->max_lag_;
+      for (int op = 0; op < kWorkOps; op++)
+        error_check(sqlite3_finalize(w->stmt_[op]));
+      if (w->kv_ != NULL) kv_close(w->kv_);
+      if (w->db_ != db_) error_check(sqlite3_close(w->db_));
+    }
+    free(wt);
+
+    char msg[200];
+    snprintf(msg, sizeof(msg), "%.0f ops/s (%d threads) r/w/s/d "
+             "%lld/%lld/%lld/%lld p50 %.1f p99 %.1f usec",
+             done_ / (now_seconds() - start_), nthreads,
+             (long long)count[WORK_READ], (long long)count[WORK_WRITE],
+             (long long)count[WORK_SCAN], (long long)count[WORK_DELETE],
+             histogram_percentile(&latency, 50),
+             histogram_percentile(&latency, 99));
+    append_message(msg);
+    if (p->rate_ > 0) {
+      snprintf(msg, sizeof(msg), "target %.0f ops/s max lag %.1f ms",
+               p->rate_, max_lag * 1e3);
+      append_message(msg);
+    }
+    bench_stop(p->name_);
+
+    if (nthreads > 1) {
+      own_connections_ = false;
+      bench_connect();
+    }
+  }
+  char restore[50];
+  snprintf(restore, sizeof(restore), "PRAGMA synchronous = %d",
+           (int)synchronous);
+  exec_sql(db_, restore);
+  workload_free(&wl);
+}
+
+/* groupcommit: producers queue writes for a single writer on db_ */
+#define kRingSize 4096
+
+typedef struct Producer {
+  ThreadState t_;
+  Ring* ring_;
+  int ops_;
+  int num_entries_;
+  int value_size_;
+  int64_t full_;          /* pushes retried on a full ring */
+} Producer;
+
+static void producer_main(void* arg) {
+  Producer* p = (Producer*)arg;
+  ThreadState* t = &p->t_;
+  RingItem item;
+
+  for (int i = 0; i < p->ops_; i++) {
+    item.key_ = (int)(rand_next(&t->rand_) % p->num_entries_);
+    item.value_ = rand_gen_generate(&t->gen_, p->value_size_);
+    item.size_ = p->value_size_;
+    /* Latency counts from the request, including waits on a full ring */
+    item.enqueued_ = now_seconds();
+    while (!ring_push(p->ring_, &item)) {
+      p->full_++;
+      sqlite3_sleep(0);
+    }
+  }
+}
+
+/*
+ * Group commit: --producers threads put writes in random key order on a
+ * lock-free ring and this thread commits them.  Each transaction takes
+ * whatever is queued when it begins, so batches grow with the backlog.
+ * Latency is from enqueue until the COMMIT holding the write returns;
+ * with synchronous=NORMAL in WAL mode that is not yet on disk.
+ */
+static void bench_groupcommit(bool write_sync, int num_entries,
+                              int value_size) {
+  if (shards_ > 0) {
+    strcpy(message_, "skipping (not sharded)");
+    return;
+  }
+  if (FLAGS_use_existing_db) {
+    strcpy(message_, "skipping (--use_existing_db is true)");
+    return;
+  }
+  sqlite3_close(db_);
+  db_ = NULL;
+  bench_open();
+
+  sqlite3_stmt *replace_stmt, *begin_stmt, *commit_stmt;
+  exec_sql(db_, write_sync ? "PRAGMA synchronous = FULL" :
+                               "PRAGMA synchronous = NORMAL");
+  error_check(sqlite3_prepare_v2(db_,
+      "REPLACE INTO test (key, value) VALUES (?, ?)", -1, &replace_stmt, NULL));
+  error_check(sqlite3_prepare_v2(db_, "BEGIN", -1, &begin_stmt, NULL));
+  error_check(sqlite3_prepare_v2(db_, "COMMIT", -1, &commit_stmt, NULL));
+
+  Ring* ring = ring_new(kRingSize);
+  const int nproducers = FLAGS_producers;
+  Producer* pr = (Producer*)calloc(nproducers, sizeof(Producer));
+  for (int i = 0; i < nproducers; i++) {
+    thread_state_init(&pr[i].t_, i);
+    pr[i].ring_ = ring;
+    pr[i].ops_ = num_entries / nproducers +
+                 (i == 0 ? num_entries % nproducers : 0);
+    pr[i].num_entries_ = num_entries;
+    pr[i].value_size_ = value_size;
+  }
+  double* enqueued = (double*)malloc(sizeof(double) * kRingSize);
+  Histogram latency;
+  histogram_clear(&latency);
+  int64_t commits = 0;
+  int max_batch = 0;
+  int status;
+
+  bench_start();
+  for (int i = 0; i < nproducers; i++) {
+    thread_create(&pr[i].t_.thread_, producer_main, &pr[i]);
+  }
+  for (int remaining = num_entries; remaining > 0; ) {
+    int batch = ring_depth(ring);
+    if (batch == 0) {
+      sqlite3_sleep(0);
+      continue;
+    }
+    if (batch > kRingSize) batch = kRingSize;
+
+    step_error_check(sqlite3_step(begin_stmt));
+    error_check(sqlite3_reset(begin_stmt));
+    for (int n = 0; n < batch; n++) {
+      RingItem item;
+      char key[kMaxKeySize];
+      /* Claimed by a producer but possibly not yet published */
+      while (!ring_pop(ring, &item)) sqlite3_sleep(0);
+      enqueued[n] = item.enqueued_;
+      int key_size = bind_key(replace_stmt, 1, item.key_, key);
+      status = sqlite3_bind_blob(replace_stmt, 2,
+                                 stamp_value(verify_scratch_, item.value_,
+                                             item.size_, item.key_),
+                                 item.size_, SQLITE_STATIC);
+      error_check(status);
+      step_error_check(sqlite3_step(replace_stmt));
+      error_check(sqlite3_reset(replace_stmt));
+      bytes_ += item.size_ + key_size;
+    }
+    step_error_check(sqlite3_step(commit_stmt));
+    error_check(sqlite3_reset(commit_stmt));
+
+    double now = now_seconds();
+    for (int n = 0; n < batch; n++) {
+      histogram_add(&latency, (now - enqueued[n]) * 1e6);
+    }
+    done_ += batch;
+    if (metrics_) {
+      metrics_ops_ += batch;
+      if (now >= metrics_next_) metrics_update(now);
+    }
+    remaining -= batch;
+    commits++;
+    if (batch > max_batch) max_batch = batch;
+  }
+
+  int64_t full = 0;
+  for (int i = 0; i < nproducers; i++) {
+    thread_join(pr[i].t_.thread_);
+    thread_state_merge(&pr[i].t_);
+    full += pr[i].full_;
+  }
+  if (FLAGS_histogram) histogram_merge(&hist_, &latency);
+
+  char msg[200];
+  snprintf(msg, sizeof(msg),
+           "%.0f ops/s (%d producers) %.1f writes/commit (max %d) "
+           "latency p50 %.0f p99 %.0f max %.0f usec, ring full %lld",
+           done_ / (now_seconds() - start_), nproducers,
+           commits > 0 ? (double)done_ / commits : 0.0, max_batch,
+           histogram_percentile(&latency, 50), histogram_percentile(&latency, 99),
+           latency.max_, (long long)full);
+  append_message(msg);
+
+  free(enqueued);
+  free(pr);
+  ring_free(ring);
+  error_check(sqlite3_finalize(replace_stmt));
+  error_check(sqlite3_finalize(begin_stmt));
+  error_check(sqlite3_finalize(commit_stmt));
+}
+
+/*
+ * Seconds per op of n point reads of db_, or of n overwrites committed
+ * 1000 at a time: short statements where the per-call mutex work shows.
+ */
+static double matrix_ops(bool write, int n) {
+  sqlite3_stmt* stmt;
+  char key[kMaxKeySize];
+  int status;
+
+  status = sqlite3_prepare_v2(db_, write ?
+                              "REPLACE INTO test (key, value) VALUES (?, ?)" :
+                              "SELECT * FROM test WHERE key = ?",
+                              -1, &stmt, NULL);
+  error_check(status);
+  double start = now_seconds();
+  for (int i = 0; i < n; i++) {
+    if (write && i % 1000 == 0) {
+      if (i > 0) exec_sql(db_, "COMMIT");
+      exec_sql(db_, "BEGIN");
+    }
+    int k = rand_next(&rand_) % num_;
+    int key_size = bind_key(stmt, 1, k, key);
+    if (write) {
+      const char* value = stamp_value(verify_scratch_,
+                                      rand_gen_generate(&gen_, FLAGS_value_size),
+                                      FLAGS_value_size, k);
+      status = sqlite3_bind_blob(stmt, 2, value, FLAGS_value_size,
+                                 SQLITE_STATIC);
+      error_check(status);
+      bytes_ += FLAGS_value_size + key_size;
+    }
+    while ((status = sqlite3_step(stmt)) == SQLITE_ROW) {}
+    step_error_check(status);
+    error_check(sqlite3_reset(stmt));
+    finished_single_op();
+  }
+  if (write && n > 0) exec_sql(db_, "COMMIT");
+  double seconds = now_seconds() - start;
+  error_check(sqlite3_finalize(stmt));
+  return seconds / (n > 0 ? n : 1);
+}
+
+typedef struct MutexMode {
+  const char* name_;
+  int threading_;
+  int open_flags_;
+} MutexMode;
+
+/*
+ * mutexmatrix: single-threaded reads and writes of database db_num_ under
+ * each threading mode, with and without memory statistics.
+ * "serialized+nomutex" is a connection opened with SQLITE_OPEN_NOMUTEX
+ * in a serialized library, as a connection-per-thread design would.
+ * SQLite picks its mutex methods at the first sqlite3_initialize() and
+ * keeps them through shutdowns, so the rows only differ in which mutexes
+ * get allocated; a library first started single-threaded keeps no-op
+ * methods, and every row would measure the same thing.
+ */
+static void bench_mutex_matrix(void) {
+  static const MutexMode modes[] = {
+    { "single", SQLITE_CONFIG_SINGLETHREAD, 0 },
+    { "multi", SQLITE_CONFIG_MULTITHREAD, 0 },
+    { "serialized+nomutex", SQLITE_CONFIG_SERIALIZED, SQLITE_OPEN_NOMUTEX },
+    { "serialized", SQLITE_CONFIG_SERIALIZED, SQLITE_OPEN_FULLMUTEX },
+  };
+  const int nmodes = sizeof(modes) / sizeof(modes[0]);
+  int saved_flags = open_flags_;
+  double base = 0;
+
+  if (shared_db()) {
+    strcpy(message_, "skipping (needs the only connection)");
+    return;
+  }
+  if (threading_ == SQLITE_CONFIG_SINGLETHREAD) {
+    strcpy(message_, "skipping (no-op mutexes under --threading=single)");
+    return;
+  }
+
+  fprintf(stdout, "  %-18s %9s %12s %12s %10s\n", "mode", "memstatus",
+          "read usec", "write usec", "vs single");
+  for (int m = 0; m < nmodes; m++) {
+    for (int memstatus = 1; memstatus >= 0; memstatus--) {
+      sqlite3_close(db_);
+      db_ = NULL;
+      error_check(sqlite3_shutdown());
+      if (!sqlite_configure(modes[m].threading_, memstatus != 0)) {
+        fprintf(stdout, "  %-18s %9s %12s\n", modes[m].name_,
+                memstatus ? "on" : "off", "n/a");
+        continue;
+      }
+      open_flags_ = modes[m].open_flags_ |
+                    (saved_flags & SQLITE_OPEN_SHAREDCACHE);
+      bench_connect();
+      exec_sql(db_, "PRAGMA synchronous = OFF");
+
+      double read = matrix_ops(false, reads_);
+      double write = matrix_ops(true, num_);
+      wal_checkpoint(db_);
+      if (base == 0) base = read + write;
+      fprintf(stdout, "  %-18s %9s %12.3f %12.3f %+9.1f%%\n", modes[m].name_,
+              memstatus ? "on" : "off", read * 1e6, write * 1e6,
+              100.0 * ((read + write) / base - 1));
+      fflush(stdout);
+    }
+  }
+
+  /* Back to the configured settings */
+  sqlite3_close(db_);
+  db_ = NULL;
+  error_check(sqlite3_shutdown());
+  sqlite_configure(threading_, FLAGS_memstatus);
+  open_flags_ = saved_flags;
+  bench_connect();
+}
+
+/* One sharedcache thread: point reads on its own connection */
+typedef struct CacheReader {
+  ThreadState t_;
+  sqlite3* db_;
+  sqlite3_stmt* stmt_;
+  int ops_;
+} CacheReader;
+
+static void cache_reader(void* arg) {
+  CacheReader* r = (CacheReader*)arg;
+  ThreadState* t = &r->t_;
+  char key[kMaxKeySize];
+  int status;
+
+  t->last_op_finish_ = now_seconds();
+  for (int i = 0; i < r->ops_; i++) {
+    int k = rand_next(&t->rand_) % reads_;
+    bind_key(r->stmt_, 1, k, key);
+    while ((status = sqlite3_step(r->stmt_)) == SQLITE_ROW) {
+      if (FLAGS_verify) verify_row(r->stmt_, k, &t->verify_);
+    }
+    step_error_check(status);
+    error_check(sqlite3_reset(r->stmt_));
+    thread_op_note(t, TRACE_READ, k);
+    thread_finished_op(t);
+  }
+}
+
+/*
+ * sharedcache: reads_ point reads of database db_num_ split over each of
+ * --threads connections, first each with its own page cache, then all in
+ * one shared cache, whose table locks the readers contend on.
+ */
+static void bench_shared_cache(void) {
+  int thread_list[16] = { 1, 2, 4 };
+  int nthread = 3;
+  int saved_flags = open_flags_;
+  char file_name[100];
+  double base = 0;
+
+  if (shards_ > 0 || FLAGS_processes > 1) {
+    strcpy(message_, "skipping (not sharded)");
+    return;
+  }
+  if (threading_ == SQLITE_CONFIG_SINGLETHREAD) {
+    strcpy(message_, "skipping (--threading=single)");
+    return;
+  }
+  if (FLAGS_threads != NULL)
+    nthread = parse_int_list(FLAGS_threads, thread_list, 16);
+  if (nthread <= 0) {
+    fprintf(stderr, "invalid --threads list\n");
+    exit(1);
+  }
+
+  /* db_ holds an exclusive lock; the readers share the file */
+  sqlite3_close(db_);
+  db_ = NULL;
+  own_connections_ = true;
+  db_file_name(file_name, sizeof(file_name), db_num_, -1);
+  fprintf(stdout, "  %7s %8s %12s %8s\n", "threads", "cache", "ops/s",
+          "scale");
+  for (int i = 0; i < nthread; i++) {
+    int n = thread_list[i] < 1 ? 1 : thread_list[i];
+    for (int shared = 0; shared <= 1; shared++) {
+      CacheReader* r = (CacheReader*)calloc(n, sizeof(CacheReader));
+      open_flags_ = (saved_flags & ~SQLITE_OPEN_SHAREDCACHE) |
+                    (shared ? SQLITE_OPEN_SHAREDCACHE : SQLITE_OPEN_PRIVATECACHE);
+      for (int j = 0; j < n; j++) {
+        thread_state_init(&r[j].t_, j);
+        r[j].ops_ = reads_ / n + (j == 0 ? reads_ % n : 0);
+        r[j].db_ = open_db(file_name, &r[j].t_.busy_);
+        error_check(sqlite3_prepare_v2(r[j].db_,
+                                       "SELECT * FROM test WHERE key = ?",
+                                       -1, &r[j].stmt_, NULL));
+      }
+      open_flags_ = saved_flags;
+
+      double start = now_seconds();
+      for (int j = 0; j < n; j++)
+        thread_create(&r[j].t_.thread_, cache_reader, &r[j]);
+      for (int j = 0; j < n; j++) {
+        thread_join(r[j].t_.thread_);
+        thread_state_merge(&r[j].t_);
+      }
+      double ops = reads_ / (now_seconds() - start);
+      for (int j = 0; j < n; j++) {
+        error_check(sqlite3_finalize(r[j].stmt_));
+        error_check(sqlite3_close(r[j].db_));
+      }
+      free(r);
+
+      if (base == 0) base = ops;
+      fprintf(stdout, "  %7d %8s %12.0f %7.2fx\n", n,
+              shared ? "shared" : "private", ops, ops / base);
+      fflush(stdout);
+    }
+  }
+  own_connections_ = false;
+  bench_connect();
+}
+
+/*
+ * Analytics: aggregates over the whole table, as a reporting job runs
+ * them next to the point operations.  A query is one op; its rows are
+ * the table rows it stepped through and its bytes the database file.
+ */
+static void scan_sql(int q, char* buf, size_t size) {
+  switch (q) {
+    case SCAN_COUNT:
+      snprintf(buf, size, "SELECT count(*) FROM test");
+      break;
+    case SCAN_SUM:
+      snprintf(buf, size, "SELECT sum(length(value)) FROM test");
+      break;
+    case SCAN_GROUP:
+      snprintf(buf, size, "SELECT substr(key, 1, %d), count(*) FROM test "
+               "GROUP BY 1", FLAGS_scan_prefix);
+      break;
+    default:
+      snprintf(buf, size, "SELECT key, value FROM test ORDER BY value "
+               "LIMIT %d", FLAGS_scan_limit);
+      break;
+  }
+}
+
+/* Run scan query q on db; returns the rows it read */
+static int64_t scan_run(sqlite3* db, int q) {
+  sqlite3_stmt* stmt;
+  char sql[150];
+  int64_t rows = 0;
+  int status;
+
+  scan_sql(q, sql, sizeof(sql));
+  status = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+  error_check(status);
+  while ((status = sqlite3_step(stmt)) == SQLITE_ROW) {
+    if (q == SCAN_COUNT) rows = sqlite3_column_int64(stmt, 0);
+  }
+  step_error_check(status);
+  /* The first row is reached by a rewind, not a step; count(*) reads the
+   * b-tree's cell counts rather than stepping rows at all */
+  int64_t stepped = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 0);
+  if (stepped > 0) stepped++;
+  error_check(sqlite3_finalize(stmt));
+  return stepped > rows ? stepped : rows;
+}
+
+static int64_t db_bytes(sqlite3* db) {
+  return query_int(db, "PRAGMA page_count") * query_int(db, "PRAGMA page_size");
+}
+
+static void bench_scan(int q) {
+  if (shards_ > 0) {
+    strcpy(message_, "skipping (not sharded)");
+    return;
+  }
+
+  int64_t bytes = db_bytes(db_);
+  double start = now_seconds();
+  int64_t rows = scan_run(db_, q);
+  double seconds = now_seconds() - start;
+  bytes_ += bytes;
+  finished_single_op();
+  snprintf(message_, sizeof(message_), "%lld rows %.0f rows/s",
+           (long long)rows, rows / seconds);
+}
+
+/* Copy the test table into file_name, a new database of page_size pages */
+static void scan_copy(const char* file_name, int page_size) {
+  sqlite3_stmt* stmt;
+  char sql[300];
+  int status;
+
+  remove(file_name);
+  snprintf(sql, sizeof(sql), "ATTACH '%s' AS scan", file_name);
+  exec_sql(db_, sql);
+  snprintf(sql, sizeof(sql), "PRAGMA scan.page_size = %d", page_size);
+  exec_sql(db_, sql);
+  exec_sql(db_, "PRAGMA scan.journal_mode = OFF");
+
+  /* Same schema as main.test; sqlite_master has "CREATE TABLE test ..." */
+  status = sqlite3_prepare_v2(db_, "SELECT sql FROM main.sqlite_master "
+                              "WHERE name = 'test'", -1, &stmt, NULL);
+  error_check(status);
+  status = sqlite3_step(stmt);
+  if (status != SQLITE_ROW) step_error_check(status);
+  snprintf(sql, sizeof(sql), "CREATE TABLE scan.test%s",
+           (const char*)sqlite3_column_text(stmt, 0) + strlen("CREATE TABLE test"));
+  error_check(sqlite3_finalize(stmt));
+  exec_sql(db_, sql);
+  exec_sql(db_, "INSERT INTO scan.test SELECT * FROM main.test");
+  exec_sql(db_, "DETACH scan");
+}
+
+/*
+ * analytics: the four scans of a copy of the table, first with the first
+ * of each --scan_* setting, then varying one setting at a time.  The copy
+ * is rebuilt for each page size, and each configuration starts with a new
+ * connection, so an empty page cache.  Prints MB/s of each query.
+ */
+static void bench_analytics(void) {
+  static const char* const setting_name[] = {
+    "cache", "mmap", "temp", "threads", "page"
+  };
+  const int nsettings = 5;
+  char* lists[5];
+  int values[5][16], counts[5];
+  char file_name[100], wal_name[120];
+  double base = 0;
+  int built = 0;
+
+  if (shards_ > 0) {
+    strcpy(message_, "skipping (not sharded)");
+    return;
+  }
+  /* Every worker would rebuild the one scan copy at once */
+  if (FLAGS_processes > 1) {
+    strcpy(message_, "skipping (not multi-process)");
+    return;
+  }
+  lists[0] = FLAGS_scan_cache_sizes;
+  lists[1] = FLAGS_scan_mmap_mb;
+  lists[2] = FLAGS_scan_temp_store;
+  lists[3] = FLAGS_scan_threads;
+  lists[4] = FLAGS_scan_page_sizes;
+  for (int i = 0; i < nsettings; i++) {
+    counts[i] = parse_int_list(lists[i], values[i], 16);
+    if (counts[i] <= 0) {
+      fprintf(stderr, "invalid --scan_* list for %s\n", setting_name[i]);
+      exit(1);
+    }
+  }
+
+  snprintf(file_name, sizeof(file_name), "%s/dbbench_sqlite3-scan.db",
+           FLAGS_db);
+  snprintf(wal_name, sizeof(wal_name), "%s-wal", file_name);
+  fprintf(stdout, "  %6s %7s %5s %5s %7s %9s %9s %9s %9s %9s %8s\n",
+          "page", "cache", "mmap", "temp", "threads", "count", "sum",
+          "group", "topk", "Mrows/s", "vs base");
+  /* Setting -1 is the baseline; the page size goes last, so each copy is
+   * built once (the baseline's is reused up to the page size sweep) */
+  for (int s = -1; s < nsettings; s++) {
+    for (int i = (s < 0 ? 0 : 1); i < (s < 0 ? 1 : counts[s]); i++) {
+      int v[5];
+      for (int j = 0; j < nsettings; j++) v[j] = values[j][s == j ? i : 0];
+      if (v[4] != built) {
+        remove(wal_name);
+        scan_copy(file_name, v[4]);
+        built = v[4];
+      }
+
+      char sql[200];
+      sqlite3* db = open_db(file_name, &busy_);
+      snprintf(sql, sizeof(sql), "PRAGMA cache_size = %d; "
+               "PRAGMA mmap_size = %lld; PRAGMA temp_store = %d; "
+               "PRAGMA threads = %d", v[0], (long long)v[1] << 20, v[2], v[3]);
+      exec_sql(db, sql);
+      int64_t bytes = db_bytes(db);
+      /* Both may be capped by the build */
+      int64_t mmap_mb = query_int(db, "PRAGMA mmap_size") >> 20;
+      int64_t threads = query_int(db, "PRAGMA threads");
+
+      double mbs[kScanQueries], seconds = 0;
+      int64_t rows = 0;
+      for (int q = 0; q < kScanQueries; q++) {
+        if (FLAGS_cold) {
+          drop_file_cache(file_name);
+          drop_file_cache(wal_name);
+        }
+        double start = now_seconds();
+        rows += scan_run(db, q);
+        double t = now_seconds() - start;
+        mbs[q] = bytes / 1048576.0 / t;
+        seconds += t;
+        bytes_ += bytes;
+        finished_single_op();
+      }
+      error_check(sqlite3_close(db));
+
+      if (base == 0) base = seconds;
+      fprintf(stdout, "  %6d %7d %5lld %5d %7lld %9.1f %9.1f %9.1f %9.1f "
+              "%9.2f %+7.1f%%\n", v[4], v[0], (long long)mmap_mb, v[2],
+              (long long)threads, mbs[SCAN_COUNT], mbs[SCAN_SUM],
+              mbs[SCAN_GROUP], mbs[SCAN_TOPK], rows / seconds / 1e6,
+              100.0 * (base / seconds - 1));
+      fflush(stdout);
+    }
+  }
+  remove(file_name);
+  remove(wal_name);
+}
+
+/*
+ * Online copies of database db_num_ into a file next to it: backup runs
+ * sqlite3_backup_step() over --backup_pages pages at a time, sleeping
+ * --backup_sleep_ms between steps, and vacuuminto one VACUUM INTO.  An op
+ * is a backup step (the whole VACUUM INTO), the bytes those of the copy.
+ *
+ * With --backup_writer a thread does fillrandom's writes on a connection
+ * of its own while the copy runs.  A write from another connection makes
+ * the backup start over at its next step, counted as a restart.  The same
+ * thread first writes num_/10 rows with no copy going on, so the p99 of
+ * its writes during the copy has a baseline.
+ */
+typedef struct CopyWriter {
+  ThreadState t_;
+  sqlite3* db_;
+  sqlite3_stmt* stmt_;
+  int ops_;                     /* writes at most */
+  volatile int stop_;           /* set when the copy is done */
+  Histogram latency_;
+} CopyWriter;
+
+static void copy_writer(void* arg) {
+  CopyWriter* w = (CopyWriter*)arg;
+  ThreadState* t = &w->t_;
+  char key[kMaxKeySize];
+  int status;
+
+  histogram_clear(&w->latency_);
+  t->done_ = 0;
+  t->last_op_finish_ = now_seconds();
+  while (t->done_ < w->ops_ && !w->stop_) {
+    double start = now_seconds();
+    int k = (int)(rand_next(&t->rand_) % num_);
+    const char* value = rand_gen_generate(&t->gen_, FLAGS_value_size);
+    int key_size = bind_key(w->stmt_, 1, k, key);
+    value = stamp_value(t->scratch_, value, FLAGS_value_size, k);
+    status = sqlite3_bind_blob(w->stmt_, 2, value, FLAGS_value_size,
+                               SQLITE_STATIC);
+    error_check(status);
+    t->bytes_ += FLAGS_value_size + key_size;
+    /* A copy holding its read lock past the busy timeout only delays us */
+    while ((status = sqlite3_step(w->stmt_)) == SQLITE_BUSY) {
+      sqlite3_reset(w->stmt_);
+      sqlite3_sleep(1);
+    }
+    step_error_check(status);
+    error_check(sqlite3_reset(w->stmt_));
+    histogram_add(&w->latency_, (now_seconds() - start) * 1e6);
+    thread_op_note(t, TRACE_WRITE, k);
+    thread_finished_op(t);
+  }
+}
+
+/* Copy src into file_name; returns the times the backup started over */
+static int64_t copy_run(sqlite3* src, const char* file_name, bool vacuum) {
+  int64_t restarts = 0;
+  int status;
+
+  remove(file_name);
+  if (vacuum) {
+    char* sql = sqlite3_mprintf("VACUUM INTO %Q", file_name);
+    while ((status = sqlite3_exec(src, sql, NULL, NULL, NULL)) == SQLITE_BUSY)
+      sqlite3_sleep(1);
+    error_check(status);
+    sqlite3_free(sql);
+    finished_single_op();
+    return 0;
+  }
+
+  sqlite3* dest;
+  status = sqlite3_open_v2(file_name, &dest,
+                           SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+  error_check(status);
+  sqlite3_backup* backup = sqlite3_backup_init(dest, "main", src, "main");
+  if (backup == NULL) {
+    fprintf(stderr, "backup error: %s\n", sqlite3_errmsg(dest));
+    exit(1);
+  }
+  /* Pages copied so far; a step that ends short of where it would have
+   * taken them from there started over from the first page */
+  int copied = 0;
+  do {
+    status = sqlite3_backup_step(backup, FLAGS_backup_pages);
+    if (status == SQLITE_BUSY || status == SQLITE_LOCKED) {
+      sqlite3_sleep(1);
+      continue;
+    }
+    int total = sqlite3_backup_pagecount(backup);
+    int now = total - sqlite3_backup_remaining(backup);
+    int step = FLAGS_backup_pages < 0 ? total - copied :
+               FLAGS_backup_pages < total - copied ? FLAGS_backup_pages :
+               total - copied;
+    if (copied > 0 && now - copied < step) restarts++;
+    copied = now;
+    finished_single_op();
+    if (status == SQLITE_OK && FLAGS_backup_sleep_ms > 0)
+      sqlite3_sleep(FLAGS_backup_sleep_ms);
+  } while (status == SQLITE_OK || status == SQLITE_BUSY ||
+           status == SQLITE_LOCKED);
+  if (status != SQLITE_DONE) {
+    fprintf(stderr, "backup error: %s\n", sqlite3_errstr(status));
+    exit(1);
+  }
+  error_check(sqlite3_backup_finish(backup));
+  error_check(sqlite3_close(dest));
+  return restarts;
+}
+
+static void bench_copy(bool vacuum) {
+  char file_name[100], copy_name[100];
+  CopyWriter w;
+  double alone_p99 = 0;
+
+  if (shards_ > 0 || FLAGS_processes > 1) {
+    strcpy(message_, "skipping (not sharded)");
+    return;
+  }
+  if (FLAGS_backup_writer && threading_ == SQLITE_CONFIG_SINGLETHREAD) {
+    strcpy(message_, "skipping (--threading=single)");
+    return;
+  }
+
+  /* db_ holds an exclusive lock; the copy and the writer share the file */
+  sqlite3_close(db_);
+  db_ = NULL;
+  own_connections_ = true;
+  db_file_name(file_name, sizeof(file_name), db_num_, -1);
+  snprintf(copy_name, sizeof(copy_name), "%s/dbbench_sqlite3-copy.db",
+           FLAGS_db);
+  sqlite3* src = open_db(file_name, &busy_);
+
+  if (FLAGS_backup_writer) {
+    thread_state_init(&w.t_, 0);
+    w.db_ = open_db(file_name, &w.t_.busy_);
+    exec_sql(w.db_, "PRAGMA synchronous = OFF");
+    error_check(sqlite3_prepare_v2(w.db_,
+        "REPLACE INTO test (key, value) VALUES (?, ?)", -1, &w.stmt_, NULL));
+    w.ops_ = num_ / 10 > 0 ? num_ / 10 : 1;
+    w.stop_ = 0;
+    copy_writer(&w);
+    alone_p99 = histogram_percentile(&w.latency_, 99);
+    w.ops_ = num_;
+    thread_create(&w.t_.thread_, copy_writer, &w);
+    bench_start();
+  }
+
+  double start = now_seconds();
+  int64_t restarts = copy_run(src, copy_name, vacuum);
+  double seconds = now_seconds() - start;
+  int64_t bytes = file_size(copy_name);
+  bytes_ += bytes;
+
+  char msg[200];
+  if (vacuum)
+    snprintf(msg, sizeof(msg), "%.1f MB copied", bytes / 1048576.0);
+  else
+    snprintf(msg, sizeof(msg), "%.1f MB copied, %lld restarts",
+             bytes / 1048576.0, (long long)restarts);
+  if (FLAGS_backup_writer) {
+    w.stop_ = 1;
+    thread_join(w.t_.thread_);
+    double p99 = histogram_percentile(&w.latency_, 99);
+    size_t n = strlen(msg);
+    snprintf(msg + n, sizeof(msg) - n, ", writer %d ops %.0f ops/s p99 %.1f "
+             "usec vs %.1f alone (%+.0f%%)", w.t_.done_,
+             w.t_.done_ / seconds, p99, alone_p99,
+             alone_p99 > 0 ? 100.0 * (p99 / alone_p99 - 1) : 0.0);
+    error_check(sqlite3_finalize(w.stmt_));
+    error_check(sqlite3_close(w.db_));
+    rand_gen_free(&w.t_.gen_);
+    free(w.t_.scratch_);
+  }
+  append_message(msg);
+
+  error_check(sqlite3_close(src));
+  remove(copy_name);
+  own_connections_ = false;
+  bench_connect();
+}
+
+/*
+ * replicaapply: the changesets --session kept of the last write benchmark
+ * applied in order to a new database, one transaction each, as a replica
+ * would.  After writes to an existing database the replica lacks rows the
+ * changes expect; those conflicts are counted and the change skipped, or
+ * it replaces the replica's row.
+ */
+#ifdef SQLITE_ENABLE_SESSION
+static int replica_conflict(void* arg, int type, sqlite3_changeset_iter* it) {
+  (void)it;
+  (*(int64_t*)arg)++;
+  return (type == SQLITE_CHANGESET_DATA || type == SQLITE_CHANGESET_CONFLICT) ?
+         SQLITE_CHANGESET_REPLACE : SQLITE_CHANGESET_OMIT;
+}
+#endif
+
+static void bench_replica_apply(void) {
+  if (nchangesets_ == 0) {
+    strcpy(message_, "skipping (no --session writes)");
+    return;
+  }
+#ifdef SQLITE_ENABLE_SESSION
+  char file_name[100], wal_name[110];
+  int64_t conflicts = 0;
+
+  snprintf(file_name, sizeof(file_name), "%s/dbbench_sqlite3-replica.db",
+           FLAGS_db);
+  snprintf(wal_name, sizeof(wal_name), "%s-wal", file_name);
+  remove(file_name);
+  remove(wal_name);
+  sqlite3* replica = open_db(file_name, &busy_);
+  exec_sql(replica, changesets_sync_ ? "PRAGMA synchronous = FULL" :
+                                       "PRAGMA synchronous = OFF");
+
+  int changes = sqlite3_total_changes(replica);
+  double start = now_seconds();
+  for (int i = 0; i < nchangesets_; i++) {
+    int status = sqlite3changeset_apply(replica, changesets_[i].size_,
+                                        changesets_[i].data_, NULL,
+                                        replica_conflict, &conflicts);
+    error_check(status);
+    bytes_ += changesets_[i].size_;
+    finished_single_op();
+  }
+  double seconds = now_seconds() - start;
+  changes = sqlite3_total_changes(replica) - changes;
+  snprintf(message_, sizeof(message_), "%d changesets, %d rows %.0f rows/s, "
+           "%lld conflicts", nchangesets_, changes, changes / seconds,
+           (long long)conflicts);
+
+  error_check(sqlite3_close(replica));
+  remove(file_name);
+  remove(wal_name);
+#endif
+}
@@ -0,0 +1,113 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+#if defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+/*
+ * CRC-32C (Castagnoli) for --verify.  SSE4.2 and ARMv8 have an
+ * instruction that folds 8 bytes into the CRC at a time (4 on 32-bit
+ * x86); it is used when the CPU has it, a byte-wise table otherwise.
+ * crc32c() extends crc by n bytes at p, like LevelDB's crc32c::Extend.
+ */
+
+typedef uint32_t (*Crc32cFunc)(uint32_t, const unsigned char*, size_t);
+
+static uint32_t table_[256];
+static Crc32cFunc crc_fn_;
+
+static uint32_t crc32c_table(uint32_t crc, const unsigned char* p, size_t n) {
+  for (; n > 0; n--, p++) crc = table_[(crc ^ *p) & 0xff] ^ (crc >> 8);
+  return crc;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define HAVE_CRC32C_HW 1
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char* p, size_t n) {
+  uint64_t c = crc;
+  for (; n >= 8; n -= 8, p += 8) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    c = __builtin_ia32_crc32di(c, v);
+  }
+  crc = (uint32_t)c;
+  for (; n > 0; n--, p++) crc = __builtin_ia32_crc32qi(crc, *p);
+  return crc;
+}
+#elif defined(_MSC_VER) && defined(_M_X64)
+#define HAVE_CRC32C_HW 1
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char* p, size_t n) {
+  uint64_t c = crc;
+  for (; n >= 8; n -= 8, p += 8) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    c = _mm_crc32_u64(c, v);
+  }
+  crc = (uint32_t)c;
+  for (; n > 0; n--, p++) crc = _mm_crc32_u8(crc, *p);
+  return crc;
+}
+#elif defined(_MSC_VER) && defined(_M_IX86)
+#define HAVE_CRC32C_HW 1
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char* p, size_t n) {
+  for (; n >= 4; n -= 4, p += 4) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    crc = _mm_crc32_u32(crc, v);
+  }
+  for (; n > 0; n--, p++) crc = _mm_crc32_u8(crc, *p);
+  return crc;
+}
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define HAVE_CRC32C_HW 1
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char* p, size_t n) {
+  for (; n >= 8; n -= 8, p += 8) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    crc = __crc32cd(crc, v);
+  }
+  for (; n > 0; n--, p++) crc = __crc32cb(crc, *p);
+  return crc;
+}
+#endif
+
+static bool has_crc32c_hw(void) {
+#if defined(__GNUC__) && defined(__x86_64__)
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse4.2");
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  int r[4];
+  __cpuid(r, 1);
+  return (r[2] & (1 << 20)) != 0;
+#elif defined(HAVE_CRC32C_HW)
+  return true;
+#else
+  return false;
+#endif
+}
+
+/* Pick the implementation before any thread uses crc32c(); returns its name */
+const char* crc32c_init(void) {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++) c = (c >> 1) ^ ((c & 1) ? 0x82f63b78 : 0);
+    table_[i] = c;
+  }
+  crc_fn_ = crc32c_table;
+#ifdef HAVE_CRC32C_HW
+  if (has_crc32c_hw()) {
+    crc_fn_ = crc32c_hw;
+    return "hardware";
+  }
+#endif
+  return "table";
+}
+
+uint32_t crc32c(uint32_t crc, const void* p, size_t n) {
+  return ~crc_fn_(~crc, (const unsigned char*)p, n);
+}
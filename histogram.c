@@ -66,6 +66,10 @@ static double standard_deviation(Histogram* hist_) {
   return sqrt(variance);
 }
 
+double histogram_percentile(Histogram* hist_, double p) {
+  return percentile(hist_, p);
+}
+
 void histogram_clear(Histogram* hist_) {
   hist_->min_ = bucket_limit[kNumBuckets - 1];
   hist_->max_ = 0;
@@ -19,6 +19,7 @@ void init() {
   //   fillseq100K   -- write N/1000 100K values in sequential order in async mode
   //   readseq       -- read N times sequentially
   //   readrandom    -- read N times in random order
+  //   readhot       -- read N times in random order from 1% section of DB
   //   readrand100K  -- read N/1000 100K values in sequential order in async mode
   FLAGS_benchmarks =
     "fillseq,"
@@ -39,6 +40,7 @@ void init() {
   FLAGS_reads = -1;
   FLAGS_value_size = 100;
   FLAGS_histogram = false;
+  FLAGS_slow_op_ms = -1;
   FLAGS_raw = false,
   FLAGS_compression_ratio = 0.5;
   FLAGS_page_size = 1024;
@@ -48,6 +50,56 @@ void init() {
   FLAGS_transaction = true;
   FLAGS_WAL_enabled = true;
   FLAGS_db = NULL;
+  FLAGS_allocator = NULL;
+  FLAGS_heap_size = 64;
+  FLAGS_lookaside = NULL;
+  FLAGS_pcache = NULL;
+  FLAGS_huge_pages = false;
+  FLAGS_processes = 1;
+  FLAGS_busy_timeout = 1000;
+  FLAGS_busy_handler = "backoff";
+  FLAGS_shards = NULL;
+  FLAGS_threads = NULL;
+  FLAGS_shard_mode = "files";
+  FLAGS_trace = NULL;
+  FLAGS_trace_capture = NULL;
+  FLAGS_trace_import = NULL;
+  FLAGS_replay_speed = 0;
+  FLAGS_replay_threads = 1;
+  FLAGS_workload = NULL;
+  FLAGS_metrics_listen = NULL;
+  FLAGS_stmt_profile = false;
+  FLAGS_producers = 4;
+  FLAGS_target_commit_ms = 0;
+  FLAGS_batch_sizes = "1,2,5,10,20,50,100,200,500,1000,2000,5000,10000,20000,50000,100000";
+  FLAGS_cold = false;
+  FLAGS_open_iters = 100;
+  FLAGS_open_tables = "0,100,500";
+  FLAGS_open_wal_mb = "0,16";
+  FLAGS_scan_prefix = 12;
+  FLAGS_scan_limit = 100000;
+  FLAGS_scan_page_sizes = "1024,4096,16384";
+  FLAGS_scan_cache_sizes = "4096,65536";
+  FLAGS_scan_mmap_mb = "0,1024";
+  FLAGS_scan_temp_store = "1,2";
+  FLAGS_scan_threads = "0,4";
+  FLAGS_backup_pages = 100;
+  FLAGS_backup_sleep_ms = 0;
+  FLAGS_backup_writer = false;
+  FLAGS_key_format = "decimal16";
+  FLAGS_use_intpk = false;
+  FLAGS_page_stats = false;
+  FLAGS_threading = NULL;
+  FLAGS_op_breakdown = false;
+  FLAGS_footprint = false;
+  FLAGS_verify = false;
+  FLAGS_backend = "sqlite";
+  FLAGS_session = false;
+  FLAGS_vfs = NULL;
+  FLAGS_subtract_harness = false;
+  FLAGS_open_mutex = "default";
+  FLAGS_memstatus = true;
+  FLAGS_shared_cache = false;
 }
 
 void print_usage(const char* argv0) {
@@ -56,6 +108,8 @@ void print_usage(const char* argv0) {
   fprintf(stdout, "[OPTION]\n");
   fprintf(stdout, "  --benchmarks=BENCH[,BENCH]*\tspecify benchmark(\n");
   fprintf(stdout, "  --histogram={0,1}\t\trecord histogram\n");
+  fprintf(stdout, "  --slow_op_ms=DOUBLE\t\tlist ops slower than this, 0 for none\n"
+                  "\t\t\t\t(20 with --histogram)\n");
   fprintf(stdout, "  --compression_ratio=DOUBLE\tcompression ratio\n");
   fprintf(stdout, "  --use_existing_db={0,1}\tuse existing database\n");
   fprintf(stdout, "  --use_rowids={0,1}\t\tuse table rowid\n");
@@ -67,6 +121,61 @@ void print_usage(const char* argv0) {
   fprintf(stdout, "  --num_pages=INT\t\tnumber of pages\n");
   fprintf(stdout, "  --WAL_enabled={1,0}\t\tenable WAL\n");
   fprintf(stdout, "  --db=PATH\t\t\tpath to location databases are created\n");
+  fprintf(stdout, "  --allocator=NAME\t\tsystem, pool, arena or memsys5 allocator\n");
+  fprintf(stdout, "  --heap_size=INT\t\tmemsys5 heap size in MB\n");
+  fprintf(stdout, "  --lookaside=SZxN[,SZxN]*\tlookaside slot size and count sweep\n");
+  fprintf(stdout, "  --pcache=NAME\t\t\tpcache1 or slab page cache\n");
+  fprintf(stdout, "  --huge_pages={0,1}\t\tback slab page cache with huge pages\n");
+  fprintf(stdout, "  --processes=INT\t\tnumber of processes sharing the database\n");
+  fprintf(stdout, "  --busy_timeout=INT\t\tlock wait limit in ms\n");
+  fprintf(stdout, "  --busy_handler=NAME\t\ttimeout, backoff or yield\n");
+  fprintf(stdout, "  --shards=INT[,INT]*\t\thash-partition keys over database files\n");
+  fprintf(stdout, "  --threads=INT[,INT]*\t\tthreads for --shards (0: one per shard)\n"
+                  "\t\t\t\tand sharedcache\n");
+  fprintf(stdout, "  --shard_mode=NAME\t\tfiles or attach\n");
+  fprintf(stdout, "  --trace=PATH\t\t\ttrace file for replay\n");
+  fprintf(stdout, "  --trace_capture=PATH\t\trecord this run's statements as a trace\n");
+  fprintf(stdout, "  --trace_import=PATH\t\tconvert a SQL log into --trace\n");
+  fprintf(stdout, "  --replay_speed=DOUBLE\t\treplay pacing, 0 for full speed\n");
+  fprintf(stdout, "  --replay_threads=INT\t\tthreads for replay\n");
+  fprintf(stdout, "  --workload=PATH\t\tphase spec for the workload benchmark\n");
+  fprintf(stdout, "  --metrics_listen=ADDR\t\tserve Prometheus metrics on unix:PATH\n"
+                  "\t\t\t\tor [HOST:]PORT\n");
+  fprintf(stdout, "  --stmt_profile={0,1}\t\tprint per-statement profile\n");
+  fprintf(stdout, "  --producers=INT\t\tproducer threads for groupcommit\n");
+  fprintf(stdout, "  --target_commit_ms=DOUBLE\tadapt batch size to this commit time\n");
+  fprintf(stdout, "  --batch_sizes=INT[,INT]*\trows per commit for batchsweep\n");
+  fprintf(stdout, "  --cold={0,1}\t\t\tdrop OS page cache before reads\n");
+  fprintf(stdout, "  --open_iters=INT\t\tconnections per openlatency setting\n");
+  fprintf(stdout, "  --open_tables=INT[,INT]*\textra tables for openlatency\n");
+  fprintf(stdout, "  --open_wal_mb=INT[,INT]*\tWAL sizes for openlatency\n");
+  fprintf(stdout, "  --scan_prefix=INT\t\tkey prefix bytes scangroup groups by\n");
+  fprintf(stdout, "  --scan_limit=INT\t\trows scantopk keeps\n");
+  fprintf(stdout, "  --scan_page_sizes=INT[,INT]*\tpage sizes for analytics\n");
+  fprintf(stdout, "  --scan_cache_sizes=INT[,INT]*\tcache_size settings for analytics\n");
+  fprintf(stdout, "  --scan_mmap_mb=INT[,INT]*\tmmap sizes in MB for analytics\n");
+  fprintf(stdout, "  --scan_temp_store=INT[,INT]*\ttemp_store settings for analytics\n");
+  fprintf(stdout, "  --scan_threads=INT[,INT]*\tsorter threads for analytics\n");
+  fprintf(stdout, "  --backup_pages=INT\t\tpages per backup step, -1 for all\n");
+  fprintf(stdout, "  --backup_sleep_ms=INT\t\tpause between backup steps\n");
+  fprintf(stdout, "  --backup_writer={0,1}\t\twrite randomly while copying\n");
+  fprintf(stdout, "  --key_format=NAME\t\tdecimal16, int64, bigendian8, uuid4, uuid7\n"
+                  "\t\t\t\tor prefix+suffix\n");
+  fprintf(stdout, "  --use_intpk={0,1}\t\tkey is INTEGER PRIMARY KEY (int64 keys)\n");
+  fprintf(stdout, "  --page_stats={0,1}\t\treport database size and leaf fill\n");
+  fprintf(stdout, "  --threading=NAME\t\tsingle, multi or serialized\n");
+  fprintf(stdout, "  --open_mutex=NAME\t\tdefault, nomutex or fullmutex connections\n");
+  fprintf(stdout, "  --memstatus={0,1}\t\tkeep SQLite memory statistics\n");
+  fprintf(stdout, "  --shared_cache={0,1}\t\topen connections in shared-cache mode\n");
+  fprintf(stdout, "  --op_breakdown={0,1}\t\tsplit ops into gen/bind/step/reset/book\n");
+  fprintf(stdout, "  --subtract_harness={0,1}\treport usec/op less the null harness\n");
+  fprintf(stdout, "  --footprint={0,1}\t\treport RSS, faults, context switches, CPU\n");
+  fprintf(stdout, "  --verify={0,1}\t\tchecksum values on write, check them on read\n");
+  fprintf(stdout, "  --vfs=NAME\t\t\tunix, uring (io_uring batched writes) or\n"
+                  "\t\t\t\tdirect (O_DIRECT)\n");
+  fprintf(stdout, "  --backend=NAME\t\tsqlite, btree, memory or lsm store for fill\n"
+                  "\t\t\t\tand read benchmarks\n");
+  fprintf(stdout, "  --session={0,1}\t\tcapture a changeset per write transaction\n");
   fprintf(stdout, "  --help\t\t\tshow this help (-h)\n");
   fprintf(stdout, "\n");
   fprintf(stdout, "[BENCH]\n");
@@ -81,10 +190,32 @@ void print_usage(const char* argv0) {
   fprintf(stdout, "  fillseq100K\twirte N/1000 100K values in sequential order in async mode\n");
   fprintf(stdout, "  readseq\tread N times sequentially\n");
   fprintf(stdout, "  readrandom\tread N times in random order\n");
+  fprintf(stdout, "  readhot\tread N times in random order from 1%% section of DB\n");
   fprintf(stdout, "  readrand100K\tread N/1000 100K values in sequential order in async mode\n");
+  fprintf(stdout, "  replay\trun the operations recorded in --trace\n");
+  fprintf(stdout, "  groupcommit\tproducer threads queue N writes for one batching writer\n");
+  fprintf(stdout, "  groupcommitsync\tgroupcommit with synchronous=FULL\n");
+  fprintf(stdout, "  batchsweep\trandom writes at each of --batch_sizes rows per commit\n");
+  fprintf(stdout, "  batchsweepsync\tbatchsweep of N/100 values with synchronous=FULL\n");
+  fprintf(stdout, "  readrandom_warmup\treadrandom from a cold cache, latency per tenth\n");
+  fprintf(stdout, "  readrandom_preload\treadrandom_warmup after reading the file through\n");
+  fprintf(stdout, "  openlatency\ttime open, pragmas, schema load, prepare, first query\n");
+  fprintf(stdout, "  null\t\tthe harness of N writes without SQLite calls\n");
+  fprintf(stdout, "  mutexmatrix\treads and writes under each threading mode and memstatus\n");
+  fprintf(stdout, "  sharedcache\t--threads readers with private vs shared page cache\n");
+  fprintf(stdout, "  scancount\tSELECT count(*) over the table\n");
+  fprintf(stdout, "  scansum\tSELECT sum(length(value)) over the table\n");
+  fprintf(stdout, "  scangroup\tcount(*) GROUP BY a --scan_prefix byte key prefix\n");
+  fprintf(stdout, "  scantopk\tORDER BY value LIMIT --scan_limit\n");
+  fprintf(stdout, "  analytics\tthe four scans under each page/cache/mmap/temp/threads\n");
+  fprintf(stdout, "  backup\tonline backup of the database, --backup_pages per step\n");
+  fprintf(stdout, "  vacuuminto\tVACUUM INTO a copy of the database\n");
+  fprintf(stdout, "  replicaapply\tapply the --session changesets to a new database\n");
+  fprintf(stdout, "  workload\trun the phases of --workload\n");
 }
 
 int main(int argc, char** argv) {
+  clock_init();
   init();
 
   for (int i = 1; i < argc; i++) {
@@ -95,6 +226,9 @@ int main(int argc, char** argv) {
       FLAGS_benchmarks = argv[i] + strlen("--benchmarks=");
     } else if (sscanf(argv[i], "--histogram=%d%c", &n, &junk) == 1 &&
         (n == 0 || n == 1)) { FLAGS_histogram = n == 1;
+    } else if (sscanf(argv[i], "--slow_op_ms=%lf%c", &d, &junk) == 1 &&
+               d >= 0) {
+      FLAGS_slow_op_ms = d;
     } else if (sscanf(argv[i], "--compression_ratio=%lf%c", &d, &junk) == 1) {
       FLAGS_compression_ratio = d;
     } else if (sscanf(argv[i], "--use_existing_db=%d%c", &n, &junk) == 1 &&
@@ -117,6 +251,108 @@ int main(int argc, char** argv) {
         (n == 0 || n == 1)) { FLAGS_WAL_enabled = n == 1;
     } else if (strncmp(argv[i], "--db=", 5) == 0) {
       FLAGS_db = argv[i] + 5;
+    } else if (strncmp(argv[i], "--allocator=", 12) == 0) {
+      FLAGS_allocator = argv[i] + 12;
+    } else if (sscanf(argv[i], "--heap_size=%d%c", &n, &junk) == 1) {
+      FLAGS_heap_size = n;
+    } else if (strncmp(argv[i], "--lookaside=", 12) == 0) {
+      FLAGS_lookaside = argv[i] + 12;
+    } else if (strncmp(argv[i], "--pcache=", 9) == 0) {
+      FLAGS_pcache = argv[i] + 9;
+    } else if (sscanf(argv[i], "--huge_pages=%d%c", &n, &junk) == 1 &&
+        (n == 0 || n == 1)) { FLAGS_huge_pages = n == 1;
+    } else if (sscanf(argv[i], "--processes=%d%c", &n, &junk) == 1 && n > 0) {
+      FLAGS_processes = n;
+    } else if (sscanf(argv[i], "--busy_timeout=%d%c", &n, &junk) == 1) {
+      FLAGS_busy_timeout = n;
+    } else if (strncmp(argv[i], "--busy_handler=", 15) == 0) {
+      FLAGS_busy_handler = argv[i] + 15;
+    } else if (strncmp(argv[i], "--shards=", 9) == 0) {
+      FLAGS_shards = argv[i] + 9;
+    } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+      FLAGS_threads = argv[i] + 10;
+    } else if (strncmp(argv[i], "--shard_mode=", 13) == 0) {
+      FLAGS_shard_mode = argv[i] + 13;
+    } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+      FLAGS_trace = argv[i] + 8;
+    } else if (strncmp(argv[i], "--trace_capture=", 16) == 0) {
+      FLAGS_trace_capture = argv[i] + 16;
+    } else if (strncmp(argv[i], "--trace_import=", 15) == 0) {
+      FLAGS_trace_import = argv[i] + 15;
+    } else if (sscanf(argv[i], "--replay_speed=%lf%c", &d, &junk) == 1 &&
+        d >= 0) { FLAGS_replay_speed = d;
+    } else if (sscanf(argv[i], "--replay_threads=%d%c", &n, &junk) == 1 &&
+        n > 0) { FLAGS_replay_threads = n;
+    } else if (strncmp(argv[i], "--workload=", 11) == 0) {
+      FLAGS_workload = argv[i] + 11;
+    } else if (strncmp(argv[i], "--metrics_listen=", 17) == 0) {
+      FLAGS_metrics_listen = argv[i] + 17;
+    } else if (sscanf(argv[i], "--stmt_profile=%d%c", &n, &junk) == 1 &&
+        (n == 0 || n == 1)) { FLAGS_stmt_profile = n == 1;
+    } else if (sscanf(argv[i], "--producers=%d%c", &n, &junk) == 1 && n > 0) {
+      FLAGS_producers = n;
+    } else if (sscanf(argv[i], "--target_commit_ms=%lf%c", &d, &junk) == 1 &&
+        d >= 0) { FLAGS_target_commit_ms = d;
+    } else if (strncmp(argv[i], "--batch_sizes=", 14) == 0) {
+      FLAGS_batch_sizes = argv[i] + 14;
+    } else if (sscanf(argv[i], "--cold=%d%c", &n, &junk) == 1 &&
+        (n == 0 || n == 1)) { FLAGS_cold = n == 1;
+    } else if (sscanf(argv[i], "--open_iters=%d%c", &n, &junk) == 1 && n > 0) {
+      FLAGS_open_iters = n;
+    } else if (strncmp(argv[i], "--open_tables=", 14) == 0) {
+      FLAGS_open_tables = argv[i] + 14;
+    } else if (strncmp(argv[i], "--open_wal_mb=", 14) == 0) {
+      FLAGS_open_wal_mb = argv[i] + 14;
+    } else if (sscanf(argv[i], "--scan_prefix=%d%c", &n, &junk) == 1 && n > 0) {
+      FLAGS_scan_prefix = n;
+    } else if (sscanf(argv[i], "--scan_limit=%d%c", &n, &junk) == 1 && n > 0) {
+      FLAGS_scan_limit = n;
+    } else if (strncmp(argv[i], "--scan_page_sizes=", 18) == 0) {
+      FLAGS_scan_page_sizes = argv[i] + 18;
+    } else if (strncmp(argv[i], "--scan_cache_sizes=", 19) == 0) {
+      FLAGS_scan_cache_sizes = argv[i] + 19;
+    } else if (strncmp(argv[i], "--scan_mmap_mb=", 15) == 0) {
+      FLAGS_scan_mmap_mb = argv[i] + 15;
+    } else if (strncmp(argv[i], "--scan_temp_store=", 18) == 0) {
+      FLAGS_scan_temp_store = argv[i] + 18;
+    } else if (strncmp(argv[i], "--scan_threads=", 15) == 0) {
+      FLAGS_scan_threads = argv[i] + 15;
+    } else if (sscanf(argv[i], "--backup_pages=%d%c", &n, &junk) == 1 &&
+               n != 0) {
+      FLAGS_backup_pages = n;
+    } else if (sscanf(argv[i], "--backup_sleep_ms=%d%c", &n, &junk) == 1 &&
+               n >= 0) {
+      FLAGS_backup_sleep_ms = n;
+    } else if (sscanf(argv[i], "--backup_writer=%d%c", &n, &junk) == 1 &&
+        (n == 0 || n == 1)) { FLAGS_backup_writer = n == 1;
+    } else if (sscanf(argv[i], "--op_breakdown=%d%c", &n, &junk) == 1 &&
+        (n == 0 || n == 1)) { FLAGS_op_breakdown = n == 1;
+    } else if (sscanf(argv[i], "--verify=%d%c", &n, &junk) == 1 &&
+        (n == 0 || n == 1)) { FLAGS_verify = n == 1;
+    } else if (strncmp(argv[i], "--vfs=", 6) == 0) {
+      FLAGS_vfs = argv[i] + 6;
+    } else if (strncmp(argv[i], "--backend=", 10) == 0) {
+      FLAGS_backend = argv[i] + 10;
+    } else if (sscanf(argv[i], "--session=%d%c", &n, &junk) == 1 &&
+        (n == 0 || n == 1)) { FLAGS_session = n == 1;
+    } else if (sscanf(argv[i], "--footprint=%d%c", &n, &junk) == 1 &&
+        (n == 0 || n == 1)) { FLAGS_footprint = n == 1;
+    } else if (sscanf(argv[i], "--subtract_harness=%d%c", &n, &junk) == 1 &&
+        (n == 0 || n == 1)) { FLAGS_subtract_harness = n == 1;
+    } else if (strncmp(argv[i], "--threading=", 12) == 0) {
+      FLAGS_threading = argv[i] + 12;
+    } else if (strncmp(argv[i], "--open_mutex=", 13) == 0) {
+      FLAGS_open_mutex = argv[i] + 13;
+    } else if (sscanf(argv[i], "--memstatus=%d%c", &n, &junk) == 1 &&
+        (n == 0 || n == 1)) { FLAGS_memstatus = n == 1;
+    } else if (sscanf(argv[i], "--shared_cache=%d%c", &n, &junk) == 1 &&
+        (n == 0 || n == 1)) { FLAGS_shared_cache = n == 1;
+    } else if (strncmp(argv[i], "--key_format=", 13) == 0) {
+      FLAGS_key_format = argv[i] + 13;
+    } else if (sscanf(argv[i], "--use_intpk=%d%c", &n, &junk) == 1 &&
+        (n == 0 || n == 1)) { FLAGS_use_intpk = n == 1;
+    } else if (sscanf(argv[i], "--page_stats=%d%c", &n, &junk) == 1 &&
+        (n == 0 || n == 1)) { FLAGS_page_stats = n == 1;
     } else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h")) {
       print_usage(argv[0]);
       exit(0);
@@ -0,0 +1,328 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+#include <stdarg.h>
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET Socket;
+#define close_socket closesocket
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+typedef int Socket;
+#define INVALID_SOCKET (-1)
+#define close_socket close
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/*
+ * --metrics_listen: a thread serving the live counters of the run in the
+ * Prometheus text format, over HTTP on 127.0.0.1:port or a Unix socket
+ * ("curl --unix-socket PATH http://localhost/metrics").
+ *
+ * The benchmark thread publishes a MetricsSnapshot now and then into one
+ * of two slots and then bumps seq_; the server copies the slot seq_ names
+ * and retries if seq_ moved on at all meanwhile, since the publish after
+ * next may already be rewriting that slot.  Neither side ever waits for
+ * the other.  Ops of worker
+ * threads and checkpoints are counted with atomic adds instead.
+ */
+
+static volatile int64_t seq_;
+static MetricsSnapshot slots_[2];
+static volatile int64_t thread_ops_;
+static volatile int64_t checkpoints_;
+
+static Socket listen_;
+static char unix_path_[108];
+static Thread server_;
+static volatile int64_t stopping_;
+
+/* Live rate, sampled by the server once a second */
+static double rate_;
+static int64_t rate_ops_;
+static double rate_time_;
+
+#ifdef _WIN32
+static inline int64_t load_acquire(volatile int64_t* p) {
+  int64_t v = *p;
+  _ReadWriteBarrier();
+  return v;
+}
+
+static inline void store_release(volatile int64_t* p, int64_t v) {
+  _ReadWriteBarrier();
+  *p = v;
+}
+
+static inline void fence_acquire(void) {
+  _ReadWriteBarrier();
+}
+
+static inline void fence_release(void) {
+  _ReadWriteBarrier();
+}
+
+static inline void fetch_add(volatile int64_t* p, int64_t n) {
+  InterlockedExchangeAdd64(p, n);
+}
+#else
+static inline int64_t load_acquire(volatile int64_t* p) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_release(volatile int64_t* p, int64_t v) {
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static inline void fence_acquire(void) {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+}
+
+static inline void fence_release(void) {
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void fetch_add(volatile int64_t* p, int64_t n) {
+  __atomic_fetch_add(p, n, __ATOMIC_RELAXED);
+}
+#endif
+
+/* Only ever called by the benchmark's main thread */
+void metrics_publish(const MetricsSnapshot* s) {
+  int64_t next = seq_ + 1;
+  /* The last publish's seq_ must be out before this slot changes */
+  fence_release();
+  slots_[next & 1] = *s;
+  store_release(&seq_, next);
+}
+
+void metrics_add_ops(int64_t n) {
+  fetch_add(&thread_ops_, n);
+}
+
+void metrics_add_checkpoint(void) {
+  fetch_add(&checkpoints_, 1);
+}
+
+static void snapshot_read(MetricsSnapshot* s) {
+  for (;;) {
+    int64_t seq = load_acquire(&seq_);
+    *s = slots_[seq & 1];
+    fence_acquire();
+    if (load_acquire(&seq_) == seq) return;
+  }
+}
+
+static int64_t ops_total(const MetricsSnapshot* s) {
+  return s->ops_ + load_acquire(&thread_ops_);
+}
+
+static void sample_rate(void) {
+  MetricsSnapshot s;
+  snapshot_read(&s);
+  int64_t ops = ops_total(&s);
+  double now = now_seconds();
+  if (rate_time_ > 0 && now > rate_time_)
+    rate_ = (ops - rate_ops_) / (now - rate_time_);
+  rate_ops_ = ops;
+  rate_time_ = now;
+}
+
+typedef struct Text {
+  char* buf_;
+  size_t size_;
+  size_t len_;
+} Text;
+
+static void text_add(Text* t, const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(t->buf_ + t->len_, t->size_ - t->len_, fmt, ap);
+  va_end(ap);
+  if (n > 0) t->len_ += (size_t)n < t->size_ - t->len_ ? (size_t)n :
+                        t->size_ - t->len_ - 1;
+}
+
+static void metric(Text* t, const char* name, const char* type,
+                   const char* help, const char* labels, double v) {
+  text_add(t, "# HELP sqlitebench_%s %s\n# TYPE sqlitebench_%s %s\n"
+           "sqlitebench_%s%s %.17g\n", name, help, name, type, name, labels, v);
+}
+
+/* The exposition text, after the HTTP header */
+static void render(Text* t) {
+  MetricsSnapshot s;
+  char labels[80];
+  snapshot_read(&s);
+  snprintf(labels, sizeof(labels), "{benchmark=\"%s\"}", s.bench_);
+
+  metric(t, "ops_total", "counter", "Operations finished.", "",
+         (double)ops_total(&s));
+  metric(t, "ops_per_second", "gauge", "Operations over the last second.",
+         labels, rate_);
+  metric(t, "bytes_total", "counter", "Key and value bytes moved.", "",
+         (double)s.bytes_);
+  text_add(t, "# HELP sqlitebench_latency_usec Time between finished ops of the "
+           "main thread over the last second.\n# TYPE sqlitebench_latency_usec "
+           "summary\n");
+  static const double q[] = { 0.5, 0.9, 0.99, 0.999 };
+  for (int i = 0; i < 4; i++)
+    text_add(t, "sqlitebench_latency_usec{benchmark=\"%s\",quantile=\"%g\"} "
+             "%.3f\n", s.bench_, q[i], s.latency_[i]);
+  text_add(t, "sqlitebench_latency_usec_sum%s %.3f\n", labels, s.latency_sum_);
+  text_add(t, "sqlitebench_latency_usec_count%s %lld\n", labels,
+           (long long)s.latency_count_);
+  metric(t, "latency_max_usec", "gauge",
+         "Longest time between finished ops over the last second.",
+         labels, s.latency_max_);
+  metric(t, "wal_bytes", "gauge", "Size of the current database's WAL.", "",
+         (double)file_size(s.wal_path_));
+  metric(t, "checkpoints_total", "counter", "WAL checkpoints run.", "",
+         (double)load_acquire(&checkpoints_));
+  metric(t, "cache_hits_total", "counter", "Page cache hits of the main "
+         "connection.", "", (double)s.cache_hit_);
+  metric(t, "cache_misses_total", "counter", "Page cache misses of the main "
+         "connection.", "", (double)s.cache_miss_);
+  metric(t, "cache_hit_ratio", "gauge", "Page cache hit ratio of the main "
+         "connection.", "", s.cache_hit_ + s.cache_miss_ > 0 ?
+         (double)s.cache_hit_ / (s.cache_hit_ + s.cache_miss_) : 0.0);
+}
+
+/* Answer one request; whatever was asked, the answer is the metrics */
+static void serve(Socket c) {
+  char req[2048];
+  fd_set fds;
+  struct timeval tv;
+  size_t got = 0;
+
+  /* Read the request head, giving a slow client a second */
+  while (got < sizeof(req) - 1) {
+    FD_ZERO(&fds);
+    FD_SET(c, &fds);
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    if (select((int)c + 1, &fds, NULL, NULL, &tv) <= 0) break;
+    int n = recv(c, req + got, (int)(sizeof(req) - 1 - got), 0);
+    if (n <= 0) break;
+    got += n;
+    req[got] = 0;
+    if (strstr(req, "\r\n\r\n") != NULL || strstr(req, "\n\n") != NULL) break;
+  }
+
+  Text body;
+  char head[128];
+  body.size_ = 8192;
+  body.buf_ = (char*)malloc(body.size_);
+  body.len_ = 0;
+  body.buf_[0] = 0;
+  render(&body);
+  int n = snprintf(head, sizeof(head), "HTTP/1.0 200 OK\r\n"
+                   "Content-Type: text/plain; version=0.0.4\r\n"
+                   "Content-Length: %d\r\n\r\n", (int)body.len_);
+  /* A client gone away must not kill the run with SIGPIPE */
+  send(c, head, n, MSG_NOSIGNAL);
+  send(c, body.buf_, (int)body.len_, MSG_NOSIGNAL);
+  free(body.buf_);
+  close_socket(c);
+}
+
+static void server_main(void* arg) {
+  (void)arg;
+  while (!load_acquire(&stopping_)) {
+    fd_set fds;
+    struct timeval tv;
+    FD_ZERO(&fds);
+    FD_SET(listen_, &fds);
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    int ready = select((int)listen_ + 1, &fds, NULL, NULL, &tv);
+    if (now_seconds() - rate_time_ >= 1.0) sample_rate();
+    if (ready <= 0) continue;
+    Socket c = accept(listen_, NULL, NULL);
+    if (c != INVALID_SOCKET) serve(c);
+  }
+}
+
+/* Listen on "unix:PATH" or "[HOST:]PORT" (host 127.0.0.1 by default) */
+void metrics_start(const char* where) {
+  int status;
+
+#ifdef _WIN32
+  WSADATA wsa;
+  WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+  if (starts_with(where, "unix:")) {
+#ifdef _WIN32
+    fprintf(stderr, "metrics: no unix sockets on this platform\n");
+    exit(1);
+#else
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(where + 5) >= sizeof(addr.sun_path)) {
+      fprintf(stderr, "metrics: socket path too long '%s'\n", where + 5);
+      exit(1);
+    }
+    strcpy(addr.sun_path, where + 5);
+    strcpy(unix_path_, where + 5);
+    unlink(unix_path_);
+    listen_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    status = listen_ == INVALID_SOCKET ? -1 :
+             bind(listen_, (struct sockaddr*)&addr, sizeof(addr));
+#endif
+  } else {
+    struct sockaddr_in addr;
+    char host[64] = "127.0.0.1";
+    int port;
+    const char* colon = strrchr(where, ':');
+    if (colon != NULL && colon - where < (int)sizeof(host)) {
+      memcpy(host, where, colon - where);
+      host[colon - where] = 0;
+    }
+    if (sscanf(colon != NULL ? colon + 1 : where, "%d", &port) != 1 ||
+        port <= 0 || port > 65535) {
+      fprintf(stderr, "metrics: bad address '%s'\n", where);
+      exit(1);
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((unsigned short)port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+      fprintf(stderr, "metrics: bad address '%s'\n", where);
+      exit(1);
+    }
+    listen_ = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    if (listen_ != INVALID_SOCKET)
+      setsockopt(listen_, SOL_SOCKET, SO_REUSEADDR, (const char*)&one,
+                 sizeof(one));
+    status = listen_ == INVALID_SOCKET ? -1 :
+             bind(listen_, (struct sockaddr*)&addr, sizeof(addr));
+  }
+  if (status != 0 || listen(listen_, 16) != 0) {
+    fprintf(stderr, "metrics: cannot listen on '%s'\n", where);
+    exit(1);
+  }
+  sample_rate();
+  thread_create(&server_, server_main, NULL);
+}
+
+void metrics_stop(void) {
+  store_release(&stopping_, 1);
+  thread_join(server_);
+  close_socket(listen_);
+#ifndef _WIN32
+  if (unix_path_[0] != 0) unlink(unix_path_);
+#endif
+}
@@ -0,0 +1,373 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+#endif
+
+/*
+ * Page cache selected with --pcache=slab.
+ *
+ * Each cache keeps its pages in one contiguous slab (optionally backed by
+ * huge pages), finds them through an open-addressing table keyed by page
+ * number and evicts with CLOCK.  A slab holds nMax pages; it is extended
+ * by a further segment when xCachesize raises the limit, when SQLite
+ * insists on a page while every slot is pinned, or when the cache is not
+ * purgeable.  Slots are handed out from the mapping in order, so memory
+ * the cache never needed is never touched.
+ */
+
+#define kMaxSegments 64
+#define kNoSlot 0xffffffffu
+
+typedef struct PSlot {
+  sqlite3_pcache_page page_;    /* must be first: SQLite holds pointers */
+  unsigned pgno_;               /* 0 when the slot is free */
+  unsigned next_free_;
+  unsigned char pinned_;
+  unsigned char ref_;
+} PSlot;
+
+typedef struct PEntry {
+  unsigned pgno_;               /* 0 when empty */
+  unsigned slot_;
+} PEntry;
+
+typedef struct PCache {
+  int page_size_;
+  int extra_size_;
+  bool purgeable_;
+  unsigned max_;                /* from xCachesize */
+  size_t stride_;
+  int nseg_;
+  char* seg_[kMaxSegments];
+  unsigned seg_first_[kMaxSegments];    /* index of a segment's first slot */
+  size_t seg_mapped_[kMaxSegments];     /* as rounded up by slab_alloc() */
+  unsigned nslot_;              /* slots across all segments */
+  unsigned fresh_;              /* slots from here on were never used */
+  unsigned nused_;              /* slots holding a page */
+  unsigned npinned_;            /* of which pinned */
+  unsigned free_;               /* head of free slot list */
+  unsigned hand_;               /* CLOCK hand */
+  unsigned max_pgno_;           /* no page above this is cached */
+  PEntry* table_;
+  unsigned mask_;               /* table size - 1 */
+} PCache;
+
+static void* slab_alloc(size_t* size) {
+#ifdef _WIN32
+  void* p = NULL;
+  if (FLAGS_huge_pages) {
+    SIZE_T large = GetLargePageMinimum();
+    if (large > 0) {
+      *size = (*size + large - 1) & ~(large - 1);
+      p = VirtualAlloc(NULL, *size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                       PAGE_READWRITE);
+    }
+  }
+  if (p == NULL)
+    p = VirtualAlloc(NULL, *size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+  return p;
+#else
+  void* p = MAP_FAILED;
+  if (FLAGS_huge_pages) {
+#ifdef MAP_HUGETLB
+    size_t huge = *size + (2u << 20) - 1;
+    huge &= ~(size_t)((2u << 20) - 1);
+    p = mmap(NULL, huge, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) *size = huge;
+#endif
+  }
+  if (p == MAP_FAILED) {
+    p = mmap(NULL, *size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) return NULL;
+#ifdef MADV_HUGEPAGE
+    /* No hugetlbfs pages reserved: ask for transparent huge pages */
+    if (FLAGS_huge_pages) madvise(p, *size, MADV_HUGEPAGE);
+#endif
+  }
+  return p;
+#endif
+}
+
+static void slab_free(void* p, size_t size) {
+#ifdef _WIN32
+  VirtualFree(p, 0, MEM_RELEASE);
+#else
+  munmap(p, size);
+#endif
+}
+
+static PSlot* slot_at(PCache* c, unsigned i) {
+  int k = c->nseg_ - 1;
+  while (i < c->seg_first_[k]) k--;
+  return (PSlot*)(c->seg_[k] + (size_t)(i - c->seg_first_[k]) * c->stride_);
+}
+
+static unsigned hash_pgno(unsigned pgno) {
+  return pgno * 2654435761u;
+}
+
+static unsigned table_find(PCache* c, unsigned pgno) {
+  if (c->table_ == NULL) return kNoSlot;
+  for (unsigned h = hash_pgno(pgno) & c->mask_; ; h = (h + 1) & c->mask_) {
+    if (c->table_[h].pgno_ == pgno) return c->table_[h].slot_;
+    if (c->table_[h].pgno_ == 0) return kNoSlot;
+  }
+}
+
+static void table_insert(PCache* c, unsigned pgno, unsigned slot) {
+  unsigned h = hash_pgno(pgno) & c->mask_;
+  while (c->table_[h].pgno_ != 0) h = (h + 1) & c->mask_;
+  c->table_[h].pgno_ = pgno;
+  c->table_[h].slot_ = slot;
+  if (pgno > c->max_pgno_) c->max_pgno_ = pgno;
+}
+
+/* Linear-probing delete with backward shift, so no tombstones build up */
+static void table_remove(PCache* c, unsigned pgno) {
+  unsigned h = hash_pgno(pgno) & c->mask_;
+  while (c->table_[h].pgno_ != pgno) h = (h + 1) & c->mask_;
+  for (unsigned j = (h + 1) & c->mask_; c->table_[j].pgno_ != 0;
+       j = (j + 1) & c->mask_) {
+    unsigned home = hash_pgno(c->table_[j].pgno_) & c->mask_;
+    if (((j - home) & c->mask_) >= ((j - h) & c->mask_)) {
+      c->table_[h] = c->table_[j];
+      h = j;
+    }
+  }
+  c->table_[h].pgno_ = 0;
+}
+
+/* Add a segment of at least slots pages and keep the table under half
+ * full.  The mapping comes zeroed, so its slots read as free until
+ * slot_take() hands them out. */
+static bool cache_grow(PCache* c, unsigned slots) {
+  if (c->nseg_ == kMaxSegments) return false;
+  if (slots < 16) slots = 16;
+  if (slots > 0x7fffffffu - c->nslot_) return false;
+  size_t size = (size_t)slots * c->stride_;
+  char* seg = (char*)slab_alloc(&size);
+  if (seg == NULL) return false;
+
+  c->seg_[c->nseg_] = seg;
+  c->seg_first_[c->nseg_] = c->nslot_;
+  c->seg_mapped_[c->nseg_] = size;
+  c->nseg_++;
+  c->nslot_ += slots;
+
+  unsigned size_table = 16;
+  while (size_table < 2 * c->nslot_) size_table *= 2;
+  if (size_table - 1 != c->mask_) {
+    PEntry* old = c->table_;
+    unsigned old_size = old == NULL ? 0 : c->mask_ + 1;
+    c->table_ = (PEntry*)calloc(size_table, sizeof(PEntry));
+    c->mask_ = size_table - 1;
+    for (unsigned i = 0; i < old_size; i++) {
+      if (old[i].pgno_ != 0) table_insert(c, old[i].pgno_, old[i].slot_);
+    }
+    free(old);
+  }
+  return true;
+}
+
+/* A free slot, or kNoSlot when every slot holds a page */
+static unsigned slot_take(PCache* c) {
+  unsigned i = c->free_;
+  if (i != kNoSlot) {
+    c->free_ = slot_at(c, i)->next_free_;
+  } else if (c->fresh_ < c->nslot_) {
+    i = c->fresh_++;
+    PSlot* s = slot_at(c, i);
+    s->page_.pBuf = (char*)s + ((sizeof(PSlot) + 15) & ~15);
+    s->page_.pExtra = (char*)s->page_.pBuf + c->page_size_;
+  }
+  return i;
+}
+
+static void slot_discard(PCache* c, unsigned i) {
+  PSlot* s = slot_at(c, i);
+  table_remove(c, s->pgno_);
+  if (s->pinned_) c->npinned_--;
+  s->pgno_ = 0;
+  s->pinned_ = 0;
+  s->next_free_ = c->free_;
+  c->free_ = i;
+  c->nused_--;
+}
+
+/* CLOCK: clear reference bits until an unpinned, unreferenced page turns up */
+static bool clock_evict(PCache* c) {
+  for (unsigned n = 0; n < 2 * c->fresh_; n++) {
+    unsigned i = c->hand_;
+    c->hand_ = (c->hand_ + 1) % c->fresh_;
+    PSlot* s = slot_at(c, i);
+    if (s->pgno_ == 0 || s->pinned_) continue;
+    if (s->ref_) {
+      s->ref_ = 0;
+      continue;
+    }
+    slot_discard(c, i);
+    return true;
+  }
+  return false;
+}
+
+static int pcache_init(void* app) {
+  return SQLITE_OK;
+}
+
+static void pcache_shutdown(void* app) {
+}
+
+static sqlite3_pcache* pcache_create(int page_size, int extra_size,
+                                     int purgeable) {
+  PCache* c = (PCache*)calloc(1, sizeof(PCache));
+  if (c == NULL) return NULL;
+  c->page_size_ = page_size;
+  c->extra_size_ = extra_size;
+  c->purgeable_ = purgeable != 0;
+  c->max_ = 100;
+  c->stride_ = ((sizeof(PSlot) + 15) & ~15) + page_size + extra_size;
+  c->stride_ = (c->stride_ + 15) & ~15;
+  c->free_ = kNoSlot;
+  return (sqlite3_pcache*)c;
+}
+
+static void pcache_cachesize(sqlite3_pcache* p, int max) {
+  PCache* c = (PCache*)p;
+  c->max_ = max > 0 ? (unsigned)max : 1;
+  /* A raised limit gets its slots now rather than one page at a time */
+  if (c->nseg_ > 0 && c->max_ > c->nslot_) cache_grow(c, c->max_ - c->nslot_);
+  while (c->purgeable_ && c->nused_ > c->max_ && c->npinned_ < c->nused_) {
+    if (!clock_evict(c)) break;
+  }
+}
+
+static int pcache_pagecount(sqlite3_pcache* p) {
+  return (int)((PCache*)p)->nused_;
+}
+
+static sqlite3_pcache_page* pcache_fetch(sqlite3_pcache* p, unsigned pgno,
+                                         int create) {
+  PCache* c = (PCache*)p;
+  unsigned i = table_find(c, pgno);
+  if (i != kNoSlot) {
+    PSlot* s = slot_at(c, i);
+    if (!s->pinned_) c->npinned_++;
+    s->pinned_ = 1;
+    s->ref_ = 1;
+    return &s->page_;
+  }
+  if (create == 0) return NULL;
+
+  /* The first segment is sized to the cache limit at first use */
+  if (c->nseg_ == 0 && !cache_grow(c, c->max_)) return NULL;
+
+  /* An evicted slot goes back on the free list, so always pop from there */
+  if (c->nused_ >= c->max_ && c->purgeable_ && c->npinned_ < c->nused_)
+    clock_evict(c);
+  i = slot_take(c);
+  if (i == kNoSlot &&
+      (create == 2 || !c->purgeable_ || c->nslot_ < c->max_)) {
+    /* Out of segments or memory, a purgeable cache still has unpinned
+     * pages to give up even under its limit */
+    unsigned grow = c->max_ > c->nslot_ ? c->max_ - c->nslot_ : c->nslot_ / 4;
+    if (cache_grow(c, grow) || (c->purgeable_ && clock_evict(c)))
+      i = slot_take(c);
+  }
+  if (i == kNoSlot) return NULL;
+
+  PSlot* s = slot_at(c, i);
+  s->pgno_ = pgno;
+  s->pinned_ = 1;
+  s->ref_ = 1;
+  memset(s->page_.pExtra, 0, c->extra_size_);
+  table_insert(c, pgno, i);
+  c->nused_++;
+  c->npinned_++;
+  return &s->page_;
+}
+
+static unsigned slot_index(PCache* c, sqlite3_pcache_page* page) {
+  return table_find(c, ((PSlot*)page)->pgno_);
+}
+
+static void pcache_unpin(sqlite3_pcache* p, sqlite3_pcache_page* page,
+                         int discard) {
+  PCache* c = (PCache*)p;
+  PSlot* s = (PSlot*)page;
+  if (discard || (c->purgeable_ && c->nused_ > c->max_)) {
+    slot_discard(c, slot_index(c, page));
+  } else {
+    s->pinned_ = 0;
+    c->npinned_--;
+  }
+}
+
+static void pcache_rekey(sqlite3_pcache* p, sqlite3_pcache_page* page,
+                         unsigned old_pgno, unsigned new_pgno) {
+  PCache* c = (PCache*)p;
+  unsigned i = slot_index(c, page);
+  unsigned other = table_find(c, new_pgno);
+  if (other != kNoSlot) slot_discard(c, other);
+  table_remove(c, old_pgno);
+  slot_at(c, i)->pgno_ = new_pgno;
+  table_insert(c, new_pgno, i);
+}
+
+static void pcache_truncate(sqlite3_pcache* p, unsigned limit) {
+  PCache* c = (PCache*)p;
+  /* The pager truncates at every commit, almost always past the end */
+  if (limit > c->max_pgno_) return;
+  c->max_pgno_ = limit - 1;
+  for (unsigned i = 0; i < c->fresh_; i++) {
+    unsigned pgno = slot_at(c, i)->pgno_;
+    if (pgno != 0 && pgno >= limit) slot_discard(c, i);
+  }
+}
+
+static void pcache_destroy(sqlite3_pcache* p) {
+  PCache* c = (PCache*)p;
+  for (int i = 0; i < c->nseg_; i++) {
+    slab_free(c->seg_[i], c->seg_mapped_[i]);
+  }
+  free(c->table_);
+  free(c);
+}
+
+static void pcache_shrink(sqlite3_pcache* p) {
+  /* Slab memory is held until the cache is destroyed */
+}
+
+static const sqlite3_pcache_methods2 slab_methods = {
+  1, NULL,
+  pcache_init, pcache_shutdown, pcache_create, pcache_cachesize,
+  pcache_pagecount, pcache_fetch, pcache_unpin, pcache_rekey,
+  pcache_truncate, pcache_destroy, pcache_shrink
+};
+
+/* Must run before sqlite3_initialize() */
+void pcache_install(const char* name) {
+  if (!strcmp(name, "slab")) {
+    int status = sqlite3_config(SQLITE_CONFIG_PCACHE2, &slab_methods);
+    if (status != SQLITE_OK) {
+      fprintf(stderr, "pcache %s: sqlite3_config failed: status = %d\n",
+              name, status);
+      exit(1);
+    }
+  } else if (strcmp(name, "pcache1") != 0) {
+    fprintf(stderr, "unknown pcache '%s'\n", name);
+    exit(1);
+  }
+}
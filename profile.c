@@ -0,0 +1,201 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+/*
+ * Per-statement profile for --stmt_profile.  Statements are told apart by
+ * their SQL text, so the same statement prepared on several connections
+ * adds up to one line.  Each run is timed from its SQLITE_TRACE_STMT event
+ * to its SQLITE_TRACE_PROFILE event with now_seconds(); the time SQLite
+ * reports itself is only as fine as the VFS clock, milliseconds on unix.
+ * The sqlite3_stmt_status() counters are read and reset after every run.
+ * Query plans are looked up by profile_print() on the benchmark's own
+ * connection, never from the trace callback of a statement still running.
+ */
+
+#define kMaxStatements 64
+#define kMaxRunning 256
+
+typedef struct StmtProfile {
+  char* sql_;
+  bool want_plan_;        /* reads or writes tables */
+  bool plan_printed_;     /* EXPLAIN QUERY PLAN, shown once */
+  int64_t calls_;
+  double time_;
+  double max_;
+  int64_t vm_step_;
+  int64_t fullscan_step_;
+  int64_t sort_;
+  int64_t autoindex_;
+  int64_t reprepare_;
+  int memused_;
+} StmtProfile;
+
+/* Start time of a statement between its STMT and PROFILE events */
+typedef struct Running {
+  sqlite3_stmt* stmt_;
+  double start_;
+} Running;
+
+static StmtProfile stmts_[kMaxStatements];
+static int nstmts_;
+static Running running_[kMaxRunning];
+
+/* Not cached: mutexmatrix shuts SQLite down and initializes it again */
+static sqlite3_mutex* profile_mutex(void) {
+  return sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP2);
+}
+
+static unsigned running_slot(sqlite3_stmt* stmt) {
+  return (unsigned)(((uintptr_t)stmt >> 4) * 2654435761u) % kMaxRunning;
+}
+
+void profile_begin(sqlite3_stmt* stmt, const char* sql) {
+  /* Trigger programs report "-- comment" text within a running statement */
+  if (strncmp(sql, "--", 2) == 0 || starts_with(sql, "EXPLAIN")) return;
+  sqlite3_mutex_enter(profile_mutex());
+  unsigned i = running_slot(stmt);
+  for (int n = 0; n < kMaxRunning; n++, i = (i + 1) % kMaxRunning) {
+    if (running_[i].stmt_ == NULL || running_[i].stmt_ == stmt) {
+      running_[i].stmt_ = stmt;
+      running_[i].start_ = now_seconds();
+      break;
+    }
+  }
+  sqlite3_mutex_leave(profile_mutex());
+}
+
+/* Only statements that read or write tables have a query plan worth showing */
+static bool has_plan(const char* sql) {
+  while (isspace((unsigned char)*sql)) sql++;
+  return starts_with(sql, "SELECT") || starts_with(sql, "INSERT") ||
+         starts_with(sql, "REPLACE") || starts_with(sql, "UPDATE") ||
+         starts_with(sql, "DELETE") || starts_with(sql, "WITH");
+}
+
+/* NULL if db cannot prepare the statement, e.g. it names a shard schema */
+static char* explain_plan(sqlite3* db, const char* stmt_sql) {
+  sqlite3_stmt* eqp;
+  char* sql = sqlite3_mprintf("EXPLAIN QUERY PLAN %s", stmt_sql);
+  char* plan = NULL;
+  if (sqlite3_prepare_v2(db, sql, -1, &eqp, NULL) == SQLITE_OK) {
+    while (sqlite3_step(eqp) == SQLITE_ROW) {
+      const char* detail = (const char*)sqlite3_column_text(eqp, 3);
+      char* next = plan == NULL ? sqlite3_mprintf("%s", detail) :
+                   sqlite3_mprintf("%s; %s", plan, detail);
+      sqlite3_free(plan);
+      plan = next;
+    }
+    sqlite3_finalize(eqp);
+  }
+  sqlite3_free(sql);
+  return plan;
+}
+
+/* Linear-probing delete: shift later entries back into the hole */
+static void running_remove(unsigned i) {
+  unsigned j = i;
+  running_[i].stmt_ = NULL;
+  for (;;) {
+    j = (j + 1) % kMaxRunning;
+    if (running_[j].stmt_ == NULL) return;
+    unsigned home = running_slot(running_[j].stmt_);
+    if ((i < j) ? (home > i && home <= j) : (home > i || home <= j)) continue;
+    running_[i] = running_[j];
+    running_[j].stmt_ = NULL;
+    i = j;
+  }
+}
+
+void profile_end(sqlite3_stmt* stmt, int64_t nsec) {
+  const char* sql = sqlite3_sql(stmt);
+  double seconds = nsec * 1e-9;
+
+  if (sql == NULL || starts_with(sql, "EXPLAIN")) return;
+  int vm_step = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_VM_STEP, 1);
+  int fullscan = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+  int sort = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_SORT, 1);
+  int autoindex = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_AUTOINDEX, 1);
+  int reprepare = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_REPREPARE, 1);
+  int memused = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_MEMUSED, 0);
+
+  sqlite3_mutex_enter(profile_mutex());
+  unsigned i = running_slot(stmt);
+  for (int n = 0; n < kMaxRunning; n++, i = (i + 1) % kMaxRunning) {
+    if (running_[i].stmt_ == NULL) break;
+    if (running_[i].stmt_ == stmt) {
+      seconds = now_seconds() - running_[i].start_;
+      running_remove(i);
+      break;
+    }
+  }
+
+  StmtProfile* p = NULL;
+  for (int k = 0; k < nstmts_; k++) {
+    if (!strcmp(stmts_[k].sql_, sql)) {
+      p = &stmts_[k];
+      break;
+    }
+  }
+  if (p == NULL && nstmts_ < kMaxStatements) {
+    p = &stmts_[nstmts_++];
+    memset(p, 0, sizeof(*p));
+    p->sql_ = (char*)malloc(strlen(sql) + 1);
+    strcpy(p->sql_, sql);
+    p->want_plan_ = has_plan(sql);
+  }
+  if (p != NULL) {
+    p->calls_++;
+    p->time_ += seconds;
+    if (seconds > p->max_) p->max_ = seconds;
+    p->vm_step_ += vm_step;
+    p->fullscan_step_ += fullscan;
+    p->sort_ += sort;
+    p->autoindex_ += autoindex;
+    p->reprepare_ += reprepare;
+    if (memused > p->memused_) p->memused_ = memused;
+  }
+  sqlite3_mutex_leave(profile_mutex());
+}
+
+/*
+ * Print the statements run since the last call and clear their counters;
+ * plans not shown yet are explained on db, which may be NULL.
+ */
+void profile_print(sqlite3* db) {
+  double total = 0;
+  for (int k = 0; k < nstmts_; k++) total += stmts_[k].time_;
+  if (total <= 0) return;
+
+  fprintf(stdout, "Statements:\n");
+  for (int k = 0; k < nstmts_; k++) {
+    StmtProfile* p = &stmts_[k];
+    if (p->calls_ == 0) continue;
+    fprintf(stdout, "  %s\n", p->sql_);
+    fprintf(stdout,
+            "    %lld calls %.3f usec/call (max %.1f) %.1f%% "
+            "vm_step %.1f fullscan %lld sort %lld autoindex %lld "
+            "reprepare %lld memused %d\n",
+            (long long)p->calls_, p->time_ * 1e6 / p->calls_, p->max_ * 1e6,
+            100.0 * p->time_ / total, (double)p->vm_step_ / p->calls_,
+            (long long)p->fullscan_step_, (long long)p->sort_,
+            (long long)p->autoindex_, (long long)p->reprepare_, p->memused_);
+    if (p->want_plan_ && !p->plan_printed_ && db != NULL) {
+      char* plan = explain_plan(db, p->sql_);
+      if (plan != NULL) fprintf(stdout, "    plan: %s\n", plan);
+      sqlite3_free(plan);
+      p->plan_printed_ = true;
+    }
+    p->calls_ = 0;
+    p->time_ = 0;
+    p->max_ = 0;
+    p->vm_step_ = 0;
+    p->fullscan_step_ = 0;
+    p->sort_ = 0;
+    p->autoindex_ = 0;
+    p->reprepare_ = 0;
+    p->memused_ = 0;
+  }
+}
@@ -66,14 +66,15 @@ size_t compressible_string(Random* rnd, double compressed_fraction,
 
 void rand_gen_init(RandomGenerator* gen_, double compression_ratio) {
   Random rnd;
-  gen_->data_ = (char*)malloc(sizeof(char) * 1048576);
+  /* Room for the last string and its terminator past 1 MB */
+  gen_->data_ = (char*)malloc(sizeof(char) * (1048576 + 101));
   gen_->data_size_ = 0;
   gen_->pos_ = 0;
   (gen_->data_)[0] = '\0';
 
   rand_init(&rnd, 301);
   while (gen_->data_size_ < 1048576) {
-	gen_->data_size_ += compressible_string(&rnd, compression_ratio, 100, gen_->data_ + gen_->pos_);
+	gen_->data_size_ += compressible_string(&rnd, compression_ratio, 100, gen_->data_ + gen_->data_size_);
   }
 }
 
@@ -86,3 +87,8 @@ char* rand_gen_generate(RandomGenerator* gen_, size_t len) {
   gen_->pos_ += len;
   return rstr;
 }
+
+void rand_gen_free(RandomGenerator* gen_) {
+  free(gen_->data_);
+  gen_->data_ = NULL;
+}
@@ -0,0 +1,118 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/*
+ * Bounded multi-producer single-consumer queue for the groupcommit
+ * benchmark (D. Vyukov's bounded queue).  Every cell carries a sequence
+ * number: a producer claims a position with a CAS on tail_ and publishes
+ * the cell by setting its sequence to pos + 1; the consumer takes it back
+ * and hands the cell to the next lap by setting pos + capacity.
+ */
+
+typedef struct RingCell {
+  volatile int64_t seq_;
+  RingItem item_;
+} RingCell;
+
+struct Ring {
+  /* Producer and consumer positions on separate cache lines */
+  volatile int64_t tail_;
+  char pad1_[56];
+  volatile int64_t head_;
+  char pad2_[56];
+  int64_t mask_;
+  RingCell* cells_;
+};
+
+#ifdef _WIN32
+/* x86 loads and stores already have acquire and release order */
+static inline int64_t load_acquire(volatile int64_t* p) {
+  int64_t v = *p;
+  _ReadWriteBarrier();
+  return v;
+}
+
+static inline void store_release(volatile int64_t* p, int64_t v) {
+  _ReadWriteBarrier();
+  *p = v;
+}
+
+static inline bool compare_swap(volatile int64_t* p, int64_t expect,
+                                int64_t desired) {
+  return InterlockedCompareExchange64(p, desired, expect) == expect;
+}
+#else
+static inline int64_t load_acquire(volatile int64_t* p) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_release(volatile int64_t* p, int64_t v) {
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static inline bool compare_swap(volatile int64_t* p, int64_t expect,
+                                int64_t desired) {
+  return __atomic_compare_exchange_n(p, &expect, desired, false,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+#endif
+
+/* capacity is rounded up to a power of two */
+Ring* ring_new(int capacity) {
+  Ring* r = (Ring*)calloc(1, sizeof(Ring));
+  int64_t n = 2;
+  while (n < capacity) n <<= 1;
+  r->mask_ = n - 1;
+  r->cells_ = (RingCell*)calloc((size_t)n, sizeof(RingCell));
+  for (int64_t i = 0; i < n; i++) r->cells_[i].seq_ = i;
+  return r;
+}
+
+void ring_free(Ring* r) {
+  free(r->cells_);
+  free(r);
+}
+
+/* False when the ring is full */
+bool ring_push(Ring* r, const RingItem* item) {
+  int64_t pos = load_acquire(&r->tail_);
+  for (;;) {
+    RingCell* cell = &r->cells_[pos & r->mask_];
+    int64_t dif = load_acquire(&cell->seq_) - pos;
+    if (dif == 0) {
+      if (compare_swap(&r->tail_, pos, pos + 1)) {
+        cell->item_ = *item;
+        store_release(&cell->seq_, pos + 1);
+        return true;
+      }
+      pos = load_acquire(&r->tail_);
+    } else if (dif < 0) {
+      return false;
+    } else {
+      pos = load_acquire(&r->tail_);
+    }
+  }
+}
+
+/* Consumer side; false when the next item is not yet published */
+bool ring_pop(Ring* r, RingItem* item) {
+  int64_t pos = r->head_;
+  RingCell* cell = &r->cells_[pos & r->mask_];
+  if (load_acquire(&cell->seq_) != pos + 1) return false;
+  *item = cell->item_;
+  store_release(&r->head_, pos + 1);
+  store_release(&cell->seq_, pos + r->mask_ + 1);
+  return true;
+}
+
+/* Items claimed by producers and not yet popped */
+int ring_depth(Ring* r) {
+  return (int)(load_acquire(&r->tail_) - load_acquire(&r->head_));
+}
@@ -0,0 +1,112 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/*
+ * Flight recorder of --slow_op_ms outliers: the last kSlowOps of the
+ * benchmark in a fixed ring, dumped by bench_stop().  Whichever thread
+ * finished the op claims a slot with an atomic add on next_ and fills it
+ * in, so recording never waits on a lock.  The dump runs once the threads
+ * of the benchmark are joined; two writers a full lap apart could only
+ * meet in one slot if kSlowOps outliers finished while one was written.
+ *
+ * Checkpoints (the WAL hook's and wal_checkpoint()'s) are counted here as
+ * well, so an op can tell whether one ran while it did.
+ */
+
+#define kSlowOps 64
+
+static SlowOp ops_[kSlowOps];
+static volatile int64_t next_;
+static volatile int64_t checkpoints_;   /* begun */
+static volatile int64_t running_;       /* begun and not yet ended */
+
+#ifdef _WIN32
+static inline int64_t load_acquire(volatile int64_t* p) {
+  int64_t v = *p;
+  _ReadWriteBarrier();
+  return v;
+}
+
+static inline int64_t fetch_add(volatile int64_t* p, int64_t n) {
+  return InterlockedExchangeAdd64(p, n);
+}
+#else
+static inline int64_t load_acquire(volatile int64_t* p) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline int64_t fetch_add(volatile int64_t* p, int64_t n) {
+  return __atomic_fetch_add(p, n, __ATOMIC_ACQ_REL);
+}
+#endif
+
+/* Only between benchmarks, with no other thread running */
+void slowlog_clear(void) {
+  next_ = 0;
+}
+
+void slowlog_add(const SlowOp* op) {
+  int64_t n = fetch_add(&next_, 1);
+  ops_[n & (kSlowOps - 1)] = *op;
+}
+
+void slowlog_checkpoint_begin(void) {
+  fetch_add(&checkpoints_, 1);
+  fetch_add(&running_, 1);
+}
+
+void slowlog_checkpoint_end(void) {
+  fetch_add(&running_, -1);
+}
+
+/* Whether a checkpoint began since *seen or is still running; moves *seen
+ * on to now */
+bool slowlog_checkpointed(int64_t* seen) {
+  int64_t begun = load_acquire(&checkpoints_);
+  bool ran = begun != *seen || load_acquire(&running_) > 0;
+  *seen = begun;
+  return ran;
+}
+
+/* The recorded outliers, oldest first */
+void slowlog_print(double threshold_ms) {
+  static const char* const type_name[] = {
+    "op", "read", "write", "delete", "scan"
+  };
+  int64_t n = load_acquire(&next_);
+  if (n == 0) return;
+
+  fprintf(stdout, "Slow ops over %.1f ms: %lld", threshold_ms, (long long)n);
+  if (n > kSlowOps) fprintf(stdout, ", the last %d", kSlowOps);
+  fprintf(stdout, "\n  %10s %9s %9s %-6s %20s %6s %8s  %s\n", "op", "at sec",
+          "ms", "type", "key", "thread", "wal", "during");
+  for (int64_t i = n > kSlowOps ? n - kSlowOps : 0; i < n; i++) {
+    const SlowOp* op = &ops_[i & (kSlowOps - 1)];
+    char key[24], thread[12];
+    if (op->key_ >= 0)
+      snprintf(key, sizeof(key), "%lld", (long long)op->key_);
+    else
+      strcpy(key, "-");
+    if (op->thread_ >= 0)
+      snprintf(thread, sizeof(thread), "%d", op->thread_);
+    else
+      strcpy(thread, "main");
+    fprintf(stdout, "  %10lld %9.3f %9.2f %-6s %20s %6s %8d  %s%s%s\n",
+            (long long)op->index_, op->time_, op->usec_ / 1e3,
+            type_name[op->type_ >= 0 && op->type_ <= TRACE_SCAN ?
+                      op->type_ : 0],
+            key, thread, op->wal_frames_,
+            (op->flags_ & SLOW_CHECKPOINT) ? "checkpoint" : "",
+            (op->flags_ & SLOW_CHECKPOINT) && (op->flags_ & SLOW_SPILL) ?
+                ", " : "",
+            (op->flags_ & SLOW_SPILL) ? "cache spill" :
+            (op->flags_ & SLOW_CHECKPOINT) ? "" : "-");
+  }
+}
@@ -0,0 +1,338 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Workload traces for the replay benchmark.
+ *
+ * A trace file is a TraceHeader followed by fixed-size TraceRecords, so a
+ * replay can map it and index it directly.  Records are produced from SQL
+ * text, either live through sqlite3_trace_v2() (trace_capture) or from a
+ * log of "<usec> <expanded sql>" lines written by an instrumented
+ * application (trace_import).  Only the statement shapes of a key/value
+ * table are understood: the key is the literal compared after WHERE, or
+ * the first one after VALUES; the value is the next VALUES literal or the
+ * first one after SET.
+ */
+
+#define kTraceMagic "SQLBTRC1"
+
+typedef struct TraceHeader {
+  char magic_[8];
+  uint64_t count_;
+} TraceHeader;
+
+struct TraceWriter {
+  FILE* file_;
+  uint64_t count_;
+  double last_;
+};
+
+TraceWriter* trace_writer_open(const char* path) {
+  TraceWriter* w = (TraceWriter*)calloc(1, sizeof(TraceWriter));
+  TraceHeader h;
+  w->file_ = fopen(path, "wb");
+  if (w->file_ == NULL) {
+    fprintf(stderr, "trace: cannot create '%s'\n", path);
+    exit(1);
+  }
+  setvbuf(w->file_, NULL, _IOFBF, 1 << 20);
+  memcpy(h.magic_, kTraceMagic, 8);
+  h.count_ = 0;
+  fwrite(&h, sizeof(h), 1, w->file_);
+  w->last_ = -1;
+  return w;
+}
+
+/* time is in seconds on any clock; only differences are recorded */
+void trace_writer_add(TraceWriter* w, int op, uint64_t key,
+                      uint32_t value_size, double time) {
+  TraceRecord r;
+  double delta = w->last_ < 0 ? 0 : (time - w->last_) * 1e6;
+  if (delta < 0) delta = 0;
+  if (delta > 4294967295.0) delta = 4294967295.0;
+  if (value_size > kTraceSizeMask) value_size = kTraceSizeMask;
+  r.op_size_ = ((uint32_t)op << 24) | value_size;
+  r.delta_us_ = (uint32_t)delta;
+  r.key_ = key;
+  fwrite(&r, sizeof(r), 1, w->file_);
+  w->count_++;
+  w->last_ = time;
+}
+
+uint64_t trace_writer_close(TraceWriter* w) {
+  TraceHeader h;
+  uint64_t count = w->count_;
+  memcpy(h.magic_, kTraceMagic, 8);
+  h.count_ = count;
+  fseek(w->file_, 0, SEEK_SET);
+  fwrite(&h, sizeof(h), 1, w->file_);
+  fclose(w->file_);
+  free(w);
+  return count;
+}
+
+/* SQL literal scanning */
+static const char* skip_space(const char* p) {
+  while (*p != 0 && isspace((unsigned char)*p)) p++;
+  return p;
+}
+
+static bool keyword_at(const char* p, const char* kw) {
+  size_t n = strlen(kw);
+#ifdef _WIN32
+  return _strnicmp(p, kw, n) == 0 && !isalnum((unsigned char)p[n]);
+#else
+  return strncasecmp(p, kw, n) == 0 && !isalnum((unsigned char)p[n]);
+#endif
+}
+
+/* Find keyword kw outside of string literals; returns the text after it */
+static const char* find_keyword(const char* p, const char* kw) {
+  char quote = 0, prev = ' ';
+  for (; *p != 0; prev = *p++) {
+    if (quote) {
+      if (*p == quote) quote = 0;
+    } else if (*p == '\'' || *p == '"') {
+      quote = *p;
+    } else if (!isalnum((unsigned char)prev) && keyword_at(p, kw)) {
+      return p + strlen(kw);
+    }
+  }
+  return NULL;
+}
+
+static int hex_digit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+/*
+ * Parse the next literal at or after p.  Integer literals and text or
+ * blobs of decimal digits give their number as the key, anything else its
+ * FNV-1a hash.  Returns the text after the literal, or NULL.
+ */
+static const char* next_literal(const char* p, uint64_t* key,
+                                uint32_t* size) {
+  char prev = ' ';
+  for (; *p != 0; prev = *p++) {
+    uint64_t num = 0, hash = 14695981039346656037ull;
+    bool digits = true;
+    uint32_t n = 0;
+
+    if ((*p == 'x' || *p == 'X') && p[1] == '\'') {
+      for (p += 2; hex_digit(p[0]) >= 0 && hex_digit(p[1]) >= 0; p += 2) {
+        unsigned char b = (unsigned char)(hex_digit(p[0]) * 16 + hex_digit(p[1]));
+        hash = (hash ^ b) * 1099511628211ull;
+        if (b >= '0' && b <= '9') num = num * 10 + (b - '0'); else digits = false;
+        n++;
+      }
+    } else if (*p == '\'') {
+      for (p++; *p != 0 && !(p[0] == '\'' && p[1] != '\''); p++) {
+        if (p[0] == '\'') p++;
+        hash = (hash ^ (unsigned char)*p) * 1099511628211ull;
+        if (*p >= '0' && *p <= '9') num = num * 10 + (*p - '0'); else digits = false;
+        n++;
+      }
+    } else if ((*p >= '0' && *p <= '9') && !isalnum((unsigned char)prev) &&
+               prev != '_') {
+      *key = strtoull(p, (char**)&p, 10);
+      *size = 8;
+      return p;
+    } else if (keyword_at(p, "NULL") && !isalnum((unsigned char)prev)) {
+      *key = 0;
+      *size = 0;
+      return p + 4;
+    } else {
+      continue;
+    }
+    *key = (digits && n > 0) ? num : hash;
+    *size = n;
+    return *p == 0 ? p : p + 1;
+  }
+  return NULL;
+}
+
+/* Turn one statement into a record; false for statements we do not replay */
+bool trace_parse_sql(const char* sql, int* op, uint64_t* key,
+                     uint32_t* value_size) {
+  const char* p = skip_space(sql);
+  const char* where;
+  const char* values;
+  uint32_t size;
+
+  *key = 0;
+  *value_size = 0;
+  if (keyword_at(p, "SELECT")) {
+    where = find_keyword(p, "WHERE");
+    if (where == NULL || next_literal(where, key, &size) == NULL) {
+      /* Table scan: value_size carries the LIMIT, 0 for all rows */
+      const char* limit = find_keyword(p, "LIMIT");
+      uint64_t n = 0;
+      if (limit != NULL) next_literal(limit, &n, &size);
+      *op = TRACE_SCAN;
+      *value_size = (uint32_t)n;
+      return true;
+    }
+    *op = TRACE_READ;
+    return true;
+  }
+  if (keyword_at(p, "DELETE")) {
+    where = find_keyword(p, "WHERE");
+    if (where == NULL || next_literal(where, key, &size) == NULL) return false;
+    *op = TRACE_DELETE;
+    return true;
+  }
+  if (keyword_at(p, "UPDATE")) {
+    const char* set = find_keyword(p, "SET");
+    where = find_keyword(p, "WHERE");
+    if (set == NULL || where == NULL) return false;
+    uint64_t unused;
+    if (next_literal(set, &unused, value_size) == NULL) return false;
+    if (next_literal(where, key, &size) == NULL) return false;
+    *op = TRACE_WRITE;
+    return true;
+  }
+  if (keyword_at(p, "INSERT") || keyword_at(p, "REPLACE")) {
+    uint64_t unused;
+    values = find_keyword(p, "VALUES");
+    if (values == NULL) return false;
+    values = next_literal(values, key, &size);
+    if (values == NULL || next_literal(values, &unused, value_size) == NULL)
+      return false;
+    *op = TRACE_WRITE;
+    return true;
+  }
+  return false;
+}
+
+/* Record one SQLITE_TRACE_STMT event; sql is the unexpanded text */
+void trace_capture_stmt(TraceWriter* w, sqlite3_stmt* stmt, const char* sql) {
+  int op;
+  uint64_t key;
+  uint32_t value_size;
+
+  /* Trigger programs report "-- comment" text; they are part of a statement */
+  if (strncmp(sql, "--", 2) == 0) return;
+  char* expanded = sqlite3_expanded_sql(stmt);
+  if (expanded == NULL) return;
+  if (trace_parse_sql(expanded, &op, &key, &value_size))
+    trace_writer_add(w, op, key, value_size, now_seconds());
+  sqlite3_free(expanded);
+}
+
+static int capture_callback(unsigned type, void* ctx, void* p, void* x) {
+  if (type == SQLITE_TRACE_STMT)
+    trace_capture_stmt((TraceWriter*)ctx, (sqlite3_stmt*)p, (const char*)x);
+  return 0;
+}
+
+/* Record every statement db runs; for use in instrumented applications too */
+void trace_capture(sqlite3* db, TraceWriter* w) {
+  sqlite3_trace_v2(db, SQLITE_TRACE_STMT, capture_callback, w);
+}
+
+/*
+ * Convert a log with one statement per line, optionally prefixed by a
+ * timestamp in microseconds, e.g. as printed by a sqlite3_trace_v2()
+ * callback with sqlite3_expanded_sql().  Returns the number of records.
+ */
+uint64_t trace_import(const char* log, const char* path) {
+  FILE* in = fopen(log, "r");
+  if (in == NULL) {
+    fprintf(stderr, "trace: cannot open '%s'\n", log);
+    exit(1);
+  }
+
+  TraceWriter* w = trace_writer_open(path);
+  size_t cap = 1 << 16;
+  char* line = (char*)malloc(cap);
+  double time = 0;
+  while (fgets(line, (int)cap, in) != NULL) {
+    /* Grow for statements with large literals */
+    while (strchr(line, '\n') == NULL && !feof(in)) {
+      line = (char*)realloc(line, cap * 2);
+      if (fgets(line + cap - 1, (int)cap + 1, in) == NULL) break;
+      cap *= 2;
+    }
+    char* sql = line;
+    if (isdigit((unsigned char)*sql)) time = strtod(sql, &sql) * 1e-6;
+
+    int op;
+    uint64_t key;
+    uint32_t value_size;
+    if (trace_parse_sql(sql, &op, &key, &value_size))
+      trace_writer_add(w, op, key, value_size, time);
+  }
+  free(line);
+  fclose(in);
+  return trace_writer_close(w);
+}
+
+bool trace_map(Trace* trace, const char* path) {
+  size_t size;
+  void* map;
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) return false;
+  LARGE_INTEGER li;
+  GetFileSizeEx(file, &li);
+  size = (size_t)li.QuadPart;
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(file);
+  if (mapping == NULL) return false;
+  map = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);
+  if (map == NULL) return false;
+#else
+  struct stat st;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+  size = (size_t)st.st_size;
+  map = size < sizeof(TraceHeader) ? MAP_FAILED :
+        mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return false;
+  madvise(map, size, MADV_SEQUENTIAL);
+#endif
+
+  const TraceHeader* h = (const TraceHeader*)map;
+  trace->map_ = map;
+  trace->size_ = size;
+  trace->records_ = (const TraceRecord*)(h + 1);
+  trace->count_ = (size - sizeof(TraceHeader)) / sizeof(TraceRecord);
+  if (size < sizeof(TraceHeader) || memcmp(h->magic_, kTraceMagic, 8) != 0 ||
+      h->count_ > trace->count_) {
+    trace_unmap(trace);
+    return false;
+  }
+  trace->count_ = h->count_;
+  return true;
+}
+
+void trace_unmap(Trace* trace) {
+#ifdef _WIN32
+  UnmapViewOfFile(trace->map_);
+#else
+  munmap(trace->map_, trace->size_);
+#endif
+  trace->map_ = NULL;
+}
@@ -4,19 +4,298 @@
 
 #include "bench.h"
 
-static double pred = 0;
-static __int64 start = 0;
-double now_seconds() {
-	__int64 tick;
-	if(pred==0) {
-		QueryPerformanceFrequency((LARGE_INTEGER*)&tick);
-		pred = (double)tick;
-	}
-	QueryPerformanceCounter( (LARGE_INTEGER *)&tick);
-	if(start==0) {
-		start = tick;
-	}
-	return (tick-start)/pred;
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <cpuid.h>
+#endif
+
+/*
+ * Clock.  A reading is one counter read and a multiply: the counter's
+ * rate is calibrated once against the OS clock, so no division or system
+ * call is left on the per-op path.  The TSC is only used when it is
+ * invariant (same rate in every P-state and on every core).  Plain RDTSC
+ * rather than the ordered RDTSCP: it costs less, and the ops timed are
+ * far longer than the few instructions it may be reordered with.
+ */
+bool clock_tsc_;
+uint64_t clock_start_;
+double clock_tick_seconds_;
+
+uint64_t clock_os_ticks(void) {
+#ifdef _WIN32
+  LARGE_INTEGER t;
+  QueryPerformanceCounter(&t);
+  return (uint64_t)t.QuadPart;
+#else
+  struct timespec ts;
+#ifdef CLOCK_MONOTONIC_RAW
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#else
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static double os_tick_seconds(void) {
+#ifdef _WIN32
+  LARGE_INTEGER f;
+  QueryPerformanceFrequency(&f);
+  return 1.0 / (double)f.QuadPart;
+#else
+  return 1e-9;
+#endif
+}
+
+static bool has_invariant_tsc(void) {
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+  int r[4];
+  __cpuid(r, 0x80000000);
+  if ((unsigned)r[0] < 0x80000007) return false;
+  __cpuid(r, 0x80000007);
+  return (r[3] & (1 << 8)) != 0;                /* invariant TSC */
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+  unsigned a = 0, b = 0, c = 0, d = 0;
+  if (__get_cpuid_max(0x80000000, NULL) < 0x80000007) return false;
+  __get_cpuid(0x80000007, &a, &b, &c, &d);
+  return (d & (1u << 8)) != 0;
+#elif defined(__GNUC__) && defined(__aarch64__)
+  return true;                                  /* architected, fixed rate */
+#else
+  return false;
+#endif
+}
+
+/* Pick and calibrate the clock; call before anything reads it */
+void clock_init(void) {
+  clock_tsc_ = false;
+  clock_tick_seconds_ = os_tick_seconds();
+  if (has_invariant_tsc()) {
+    uint64_t os0 = clock_os_ticks(), os1;
+    clock_tsc_ = true;
+    uint64_t tsc0 = clock_ticks();
+    while (((os1 = clock_os_ticks()) - os0) * clock_tick_seconds_ < 0.01) {}
+    uint64_t tsc1 = clock_ticks();
+    clock_tick_seconds_ = (os1 - os0) * clock_tick_seconds_ /
+                          (double)(tsc1 - tsc0);
+  }
+  clock_start_ = clock_ticks();
+}
+
+/* Peak resident set size in bytes since start or the last reset_peak_rss() */
+int64_t peak_rss(void) {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS pmc;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return 0;
+  return (int64_t)pmc.PeakWorkingSetSize;
+#else
+  /* VmHWM honours clear_refs; ru_maxrss is for the whole process life */
+  char line[128];
+  long kb = -1;
+  FILE* f = fopen("/proc/self/status", "r");
+  if (f != NULL) {
+    while (fgets(line, sizeof(line), f) != NULL) {
+      if (sscanf(line, "VmHWM: %ld kB", &kb) == 1) break;
+    }
+    fclose(f);
+  }
+  if (kb < 0) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    kb = ru.ru_maxrss;
+  }
+  return (int64_t)kb * 1024;
+#endif
+}
+
+void reset_peak_rss(void) {
+#ifndef _WIN32
+  FILE* f = fopen("/proc/self/clear_refs", "w");
+  if (f != NULL) {
+    fputs("5", f);
+    fclose(f);
+  }
+#endif
+}
+
+/*
+ * RSS and peak RSS from /proc/self/status, the rest from getrusage() for
+ * all threads.  Windows counts all page faults as minor and has no
+ * context switch counts.
+ */
+void footprint_sample(Footprint* fp) {
+  memset(fp, 0, sizeof(*fp));
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS pmc;
+  FILETIME created, exited, kernel, user;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+    fp->rss_ = (int64_t)pmc.WorkingSetSize;
+    fp->peak_rss_ = (int64_t)pmc.PeakWorkingSetSize;
+    fp->minor_faults_ = pmc.PageFaultCount;
+  }
+  if (GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) {
+    /* 100 ns units */
+    fp->user_ = (((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime) * 1e-7;
+    fp->system_ = (((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) * 1e-7;
+  }
+#else
+  char line[128];
+  long kb;
+  struct rusage ru;
+  FILE* f = fopen("/proc/self/status", "r");
+  if (f != NULL) {
+    while (fgets(line, sizeof(line), f) != NULL) {
+      if (sscanf(line, "VmRSS: %ld kB", &kb) == 1) fp->rss_ = (int64_t)kb * 1024;
+      else if (sscanf(line, "VmHWM: %ld kB", &kb) == 1) fp->peak_rss_ = (int64_t)kb * 1024;
+    }
+    fclose(f);
+  }
+  getrusage(RUSAGE_SELF, &ru);
+  if (fp->peak_rss_ == 0) fp->peak_rss_ = (int64_t)ru.ru_maxrss * 1024;
+  fp->minor_faults_ = ru.ru_minflt;
+  fp->major_faults_ = ru.ru_majflt;
+  fp->voluntary_csw_ = ru.ru_nvcsw;
+  fp->involuntary_csw_ = ru.ru_nivcsw;
+  fp->user_ = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6;
+  fp->system_ = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+#endif
+}
+
+/*
+ * Drop a file's pages from the OS page cache; missing files are ignored.
+ * Dirty pages cannot be dropped, so they are written back first.  Windows
+ * has no per-file call, but opening a file unbuffered purges its cache.
+ */
+void drop_file_cache(const char* path) {
+#ifdef _WIN32
+  HANDLE h = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                         NULL, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, NULL);
+  if (h != INVALID_HANDLE_VALUE) CloseHandle(h);
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return;
+  fdatasync(fd);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+#endif
+}
+
+/* Size of a file in bytes, 0 if it does not exist */
+int64_t file_size(const char* path) {
+#ifdef _WIN32
+  WIN32_FILE_ATTRIBUTE_DATA attr;
+  if (!GetFileAttributesExA(path, GetFileExInfoStandard, &attr)) return 0;
+  return ((int64_t)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+#else
+  struct stat st;
+  if (stat(path, &st) != 0) return 0;
+  return (int64_t)st.st_size;
+#endif
+}
+
+/* Bytes of a file in the OS page cache, -1 where that cannot be told */
+int64_t file_cached(const char* path) {
+#ifdef _WIN32
+  (void)path;
+  return -1;
+#else
+  int64_t size = file_size(path);
+  if (size == 0) return 0;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return 0;
+  void* map = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return -1;
+  long page = sysconf(_SC_PAGESIZE);
+  size_t pages = (size_t)((size + page - 1) / page);
+  unsigned char* vec = (unsigned char*)malloc(pages);
+  int64_t cached = -1;
+  if (mincore(map, (size_t)size, vec) == 0) {
+    cached = 0;
+    for (size_t i = 0; i < pages; i++) cached += vec[i] & 1;
+    cached *= page;
+  }
+  free(vec);
+  munmap(map, (size_t)size);
+  return cached;
+#endif
+}
+
+/* Read a whole file to pull it into the OS page cache; returns bytes read */
+int64_t preload_file(const char* path) {
+  const size_t kChunk = 1 << 20;
+  FILE* f = fopen(path, "rb");
+  if (f == NULL) return 0;
+  char* buf = (char*)malloc(kChunk);
+  int64_t total = 0;
+  size_t n;
+  while ((n = fread(buf, 1, kChunk, f)) > 0) total += n;
+  free(buf);
+  fclose(f);
+  return total;
+}
+
+typedef struct ThreadStart {
+  ThreadFunc fn_;
+  void* arg_;
+} ThreadStart;
+
+#ifdef _WIN32
+static unsigned __stdcall thread_main(void* p) {
+#else
+static void* thread_main(void* p) {
+#endif
+  ThreadStart start = *(ThreadStart*)p;
+  free(p);
+  start.fn_(start.arg_);
+  return 0;
+}
+
+void thread_create(Thread* thread, ThreadFunc fn, void* arg) {
+  ThreadStart* start = (ThreadStart*)malloc(sizeof(ThreadStart));
+  start->fn_ = fn;
+  start->arg_ = arg;
+#ifdef _WIN32
+  *thread = (Thread)_beginthreadex(NULL, 0, thread_main, start, 0, NULL);
+  if (*thread == NULL) {
+#else
+  if (pthread_create(thread, NULL, thread_main, start) != 0) {
+#endif
+    fprintf(stderr, "cannot create thread\n");
+    exit(1);
+  }
+}
+
+void thread_join(Thread thread) {
+#ifdef _WIN32
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+#else
+  pthread_join(thread, NULL);
+#endif
+}
+
+/* Parse "1,2,4" into at most max values; returns the count or -1 */
+int parse_int_list(const char* s, int* values, int max) {
+  int n = 0;
+  while (*s != 0) {
+    char* end;
+    long v = strtol(s, &end, 10);
+    if (end == s || n == max || (*end != ',' && *end != 0)) return -1;
+    values[n++] = (int)v;
+    s = *end == ',' ? end + 1 : end;
+  }
+  return n;
 }
 
 /*
@@ -29,14 +308,13 @@ bool starts_with(const char* str, const char* pre) {
   return lenstr < lenpre ? false : !strncmp(pre, str, lenpre);
 }
 
-#if 0
 char* trim_space(char* s) {
   size_t start = 0;
-  while (start < strlen(s) && isspace(s[start])) {
+  while (start < strlen(s) && isspace((unsigned char)s[start])) {
     start++;
   }
   size_t limit = strlen(s);
-  while (limit > start && isspace(s[limit - 1])) {
+  while (limit > start && isspace((unsigned char)s[limit - 1])) {
     limit--;
   }
   
@@ -45,5 +323,4 @@ char* trim_space(char* s) {
   s[limit - start] = '\0';
 
   return s;
-}
-#endif
\ No newline at end of file
+}
\ No newline at end of file
@@ -0,0 +1,627 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifdef __linux__
+#define _GNU_SOURCE             /* O_DIRECT */
+#endif
+#include "bench.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+/*
+ * VFS selected with --vfs.  "unix" is SQLite's own, named only so the
+ * benchmarks report checkpoint times and OS cache use to compare against.
+ *
+ * "uring" is the unix VFS with its writes batched through io_uring.  The
+ * unix VFS's pwrite system call is replaced (xSetSystemCall) so a write
+ * made from xWrite is copied into the calling thread's ring instead of
+ * being made.  The queue goes to the kernel in one io_uring_enter() when
+ * it is full or when SQLite next needs the data on disk or visible: on
+ * xSync, as an IORING_OP_FSYNC draining the writes before it; on a read
+ * of a range still queued; and on any lock or shm change, which is where
+ * other connections could look.  A WAL commit is thus one submission for
+ * all of its frames and a checkpoint one per kUringDepth pages.
+ *
+ * A file synced through the ring no longer gets the unix VFS's one-time
+ * directory fsync after it is created.
+ */
+
+static volatile int64_t writes_;
+static volatile int64_t submits_;
+static volatile int64_t syncs_;
+
+void vfs_stats(VfsStats* s) {
+  s->writes_ = writes_;
+  s->submits_ = submits_;
+  s->syncs_ = syncs_;
+}
+
+#ifdef __linux__
+#define kUringDepth 64          /* writes queued before a submit */
+#define kUringEntries 128       /* ring size: the writes and a fsync */
+#define kUringSync kUringDepth  /* user_data of the fsync */
+
+typedef struct UringWrite {
+  int fd_;
+  int64_t offset_;
+  size_t size_;
+  size_t cap_;
+  char* buf_;                   /* copy of the data, SQLite reuses its own */
+} UringWrite;
+
+typedef struct Uring {
+  int fd_;
+  void* sq_map_;
+  size_t sq_map_size_;
+  void* cq_map_;
+  size_t cq_map_size_;
+  unsigned* sq_tail_;
+  unsigned* sq_array_;
+  unsigned sq_mask_;
+  unsigned tail_;
+  struct io_uring_sqe* sqes_;
+  size_t sqes_size_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned cq_mask_;
+  struct io_uring_cqe* cqes_;
+  unsigned queued_;             /* sqes since the last submit */
+  unsigned writes_;             /* of which writes, in write_[] */
+  UringWrite write_[kUringDepth];
+} Uring;
+
+typedef struct UringFile {
+  sqlite3_file base_;
+  int fd_;                      /* seen on the first write, -1 before */
+  sqlite3_file* real_;          /* the unix VFS's file, after this struct */
+} UringFile;
+
+static sqlite3_vfs* unix_;
+static sqlite3_vfs uring_vfs_;
+static pthread_key_t ring_key_;
+static ssize_t (*real_pwrite_)(int, const void*, size_t, off_t);
+static __thread UringFile* writing_;    /* file in xWrite on this thread */
+
+static Uring* ring_open(void) {
+  struct io_uring_params p;
+  Uring* r = (Uring*)calloc(1, sizeof(Uring));
+  memset(&p, 0, sizeof(p));
+  r->fd_ = (int)syscall(__NR_io_uring_setup, kUringEntries, &p);
+  if (r->fd_ < 0) {
+    fprintf(stderr, "vfs uring: io_uring_setup: %s\n", strerror(errno));
+    exit(1);
+  }
+  r->sq_map_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  r->cq_map_size_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  r->sq_map_ = mmap(NULL, r->sq_map_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, r->fd_, IORING_OFF_SQ_RING);
+  r->cq_map_ = mmap(NULL, r->cq_map_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, r->fd_, IORING_OFF_CQ_RING);
+  r->sqes_size_ = p.sq_entries * sizeof(struct io_uring_sqe);
+  r->sqes_ = (struct io_uring_sqe*)mmap(NULL, r->sqes_size_,
+                                        PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_POPULATE, r->fd_,
+                                        IORING_OFF_SQES);
+  if (r->sq_map_ == MAP_FAILED || r->cq_map_ == MAP_FAILED ||
+      r->sqes_ == MAP_FAILED) {
+    fprintf(stderr, "vfs uring: mmap: %s\n", strerror(errno));
+    exit(1);
+  }
+  r->sq_tail_ = (unsigned*)((char*)r->sq_map_ + p.sq_off.tail);
+  r->sq_array_ = (unsigned*)((char*)r->sq_map_ + p.sq_off.array);
+  r->sq_mask_ = *(unsigned*)((char*)r->sq_map_ + p.sq_off.ring_mask);
+  r->tail_ = *r->sq_tail_;
+  r->cq_head_ = (unsigned*)((char*)r->cq_map_ + p.cq_off.head);
+  r->cq_tail_ = (unsigned*)((char*)r->cq_map_ + p.cq_off.tail);
+  r->cq_mask_ = *(unsigned*)((char*)r->cq_map_ + p.cq_off.ring_mask);
+  r->cqes_ = (struct io_uring_cqe*)((char*)r->cq_map_ + p.cq_off.cqes);
+  return r;
+}
+
+static struct io_uring_sqe* ring_sqe(Uring* r) {
+  unsigned idx = r->tail_ & r->sq_mask_;
+  struct io_uring_sqe* sqe = &r->sqes_[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  r->sq_array_[idx] = idx;
+  r->tail_++;
+  r->queued_++;
+  return sqe;
+}
+
+/* Submit what is queued and wait for all of it; false if any of it failed */
+static bool ring_flush(Uring* r) {
+  unsigned n = r->queued_;
+  unsigned done = 0;
+  bool ok = true;
+  if (n == 0) return true;
+  __atomic_store_n(r->sq_tail_, r->tail_, __ATOMIC_RELEASE);
+  __atomic_fetch_add(&submits_, 1, __ATOMIC_RELAXED);
+  unsigned submit = n;
+  while (done < n) {
+    int ret = (int)syscall(__NR_io_uring_enter, r->fd_, submit, n - done,
+                           IORING_ENTER_GETEVENTS, NULL, 0);
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      fprintf(stderr, "vfs uring: io_uring_enter: %s\n", strerror(errno));
+      exit(1);
+    }
+    submit -= (unsigned)ret < submit ? (unsigned)ret : submit;
+    unsigned head = *r->cq_head_;
+    unsigned tail = __atomic_load_n(r->cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++, done++) {
+      struct io_uring_cqe* cqe = &r->cqes_[head & r->cq_mask_];
+      if (cqe->user_data == kUringSync) {
+        if (cqe->res < 0) ok = false;
+        continue;
+      }
+      UringWrite* w = &r->write_[cqe->user_data];
+      if (cqe->res < 0) {
+        ok = false;
+      } else if ((size_t)cqe->res < w->size_) {
+        /* Short write: finish it the ordinary way */
+        size_t got = (size_t)cqe->res;
+        if (real_pwrite_(w->fd_, w->buf_ + got, w->size_ - got,
+                         (off_t)(w->offset_ + got)) != (ssize_t)(w->size_ - got))
+          ok = false;
+      }
+    }
+    __atomic_store_n(r->cq_head_, head, __ATOMIC_RELEASE);
+  }
+  r->queued_ = 0;
+  r->writes_ = 0;
+  return ok;
+}
+
+static void ring_close(void* arg) {
+  Uring* r = (Uring*)arg;
+  ring_flush(r);
+  munmap(r->sqes_, r->sqes_size_);
+  munmap(r->cq_map_, r->cq_map_size_);
+  munmap(r->sq_map_, r->sq_map_size_);
+  close(r->fd_);
+  for (int i = 0; i < kUringDepth; i++) free(r->write_[i].buf_);
+  free(r);
+}
+
+/* The ring of this thread, or NULL if it has none and create is false */
+static Uring* ring_get(bool create) {
+  Uring* r = (Uring*)pthread_getspecific(ring_key_);
+  if (r == NULL && create) {
+    r = ring_open();
+    pthread_setspecific(ring_key_, r);
+  }
+  return r;
+}
+
+/* A forked child (--processes) leaves the parent's ring alone */
+static void ring_forget(void) {
+  pthread_setspecific(ring_key_, NULL);
+}
+
+/* Whether a write to fd over [offset, offset + size) is queued (any when
+   fd is negative, any range when size is negative) */
+static bool ring_has(Uring* r, int fd, int64_t offset, int64_t size) {
+  if (r == NULL || r->queued_ == 0) return false;
+  if (fd < 0) return true;
+  for (unsigned i = 0; i < r->writes_; i++) {
+    UringWrite* w = &r->write_[i];
+    if (w->fd_ == fd && (size < 0 || (w->offset_ < offset + size &&
+                                      offset < w->offset_ + (int64_t)w->size_)))
+      return true;
+  }
+  return false;
+}
+
+static int flush(void) {
+  Uring* r = ring_get(false);
+  if (r == NULL) return SQLITE_OK;
+  return ring_flush(r) ? SQLITE_OK : SQLITE_IOERR_WRITE;
+}
+
+static int flush_if(UringFile* f, int64_t offset, int64_t size) {
+  Uring* r = ring_get(false);
+  if (!ring_has(r, f->fd_, offset, size)) return SQLITE_OK;
+  return ring_flush(r) ? SQLITE_OK : SQLITE_IOERR_WRITE;
+}
+
+/* The unix VFS's pwrite: queue the writes of xWrite, make any other */
+static ssize_t uring_pwrite(int fd, const void* buf, size_t n, off_t offset) {
+  UringFile* f = writing_;
+  if (f == NULL) return real_pwrite_(fd, buf, n, offset);
+  Uring* r = ring_get(true);
+  if (r->writes_ == kUringDepth && !ring_flush(r)) {
+    errno = EIO;
+    return -1;
+  }
+  UringWrite* w = &r->write_[r->writes_];
+  if (w->cap_ < n) {
+    free(w->buf_);
+    w->cap_ = n;
+    w->buf_ = (char*)malloc(n);
+  }
+  memcpy(w->buf_, buf, n);
+  w->fd_ = fd;
+  w->offset_ = offset;
+  w->size_ = n;
+  struct io_uring_sqe* sqe = ring_sqe(r);
+  sqe->opcode = IORING_OP_WRITE;
+  sqe->fd = fd;
+  sqe->off = (uint64_t)offset;
+  sqe->addr = (uint64_t)(uintptr_t)w->buf_;
+  sqe->len = (unsigned)n;
+  sqe->user_data = r->writes_++;
+  f->fd_ = fd;
+  __atomic_fetch_add(&writes_, 1, __ATOMIC_RELAXED);
+  return (ssize_t)n;
+}
+
+static int uring_close(sqlite3_file* file) {
+  UringFile* f = (UringFile*)file;
+  int rc = flush();
+  int rc2 = f->real_->pMethods->xClose(f->real_);
+  return rc != SQLITE_OK ? rc : rc2;
+}
+
+static int uring_read(sqlite3_file* file, void* buf, int amt, sqlite3_int64 off) {
+  UringFile* f = (UringFile*)file;
+  int rc = flush_if(f, off, amt);
+  return rc != SQLITE_OK ? rc : f->real_->pMethods->xRead(f->real_, buf, amt, off);
+}
+
+static int uring_write(sqlite3_file* file, const void* buf, int amt,
+                       sqlite3_int64 off) {
+  UringFile* f = (UringFile*)file;
+  writing_ = f;
+  int rc = f->real_->pMethods->xWrite(f->real_, buf, amt, off);
+  writing_ = NULL;
+  return rc;
+}
+
+static int uring_truncate(sqlite3_file* file, sqlite3_int64 size) {
+  UringFile* f = (UringFile*)file;
+  int rc = flush();
+  return rc != SQLITE_OK ? rc : f->real_->pMethods->xTruncate(f->real_, size);
+}
+
+static int uring_sync(sqlite3_file* file, int flags) {
+  UringFile* f = (UringFile*)file;
+  if (f->fd_ < 0) {
+    int rc = flush();
+    return rc != SQLITE_OK ? rc : f->real_->pMethods->xSync(f->real_, flags);
+  }
+  /* DRAIN: the fsync starts once every write queued before it is done */
+  Uring* r = ring_get(true);
+  struct io_uring_sqe* sqe = ring_sqe(r);
+  sqe->opcode = IORING_OP_FSYNC;
+  sqe->fd = f->fd_;
+  sqe->flags = IOSQE_IO_DRAIN;
+  sqe->fsync_flags = (flags & SQLITE_SYNC_DATAONLY) ? IORING_FSYNC_DATASYNC : 0;
+  sqe->user_data = kUringSync;
+  __atomic_fetch_add(&syncs_, 1, __ATOMIC_RELAXED);
+  return ring_flush(r) ? SQLITE_OK : SQLITE_IOERR_FSYNC;
+}
+
+static int uring_file_size(sqlite3_file* file, sqlite3_int64* size) {
+  UringFile* f = (UringFile*)file;
+  int rc = flush_if(f, 0, -1);
+  return rc != SQLITE_OK ? rc : f->real_->pMethods->xFileSize(f->real_, size);
+}
+
+static int uring_lock(sqlite3_file* file, int lock) {
+  UringFile* f = (UringFile*)file;
+  int rc = flush();
+  return rc != SQLITE_OK ? rc : f->real_->pMethods->xLock(f->real_, lock);
+}
+
+static int uring_unlock(sqlite3_file* file, int lock) {
+  UringFile* f = (UringFile*)file;
+  int rc = flush();
+  return rc != SQLITE_OK ? rc : f->real_->pMethods->xUnlock(f->real_, lock);
+}
+
+static int uring_check_reserved(sqlite3_file* file, int* out) {
+  UringFile* f = (UringFile*)file;
+  return f->real_->pMethods->xCheckReservedLock(f->real_, out);
+}
+
+static int uring_file_control(sqlite3_file* file, int op, void* arg) {
+  UringFile* f = (UringFile*)file;
+  int rc = flush();
+  return rc != SQLITE_OK ? rc :
+         f->real_->pMethods->xFileControl(f->real_, op, arg);
+}
+
+static int uring_sector_size(sqlite3_file* file) {
+  UringFile* f = (UringFile*)file;
+  return f->real_->pMethods->xSectorSize(f->real_);
+}
+
+static int uring_device_characteristics(sqlite3_file* file) {
+  UringFile* f = (UringFile*)file;
+  return f->real_->pMethods->xDeviceCharacteristics(f->real_);
+}
+
+static int uring_shm_map(sqlite3_file* file, int page, int size, int extend,
+                         void volatile** p) {
+  UringFile* f = (UringFile*)file;
+  return f->real_->pMethods->xShmMap(f->real_, page, size, extend, p);
+}
+
+static int uring_shm_lock(sqlite3_file* file, int offset, int n, int flags) {
+  UringFile* f = (UringFile*)file;
+  int rc = flush();
+  return rc != SQLITE_OK ? rc :
+         f->real_->pMethods->xShmLock(f->real_, offset, n, flags);
+}
+
+static void uring_shm_barrier(sqlite3_file* file) {
+  UringFile* f = (UringFile*)file;
+  flush();
+  f->real_->pMethods->xShmBarrier(f->real_);
+}
+
+static int uring_shm_unmap(sqlite3_file* file, int del) {
+  UringFile* f = (UringFile*)file;
+  return f->real_->pMethods->xShmUnmap(f->real_, del);
+}
+
+static int uring_fetch(sqlite3_file* file, sqlite3_int64 off, int amt,
+                       void** p) {
+  UringFile* f = (UringFile*)file;
+  int rc = flush_if(f, off, amt);
+  return rc != SQLITE_OK ? rc :
+         f->real_->pMethods->xFetch(f->real_, off, amt, p);
+}
+
+static int uring_unfetch(sqlite3_file* file, sqlite3_int64 off, void* p) {
+  UringFile* f = (UringFile*)file;
+  return f->real_->pMethods->xUnfetch(f->real_, off, p);
+}
+
+static const sqlite3_io_methods uring_io_ = {
+  3,
+  uring_close,
+  uring_read,
+  uring_write,
+  uring_truncate,
+  uring_sync,
+  uring_file_size,
+  uring_lock,
+  uring_unlock,
+  uring_check_reserved,
+  uring_file_control,
+  uring_sector_size,
+  uring_device_characteristics,
+  uring_shm_map,
+  uring_shm_lock,
+  uring_shm_barrier,
+  uring_shm_unmap,
+  uring_fetch,
+  uring_unfetch
+};
+
+static int uring_open(sqlite3_vfs* vfs, const char* name, sqlite3_file* file,
+                      int flags, int* out_flags) {
+  UringFile* f = (UringFile*)file;
+  (void)vfs;
+  f->fd_ = -1;
+  f->real_ = (sqlite3_file*)&f[1];
+  int rc = unix_->xOpen(unix_, name, f->real_, flags, out_flags);
+  f->base_.pMethods = rc == SQLITE_OK ? &uring_io_ : NULL;
+  return rc;
+}
+
+/*
+ * Replace the unix VFS's system call name, or its 64-bit twin that builds
+ * with large file support use instead, by fn; returns the original.
+ */
+static sqlite3_syscall_ptr replace_call(const char* name,
+                                        sqlite3_syscall_ptr fn) {
+  char name64[32];
+  snprintf(name64, sizeof(name64), "%s64", name);
+  if (unix_ == NULL) unix_ = sqlite3_vfs_find("unix");
+  if (unix_->xGetSystemCall(unix_, name64) != NULL) name = name64;
+  sqlite3_syscall_ptr real = unix_->xGetSystemCall(unix_, name);
+  if (real == NULL || unix_->xSetSystemCall(unix_, name, fn) != SQLITE_OK) {
+    fprintf(stderr, "vfs: cannot replace the unix VFS's %s\n", name);
+    exit(1);
+  }
+  return real;
+}
+
+static void uring_install(void) {
+  if (uring_vfs_.zName == NULL) {
+    real_pwrite_ = (ssize_t (*)(int, const void*, size_t, off_t))
+                   replace_call("pwrite", (sqlite3_syscall_ptr)uring_pwrite);
+    pthread_key_create(&ring_key_, ring_close);
+    pthread_atfork(NULL, NULL, ring_forget);
+    ring_close(ring_open());    /* fail now if io_uring is unavailable */
+    uring_vfs_ = *unix_;
+    uring_vfs_.zName = "uring";
+    uring_vfs_.szOsFile = (int)sizeof(UringFile) + unix_->szOsFile;
+    uring_vfs_.xOpen = uring_open;
+    uring_vfs_.pNext = NULL;
+  }
+  sqlite3_vfs_register(&uring_vfs_, 1);
+}
+
+/*
+ * "direct" opens database and WAL files with O_DIRECT, leaving SQLite's
+ * page cache (--num_pages) the only cache of their pages.  The unix VFS's
+ * open gets O_DIRECT added while direct_open() opens one of those files;
+ * reads and writes on such a descriptor go through a per-thread buffer
+ * aligned to kDirectAlign, since SQLite's buffers are not and neither are
+ * WAL frames (a 24-byte header and a page) or the 100-byte header read.
+ * A write that does not cover whole blocks reads the blocks at its edges
+ * first, and puts back the end of file if it lay in one of them.
+ */
+#define kDirectAlign 4096
+#define kDirectFds 65536
+
+static sqlite3_vfs direct_vfs_;
+static int (*real_open_)(const char*, int, int);
+static int (*real_close_)(int);
+static ssize_t (*real_pread_)(int, void*, size_t, off_t);
+static ssize_t (*real_dpwrite_)(int, const void*, size_t, off_t);
+static unsigned char direct_fd_[kDirectFds];
+static pthread_key_t bounce_key_;
+static __thread bool opening_;          /* in direct_open() on this thread */
+
+typedef struct Bounce {
+  char* buf_;
+  size_t size_;
+} Bounce;
+
+static void bounce_free(void* arg) {
+  Bounce* b = (Bounce*)arg;
+  free(b->buf_);
+  free(b);
+}
+
+static char* bounce(size_t size) {
+  Bounce* b = (Bounce*)pthread_getspecific(bounce_key_);
+  if (b == NULL) {
+    b = (Bounce*)calloc(1, sizeof(Bounce));
+    pthread_setspecific(bounce_key_, b);
+  }
+  if (b->size_ < size) {
+    free(b->buf_);
+    b->size_ = size > 16 * kDirectAlign ? size : 16 * kDirectAlign;
+    if (posix_memalign((void**)&b->buf_, kDirectAlign, b->size_) != 0) {
+      fprintf(stderr, "vfs direct: out of memory\n");
+      exit(1);
+    }
+  }
+  return b->buf_;
+}
+
+static bool aligned(const void* buf, size_t n, off_t off) {
+  return (((uintptr_t)buf | (uintptr_t)n | (uintptr_t)off) &
+          (kDirectAlign - 1)) == 0;
+}
+
+static int direct_open_call(const char* path, int flags, int mode) {
+  if (!opening_) return real_open_(path, flags, mode);
+  int fd = real_open_(path, flags | O_DIRECT, mode);
+  if (fd < 0 && errno == EINVAL) {
+    fprintf(stderr, "vfs direct: no O_DIRECT for %s\n", path);
+    exit(1);
+  }
+  if (fd >= kDirectFds) {
+    real_close_(fd);
+    return real_open_(path, flags, mode);
+  }
+  if (fd >= 0) direct_fd_[fd] = 1;
+  return fd;
+}
+
+static int direct_close(int fd) {
+  if (fd >= 0 && fd < kDirectFds) direct_fd_[fd] = 0;
+  return real_close_(fd);
+}
+
+static ssize_t direct_pread(int fd, void* buf, size_t n, off_t off) {
+  if (fd < 0 || fd >= kDirectFds || !direct_fd_[fd] || aligned(buf, n, off))
+    return real_pread_(fd, buf, n, off);
+  off_t start = off & ~(off_t)(kDirectAlign - 1);
+  off_t end = (off + (off_t)n + kDirectAlign - 1) & ~(off_t)(kDirectAlign - 1);
+  char* b = bounce((size_t)(end - start));
+  ssize_t got = real_pread_(fd, b, (size_t)(end - start), start);
+  if (got < 0) return got;
+  got -= off - start;
+  if (got < 0) got = 0;
+  if (got > (ssize_t)n) got = (ssize_t)n;
+  memcpy(buf, b + (off - start), (size_t)got);
+  return got;
+}
+
+/* Read the block at off into b; sets *eof if the file ends inside it */
+static bool direct_edge(int fd, char* b, off_t off, off_t* eof) {
+  ssize_t got = real_pread_(fd, b, kDirectAlign, off);
+  if (got < 0) return false;
+  if (got < kDirectAlign) {
+    memset(b + got, 0, kDirectAlign - got);
+    if (*eof < 0) *eof = off + got;
+  }
+  return true;
+}
+
+static ssize_t direct_pwrite(int fd, const void* buf, size_t n, off_t off) {
+  if (fd < 0 || fd >= kDirectFds || !direct_fd_[fd] || aligned(buf, n, off))
+    return real_dpwrite_(fd, buf, n, off);
+  off_t start = off & ~(off_t)(kDirectAlign - 1);
+  off_t end = (off + (off_t)n + kDirectAlign - 1) & ~(off_t)(kDirectAlign - 1);
+  off_t eof = -1;
+  char* b = bounce((size_t)(end - start));
+  if (start < off && !direct_edge(fd, b, start, &eof)) return -1;
+  if (off + (off_t)n < end && (end - kDirectAlign > start || start == off) &&
+      !direct_edge(fd, b + (end - kDirectAlign - start), end - kDirectAlign,
+                   &eof))
+    return -1;
+  memcpy(b + (off - start), buf, n);
+  if (real_dpwrite_(fd, b, (size_t)(end - start), start) != end - start)
+    return -1;
+  /* The blocks ran past the end of file: put it back where it belongs */
+  if (eof >= 0 && ftruncate(fd, eof > off + (off_t)n ? eof : off + (off_t)n))
+    return -1;
+  return (ssize_t)n;
+}
+
+static int direct_open(sqlite3_vfs* vfs, const char* name, sqlite3_file* file,
+                       int flags, int* out_flags) {
+  (void)vfs;
+  opening_ = (flags & (SQLITE_OPEN_MAIN_DB | SQLITE_OPEN_WAL)) != 0;
+  int rc = unix_->xOpen(unix_, name, file, flags, out_flags);
+  opening_ = false;
+  return rc;
+}
+
+static void direct_install(void) {
+  if (direct_vfs_.zName == NULL) {
+    real_open_ = (int (*)(const char*, int, int))
+                 replace_call("open", (sqlite3_syscall_ptr)direct_open_call);
+    real_close_ = (int (*)(int))
+                  replace_call("close", (sqlite3_syscall_ptr)direct_close);
+    real_pread_ = (ssize_t (*)(int, void*, size_t, off_t))
+                  replace_call("pread", (sqlite3_syscall_ptr)direct_pread);
+    real_dpwrite_ = (ssize_t (*)(int, const void*, size_t, off_t))
+                    replace_call("pwrite", (sqlite3_syscall_ptr)direct_pwrite);
+    pthread_key_create(&bounce_key_, bounce_free);
+    direct_vfs_ = *unix_;
+    direct_vfs_.zName = "direct";
+    direct_vfs_.xOpen = direct_open;
+    direct_vfs_.pNext = NULL;
+  }
+  sqlite3_vfs_register(&direct_vfs_, 1);
+}
+#endif
+
+/*
+ * Make VFS name the default.  SQLite must be initialized; a later
+ * sqlite3_shutdown() and reinitialization makes unix the default again,
+ * so this is called after each.
+ */
+void vfs_install(const char* name) {
+  if (!strcmp(name, "unix")) {
+    sqlite3_vfs* vfs = sqlite3_vfs_find("unix");
+    if (vfs != NULL) sqlite3_vfs_register(vfs, 1);
+#ifdef __linux__
+  } else if (!strcmp(name, "uring")) {
+    uring_install();
+  } else if (!strcmp(name, "direct")) {
+    direct_install();
+#endif
+  } else {
+    fprintf(stderr, "unknown vfs '%s'\n", name);
+    exit(1);
+  }
+}
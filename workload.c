@@ -0,0 +1,334 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+/*
+ * Workload specs for the workload benchmark.
+ *
+ * A spec is a text file of "name = value" lines; '#' starts a comment.
+ * "[name]" starts a phase, and the phases run in file order.  Lines
+ * before the first phase set defaults for all phases.
+ *
+ *   mix      = read:80,write:15,scan:4,delete:1   percent of each op
+ *   keys     = uniform | sequential | zipf:THETA | hot:KEYS[:OPS]
+ *              (hot: OPS percent of ops, default all, go to the first
+ *              KEYS percent of the key space)
+ *   keyspace = INT        keys are 0..INT-1 (default --num)
+ *   values   = INT | uniform:MIN:MAX   value size (default --value_size)
+ *   batch    = INT        ops per transaction (default 1, no transaction)
+ *   threads  = INT        threads, each on its own connection if > 1
+ *   ops      = INT        ops to run over all threads
+ *   duration = SECONDS    or run for this long instead
+ *   rate     = OPS/S      pace all threads to this rate (default 0, none)
+ *   scan     = INT        rows per scan (default 100)
+ *   sync     = 0|1        synchronous=FULL rather than OFF
+ *
+ * Everything a phase needs per op is worked out here once: the mix becomes
+ * a table indexed by a random percentile, and zipf its constants.
+ */
+
+typedef struct SpecReader {
+  const char* path_;
+  int line_;
+} SpecReader;
+
+static void spec_error(const SpecReader* r, const char* what, const char* s) {
+  fprintf(stderr, "workload: %s:%d: %s '%s'\n", r->path_, r->line_, what, s);
+  exit(1);
+}
+
+static void parse_mix(const SpecReader* r, WorkloadPhase* p, const char* v) {
+  static const char* const names[kWorkOps] = {
+    "read", "write", "scan", "delete"
+  };
+  const char* s = v;
+  memset(p->mix_, 0, sizeof(p->mix_));
+  while (*s != 0) {
+    char name[16];
+    int pct, len, op;
+    if (sscanf(s, " %15[a-z] : %d%n", name, &pct, &len) != 2 || pct < 0)
+      spec_error(r, "bad mix", v);
+    for (op = 0; op < kWorkOps && strcmp(name, names[op]); op++) {}
+    if (op == kWorkOps) spec_error(r, "unknown op in mix", name);
+    p->mix_[op] += pct;
+    s += len;
+    while (isspace((unsigned char)*s)) s++;
+    if (*s == ',') s++;
+    else if (*s != 0) spec_error(r, "bad mix", v);
+  }
+}
+
+static void parse_keys(const SpecReader* r, WorkloadPhase* p, const char* v) {
+  double a, b = 100;
+  char junk;
+  if (!strcmp(v, "uniform")) {
+    p->keys_ = KEYS_UNIFORM;
+  } else if (!strcmp(v, "sequential")) {
+    p->keys_ = KEYS_SEQUENTIAL;
+  } else if (sscanf(v, "zipf:%lf%c", &a, &junk) == 1 && a > 0 && a < 1) {
+    p->keys_ = KEYS_ZIPF;
+    p->theta_ = a;
+  } else if ((sscanf(v, "hot:%lf%c", &a, &junk) == 1 ||
+              sscanf(v, "hot:%lf:%lf%c", &a, &b, &junk) == 2) &&
+             a > 0 && a <= 100 && b >= 0 && b <= 100) {
+    p->keys_ = KEYS_HOT;
+    p->hot_ = a / 100;
+    p->hot_ops_ = b / 100;
+  } else {
+    spec_error(r, "bad keys (uniform, sequential, zipf:THETA with 0 < THETA < 1"
+               " or hot:KEYS[:OPS])", v);
+  }
+}
+
+static void parse_values(const SpecReader* r, WorkloadPhase* p, const char* v) {
+  int a, b;
+  char junk;
+  if (sscanf(v, "%d%c", &a, &junk) == 1 && a >= 0) {
+    p->value_min_ = p->value_max_ = a;
+  } else if (sscanf(v, "fixed:%d%c", &a, &junk) == 1 && a >= 0) {
+    p->value_min_ = p->value_max_ = a;
+  } else if (sscanf(v, "uniform:%d:%d%c", &a, &b, &junk) == 2 &&
+             a >= 0 && b >= a) {
+    p->value_min_ = a;
+    p->value_max_ = b;
+  } else {
+    spec_error(r, "bad values (INT or uniform:MIN:MAX)", v);
+  }
+}
+
+static void set_field(const SpecReader* r, WorkloadPhase* p, const char* name,
+                      const char* v) {
+  long long n;
+  double d;
+  char junk;
+  if (!strcmp(name, "mix")) {
+    parse_mix(r, p, v);
+  } else if (!strcmp(name, "keys")) {
+    parse_keys(r, p, v);
+  } else if (!strcmp(name, "values")) {
+    parse_values(r, p, v);
+  } else if (!strcmp(name, "keyspace")) {
+    if (sscanf(v, "%lld%c", &n, &junk) != 1 || n < 1)
+      spec_error(r, "bad keyspace", v);
+    p->keyspace_ = n;
+  } else if (!strcmp(name, "batch")) {
+    if (sscanf(v, "%lld%c", &n, &junk) != 1 || n < 1)
+      spec_error(r, "bad batch", v);
+    p->batch_ = (int)n;
+  } else if (!strcmp(name, "threads")) {
+    if (sscanf(v, "%lld%c", &n, &junk) != 1 || n < 1 || n > 1024)
+      spec_error(r, "bad threads", v);
+    p->threads_ = (int)n;
+  } else if (!strcmp(name, "ops")) {
+    if (sscanf(v, "%lld%c", &n, &junk) != 1 || n < 0)
+      spec_error(r, "bad ops", v);
+    p->ops_ = n;
+  } else if (!strcmp(name, "duration")) {
+    if (sscanf(v, "%lf%c", &d, &junk) != 1 || d < 0)
+      spec_error(r, "bad duration", v);
+    p->duration_ = d;
+  } else if (!strcmp(name, "rate")) {
+    if (sscanf(v, "%lf%c", &d, &junk) != 1 || d < 0)
+      spec_error(r, "bad rate", v);
+    p->rate_ = d;
+  } else if (!strcmp(name, "scan")) {
+    if (sscanf(v, "%lld%c", &n, &junk) != 1 || n < 1)
+      spec_error(r, "bad scan", v);
+    p->scan_ = (int)n;
+  } else if (!strcmp(name, "sync")) {
+    if (sscanf(v, "%lld%c", &n, &junk) != 1 || (n != 0 && n != 1))
+      spec_error(r, "bad sync", v);
+    p->sync_ = n == 1;
+  } else {
+    spec_error(r, "unknown setting", name);
+  }
+}
+
+static double zeta(int64_t n, double theta) {
+  double sum = 0;
+  for (int64_t i = 1; i <= n; i++) sum += 1.0 / pow((double)i, theta);
+  return sum;
+}
+
+static uint64_t gcd(uint64_t a, uint64_t b) {
+  while (b != 0) {
+    uint64_t t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+/* a * b mod n without overflow, for a, b < n */
+static uint64_t mul_mod(uint64_t a, uint64_t b, uint64_t n) {
+  if (a < (1ull << 32) && b < (1ull << 32)) return a * b % n;
+  uint64_t r = 0;
+  for (a %= n; b != 0; b >>= 1) {
+    if (b & 1) r = r >= n - a ? r - (n - a) : r + a;
+    a = a >= n - a ? a - (n - a) : a + a;
+  }
+  return r;
+}
+
+/* Check a phase and work out its op table and zipf constants */
+static void finish_phase(const SpecReader* r, WorkloadPhase* p) {
+  int total = 0;
+  for (int op = 0; op < kWorkOps; op++) {
+    for (int i = 0; i < p->mix_[op]; i++) {
+      if (total + i < 100) p->op_table_[total + i] = (unsigned char)op;
+    }
+    total += p->mix_[op];
+  }
+  if (total != 100) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%s: %d%%", p->name_, total);
+    spec_error(r, "mix does not add up to 100 in phase", buf);
+  }
+  if (p->ops_ == 0 && p->duration_ == 0) p->ops_ = p->keyspace_;
+  if (p->keys_ == KEYS_ZIPF) {
+    p->zeta2_ = zeta(2, p->theta_);
+    p->zetan_ = zeta(p->keyspace_, p->theta_);
+    p->alpha_ = 1.0 / (1.0 - p->theta_);
+    p->eta_ = (1.0 - pow(2.0 / p->keyspace_, 1.0 - p->theta_)) /
+              (1.0 - p->zeta2_ / p->zetan_);
+    /* rank * scatter_ mod keyspace_ is a permutation of the key space
+     * when the two are coprime; near the golden ratio of it, neighbouring
+     * ranks land far apart */
+    uint64_t n = (uint64_t)p->keyspace_;
+    p->scatter_ = (uint64_t)(n * 0.6180339887498949);
+    if (p->scatter_ == 0) p->scatter_ = 1;
+    while (gcd(p->scatter_, n) != 1) p->scatter_++;
+  }
+}
+
+/*
+ * Read the spec at path into w; exits on any error.  keyspace and
+ * value_size are the defaults for phases that do not set them.
+ */
+void workload_load(Workload* w, const char* path, int64_t keyspace,
+                   int value_size) {
+  WorkloadPhase defaults;
+  WorkloadPhase* p = &defaults;
+  SpecReader r;
+  char line[1024];
+  int capacity = 0;
+
+  FILE* f = fopen(path, "r");
+  if (f == NULL) {
+    fprintf(stderr, "workload: cannot open '%s'\n", path);
+    exit(1);
+  }
+  memset(&defaults, 0, sizeof(defaults));
+  defaults.mix_[WORK_READ] = 100;
+  defaults.keys_ = KEYS_UNIFORM;
+  defaults.keyspace_ = keyspace;
+  defaults.value_min_ = defaults.value_max_ = value_size;
+  defaults.batch_ = 1;
+  defaults.threads_ = 1;
+  defaults.scan_ = 100;
+  w->phases_ = NULL;
+  w->count_ = 0;
+  r.path_ = path;
+  r.line_ = 0;
+
+  while (fgets(line, sizeof(line), f) != NULL) {
+    r.line_++;
+    char* hash = strchr(line, '#');
+    if (hash != NULL) *hash = 0;
+    char* s = trim_space(line);
+    if (*s == 0) continue;
+
+    if (*s == '[') {
+      char* end = strchr(s, ']');
+      if (end == NULL || end[1] != 0 || end == s + 1 ||
+          end - s - 1 >= (int)sizeof(p->name_))
+        spec_error(&r, "bad phase name", s);
+      if (w->count_ > 0) finish_phase(&r, p);
+      if (w->count_ == capacity) {
+        capacity = capacity == 0 ? 8 : capacity * 2;
+        w->phases_ = (WorkloadPhase*)realloc(w->phases_,
+                                             capacity * sizeof(WorkloadPhase));
+      }
+      p = &w->phases_[w->count_++];
+      *p = defaults;
+      *end = 0;
+      strcpy(p->name_, trim_space(s + 1));
+      continue;
+    }
+
+    char* eq = strchr(s, '=');
+    if (eq == NULL) spec_error(&r, "expected name = value", s);
+    *eq = 0;
+    set_field(&r, p, trim_space(s), trim_space(eq + 1));
+  }
+  fclose(f);
+  if (w->count_ == 0) {
+    fprintf(stderr, "workload: %s has no [phase]\n", path);
+    exit(1);
+  }
+  finish_phase(&r, p);
+}
+
+void workload_free(Workload* w) {
+  free(w->phases_);
+  w->phases_ = NULL;
+  w->count_ = 0;
+}
+
+int workload_op(const WorkloadPhase* p, Random* rnd) {
+  return p->op_table_[rand_next(rnd) % 100];
+}
+
+/* A uniform double in [0, 1) */
+static double rand_double(Random* rnd) {
+  return (rand_next(rnd) - 1) / 2147483646.0;
+}
+
+/* A uniform integer in [0, n), n up to 2^62 */
+static int64_t rand_below(Random* rnd, int64_t n) {
+  uint64_t r = ((uint64_t)rand_next(rnd) << 31) ^ rand_next(rnd);
+  return (int64_t)(r % (uint64_t)n);
+}
+
+/*
+ * The next key of phase p; next is the thread's position for sequential
+ * keys.  Zipf is YCSB's generator (Gray et al., "Quickly generating
+ * billion-record synthetic databases"), with the ranks scattered over the
+ * key space so the hot keys do not sit in a few pages.
+ */
+int64_t workload_key(const WorkloadPhase* p, Random* rnd, int64_t* next) {
+  int64_t n = p->keyspace_;
+  switch (p->keys_) {
+    case KEYS_SEQUENTIAL: {
+      int64_t k = *next;
+      *next = k + 1 < n ? k + 1 : 0;
+      return k;
+    }
+    case KEYS_ZIPF: {
+      double u = rand_double(rnd);
+      double uz = u * p->zetan_;
+      int64_t rank;
+      if (uz < 1.0) rank = 0;
+      else if (uz < 1.0 + pow(0.5, p->theta_)) rank = 1;
+      else rank = (int64_t)(n * pow(p->eta_ * u - p->eta_ + 1.0, p->alpha_));
+      if (rank >= n) rank = n - 1;
+      return (int64_t)mul_mod((uint64_t)rank, p->scatter_ % (uint64_t)n,
+                              (uint64_t)n);
+    }
+    case KEYS_HOT: {
+      int64_t hot = (int64_t)(n * p->hot_);
+      if (hot < 1) hot = 1;
+      if (hot >= n || rand_double(rnd) < p->hot_ops_) return rand_below(rnd, hot);
+      return hot + rand_below(rnd, n - hot);
+    }
+    default:
+      return rand_below(rnd, n);
+  }
+}
+
+int workload_value_size(const WorkloadPhase* p, Random* rnd) {
+  if (p->value_max_ == p->value_min_) return p->value_min_;
+  return p->value_min_ + (int)(rand_next(rnd) % (p->value_max_ - p->value_min_ + 1));
+}